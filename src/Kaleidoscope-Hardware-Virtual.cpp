@@ -19,10 +19,15 @@
 #include <Kaleidoscope.h>
 #include "Kaleidoscope-Hardware-Virtual.h"
 #include "virtual_io.h"
+#include "timeline.h"
+#include "checkpoint.h"
+#include "virtual_clock.h"
+#include "virtual_library.h"
 #include <iostream>
-#include <sstream>
 #include <string>
-#include <iomanip>
+#include <string.h>
+#include <stdlib.h>
+#include <ctype.h>
 
 Virtual::Virtual(void)
   :  _readMatrixEnabled(true) {
@@ -61,18 +66,55 @@ typedef struct {
   uint8_t col;
 } rc;
 
-static rc getRCfromPhysicalKey(std::string keyname);
+static rc getRCfromPhysicalKey(const std::string& keyname);
+
+// Prints e.g. "Unrecognized command: foo" without allocating
+static void printTokenError(const char* message, const std::string& token) {
+  static char line[256];
+  const int length = snprintf(line, sizeof(line), "%s: %s", message, token.c_str());
+  printConsole(line, (length < (int)sizeof(line)) ? length : sizeof(line) - 1);
+}
+
+// Parses the number from 'start' up to 'end'; FALSE unless it is all digits
+static bool parseIndex(const char* start, const char* end, unsigned long& value) {
+  if (start == end || !isdigit((unsigned char)*start)) return false;
+  char* stop;
+  value = strtoul(start, &stop, 10);
+  return stop == end;
+}
+
+// LEDControl syncs the LEDs on a timer, which --fast-forward would skip over.
+// While the syncs keep coming, the next one is expected as long after the last
+// as that was after the one before, and registered as a deadline.
+static uint64_t lastLedSync = 0;
+static uint64_t ledSyncInterval = 0;  // 0 until there have been two syncs
+static bool anyLedSync = false;
+
+static void registerLedSyncDeadline(void) {
+  if (ledSyncInterval && lastLedSync + ledSyncInterval > virtualClockMicros()) {
+    virtualClockDeadline(lastLedSync + ledSyncInterval);
+  }
+}
+
+// Reused, so that tokens never allocate once it has grown.  Not restored from
+// checkpoints, as it points into the heap.
+static std::string token CHECKPOINT_EXCLUDED;
 
 void Virtual::readMatrix() {
 
   if (!_readMatrixEnabled) return;
+  TimelineScope span(TIMELINE_READ_MATRIX);
 
-  std::stringstream sline;
-  sline << getLineOfInput(anythingHeld());
+  const std::string& line = getLineOfInput(anythingHeld());
+  size_t pos = 0;
   Mode mode = M_TAP;
   while (true) {
-    std::string token;
-    std::getline(sline, token, ' ');
+    // tokens are separated by single spaces
+    if (pos >= line.size()) break; // end of line
+    size_t spacepos = line.find(' ', pos);
+    if (spacepos == std::string::npos) spacepos = line.size();
+    token.assign(line, pos, spacepos - pos);
+    pos = spacepos + 1;
     if (token == "") break; // end of line
     else if (token == "#") break; // skip the rest of the line
     else if ((token == "?" || token == "help") && isInteractive()) {
@@ -96,20 +138,27 @@ void Virtual::readMatrix() {
       if (token.front() == '(' && token.back() == ')') {
         size_t commapos = token.find_first_of(',');
         if (commapos == std::string::npos) {
-          std::cout << "Bad (r,c) pair: " << token << std::endl;
+          printTokenError("Bad (r,c) pair", token);
           continue;
         } else {
-          key.row = std::stoi(token.substr(1, commapos - 1));
-          key.col = std::stoi(token.substr(commapos + 1, token.length() - commapos - 1));
-          if (key.row >= ROWS || key.col >= COLS) {
-            std::cout << "Bad coordinates: " << token << std::endl;
+          const char* text = token.c_str();
+          unsigned long row, col;
+          if (!parseIndex(text + 1, text + commapos, row) ||
+              !parseIndex(text + commapos + 1, text + token.size() - 1, col)) {
+            printTokenError("Bad (r,c) pair", token);
             continue;
           }
+          if (row >= ROWS || col >= COLS) {
+            printTokenError("Bad coordinates", token);
+            continue;
+          }
+          key.row = row;
+          key.col = col;
         }
       } else {
         key = getRCfromPhysicalKey(token);
         if (key.row >= ROWS || key.col >= COLS) {
-          std::cout << "Unrecognized command: " << token << std::endl;
+          printTokenError("Unrecognized command", token);
           continue;
         }
       }
@@ -125,11 +174,31 @@ void Virtual::setKeystate(byte row, byte col, keystate ks) {
   keystates[row][col] = ks;
 }
 
+// On the timeline, only the events for keys that are or were pressed get a span;
+// idle keys would drown them out
+static void handleKeyswitchEventTimed(byte row, byte col, uint8_t keyState) {
+  if (!keyState || !timelineRecords(TIMELINE_HANDLE_KEYSWITCH_EVENT)) {
+    handleKeyswitchEvent(Key_NoKey, row, col, keyState);
+    return;
+  }
+  TimelineScope span(TIMELINE_HANDLE_KEYSWITCH_EVENT, row << 16 | col << 8 | keyState);
+  handleKeyswitchEvent(Key_NoKey, row, col, keyState);
+}
+
 Virtual::keystate Virtual::getKeystate(byte row, byte col) const {
    return keystates[row][col];
 }
 
+// For the library build's test drivers (see cores/virtual/virtual_library.h)
+int virtualSetKeystate(unsigned row, unsigned col, int keystate) {
+  if (row >= ROWS || col >= COLS || keystate < VIRTUAL_KEY_PRESSED || keystate > VIRTUAL_KEY_TAP) return 0;
+  KeyboardHardware.setKeystate(row, col, (Virtual::keystate)keystate);
+  return 1;
+}
+
 void Virtual::actOnMatrixScan() {
+  TimelineScope span(TIMELINE_ACT_ON_MATRIX_SCAN);
+  bool active = false;  // any key pressed, held or released
   for (byte row = 0; row < ROWS; row++) {
     for (byte col = 0; col < COLS; col++) {
       uint8_t keyState = 0;
@@ -155,19 +224,22 @@ void Virtual::actOnMatrixScan() {
         /* do nothing */
         break;
       }
-      handleKeyswitchEvent(Key_NoKey, row, col, keyState);
+      if (keyState) active = true;
+      handleKeyswitchEventTimed(row, col, keyState);
       keystates_prev[row][col] = keystates[row][col];
       if (keystates[row][col] == TAP) {
         keyState = WAS_PRESSED & ~IS_PRESSED;
-        handleKeyswitchEvent(Key_NoKey, row, col, keyState);
+        handleKeyswitchEventTimed(row, col, keyState);
         keystates[row][col] = NOT_PRESSED;
         keystates_prev[row][col] = NOT_PRESSED;
       }
     }
   }
+  setMatrixActive(active);
+  registerLedSyncDeadline();
 }
 
-static rc getRCfromPhysicalKey(std::string keyname) {
+static rc getRCfromPhysicalKey(const std::string& keyname) {
   if (keyname == "prog") return {0, 0};
   else if (keyname == "1") return {0, 1};
   else if (keyname == "2") return {0, 2};
@@ -262,15 +334,13 @@ void Virtual::maskHeldKeys(void) {
 }
 
 void Virtual::syncLeds(void) {
-  // log format: red.green.blue where values are written in hex; followed by a space, followed by the next LED
-  std::stringstream ss;
-  ss << std::hex;
-  for (byte i = 0; i < LED_COUNT; i++) {
-    const cRGB state = ledStates[i];
-    ss << (unsigned int)state.r << "." << (unsigned int)state.g << "." << (unsigned int)state.b << " ";
-  }
-  ss << std::endl;
-  logLEDStates(ss.str());
+  TimelineScope span(TIMELINE_SYNC_LEDS);
+  logLEDFrame(ledStates, LED_COUNT);  // cRGB is r, g, b
+  const uint64_t now = virtualClockMicros();
+  if (anyLedSync) ledSyncInterval = now - lastLedSync;
+  lastLedSync = now;
+  anyLedSync = true;
+  registerLedSyncDeadline();
 }
 
 void Virtual::setCrgbAt(byte row, byte col, cRGB color) {
@@ -1,5 +1,4 @@
 #include "ConsumerControl.h"
-#include <iostream>
 #include "virtual_io.h"
 
 ConsumerControl_::ConsumerControl_(void) {}
@@ -49,8 +48,7 @@ void ConsumerControl_::sendReport() {
 }
 
 void ConsumerControl_::sendReportUnchecked() {
-  std::cout << "A virtual ConsumerControl HID report was sent." << std::endl;
-  logUSBEvent("ConsumerControl HID report", &_report, sizeof(_report));
+  logHIDReport(USB_ENDPOINT_CONSUMER_CONTROL, &_report, sizeof(_report));
 }
 
 ConsumerControl_ ConsumerControl;
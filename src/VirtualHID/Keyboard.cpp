@@ -1,6 +1,4 @@
 #include "Keyboard.h"
-#include <iostream>
-#include <sstream>
 #include "virtual_io.h"
 #include <assert.h>
 
@@ -80,23 +78,62 @@ uint8_t Keyboard_::getLEDs() {
   return 0;
 }
 
-// For each bit set in 'bitfield', output the corresponding string to 'stream'
-#define FOREACHBIT(bitfield, stream, str0, str1, str2, str3, str4, str5, str6, str7) \
-  if((bitfield) & 1<<0) stream << str0; \
-  if((bitfield) & 1<<1) stream << str1; \
-  if((bitfield) & 1<<2) stream << str2; \
-  if((bitfield) & 1<<3) stream << str3; \
-  if((bitfield) & 1<<4) stream << str4; \
-  if((bitfield) & 1<<5) stream << str5; \
-  if((bitfield) & 1<<6) stream << str6; \
-  if((bitfield) & 1<<7) stream << str7;
+// Names of the keys, indexed by bit position in HID_KeyboardReport_Data_t::allkeys
+// (the eight modifiers first, then one bit per HID usage starting at 0x00).
+// Keys past the last named one are only summarized as "(other)".
+#define NAMED_KEY_BITS (8 * 18)
+static const char* const keyNames[NAMED_KEY_BITS] = {
+  "lctrl", "lshift", "lalt", "lgui", "rctrl", "rshift", "ralt", "rgui",
+  "NO_EVENT", "ERROR_ROLLOVER", "POST_FAIL", "ERROR_UNDEFINED", "a", "b", "c", "d",
+  "e", "f", "g", "h", "i", "j", "k", "l",
+  "m", "n", "o", "p", "q", "r", "s", "t",
+  "u", "v", "w", "x", "y", "z", "1/!", "2/@",
+  "3/#", "4/$", "5/%", "6/^", "7/&", "8/*", "9/(", "0/)",
+  "enter", "esc", "del/bksp", "tab", "space", "-/_", "=/+", "[/{",
+  "]/}", "\\/|", "#/~", ";/:", "'/\"", "`/~", ",/<", "./>",
+  "//?", "capslock", "F1", "F2", "F3", "F4", "F5", "F6",
+  "F7", "F8", "F9", "F10", "F11", "F12", "prtscr", "scrolllock",
+  "pause", "ins", "home", "pgup", "del", "end", "pgdn", "r_arrow",
+  "l_arrow", "d_arrow", "u_arrow", "numlock", "num/", "num*", "num-", "num+",
+  "numenter", "num1", "num2", "num3", "num4", "num5", "num6", "num7",
+  "num8", "num9", "num0", "num.", "\\/|", "app", "power", "num=",
+  "F13", "F14", "F15", "F16", "F17", "F18", "F19", "F20",
+  "F21", "F22", "F23", "F24", "exec", "help", "menu", "sel",
+  "stop", "again", "undo", "cut", "copy", "paste", "find", "mute",
+  "volup", "voldn", "capslock_l", "numlock_l", "scrolllock_l", "num,", "num=", "(other)",
+};
+
+#define MAX_KEY_NAME_LENGTH 18  // sign, longest key name, space
+#define KEY_TEXT_SIZE (8 * sizeof(HID_KeyboardReport_Data_t) * MAX_KEY_NAME_LENGTH + 1)
+
+static inline size_t appendKeyName(char* out, const char* name) {
+  const size_t length = strlen(name);
+  memcpy(out, name, length);
+  out[length] = ' ';
+  return length + 1;
+}
+
+// Prints "<consolePrefix><keys>" and logs "<usbPrefix><keys>", without allocating
+static void publishKeyText(const char* consolePrefix, const char* usbPrefix, const char* keys, size_t length) {
+  static char line[64 + KEY_TEXT_SIZE];
+  size_t prefixLength = strlen(consolePrefix);
+  memcpy(line, consolePrefix, prefixLength);
+  memcpy(line + prefixLength, keys, length);
+  printConsole(line, prefixLength + length);
+  prefixLength = strlen(usbPrefix);
+  memcpy(line, usbPrefix, prefixLength);
+  memcpy(line + prefixLength, keys, length);
+  logUSBEvent_keyboard(line, prefixLength + length);
+}
 
 int Keyboard_::sendReport(void) {
   // Following KeyboardioHID, we only send report if it differs from previous report.
   if (!memcmp(_lastKeyReport.allkeys, _keyReport.allkeys, sizeof(_keyReport))) return -1;
 
+  logHIDReport(USB_ENDPOINT_KEYBOARD, &_keyReport, sizeof(_keyReport));
+
   assert(_keyboardReportConsumer);
-  _keyboardReportConsumer->processKeyboardReport(_keyReport);
+  _keyboardReportConsumer->processKeyboardReportChange(_lastKeyReport, _keyReport);
 
   memcpy(_lastKeyReport.allkeys, _keyReport.allkeys, sizeof(_keyReport));
 
@@ -111,7 +148,8 @@ void Keyboard_::setKeyboardReportConsumer(
 
 void StandardKeyboardReportConsumer::processKeyboardReport(
   const HID_KeyboardReport_Data_t &reportData) {
-  std::stringstream keypresses;
+  static char keypresses[KEY_TEXT_SIZE];
+  size_t length = 0;
   bool anything = false;
   if (reportData.modifiers) anything = true;
   else for (int i = 0; i < KEY_BYTES; i++) if (reportData.keys[i]) {
@@ -119,61 +157,63 @@ void StandardKeyboardReportConsumer::processKeyboardReport(
         break;
       }
   if (!anything) {
-    keypresses << "none";
+    memcpy(keypresses, "none", 4);
+    length = 4;
   } else {
-    FOREACHBIT(reportData.modifiers, keypresses,
-               "lctrl ", "lshift ", "lalt ", "lgui ",
-               "rctrl ", "rshift ", "ralt ", "rgui ")
-    FOREACHBIT(reportData.keys[0], keypresses,
-               "NO_EVENT ", "ERROR_ROLLOVER ", "POST_FAIL ", "ERROR_UNDEFINED ",
-               "a ", "b ", "c ", "d ")
-    FOREACHBIT(reportData.keys[1], keypresses,
-               "e ", "f ", "g ", "h ", "i ", "j ", "k ", "l ")
-    FOREACHBIT(reportData.keys[2], keypresses,
-               "m ", "n ", "o ", "p ", "q ", "r ", "s ", "t ")
-    FOREACHBIT(reportData.keys[3], keypresses,
-               "u ", "v ", "w ", "x ", "y ", "z ", "1/! ", "2/@ ")
-    FOREACHBIT(reportData.keys[4], keypresses,
-               "3/# ", "4/$ ", "5/% ", "6/^ ", "7/& ", "8/* ", "9/( ", "0/) ")
-    FOREACHBIT(reportData.keys[5], keypresses,
-               "enter ", "esc ", "del/bksp ", "tab ",
-               "space ", "-/_ ", "=/+ ", "[/{ ")
-    FOREACHBIT(reportData.keys[6], keypresses,
-               "]/} ", "\\/| ", "#/~ ", ";/: ", "'/\" ", "`/~ ", ",/< ", "./> ")
-    FOREACHBIT(reportData.keys[7], keypresses,
-               "//? ", "capslock ", "F1 ", "F2 ", "F3 ", "F4 ", "F5 ", "F6 ")
-    FOREACHBIT(reportData.keys[8], keypresses,
-               "F7 ", "F8 ", "F9 ", "F10 ", "F11 ", "F12 ", "prtscr ", "scrolllock ")
-    FOREACHBIT(reportData.keys[9], keypresses,
-               "pause ", "ins ", "home ", "pgup ", "del ", "end ", "pgdn ", "r_arrow ")
-    FOREACHBIT(reportData.keys[10], keypresses,
-               "l_arrow ", "d_arrow ", "u_arrow ", "numlock ",
-               "num/ ", "num* ", "num- ", "num+ ")
-    FOREACHBIT(reportData.keys[11], keypresses,
-               "numenter ", "num1 ", "num2 ", "num3 ",
-               "num4 ", "num5 ", "num6 ", "num7 ")
-    FOREACHBIT(reportData.keys[12], keypresses,
-               "num8 ", "num9 ", "num0 ", "num. ", "\\/| ", "app ", "power ", "num= ")
-    FOREACHBIT(reportData.keys[13], keypresses,
-               "F13 ", "F14 ", "F15 ", "F16 ", "F17 ", "F18 ", "F19 ", "F20 ")
-    FOREACHBIT(reportData.keys[14], keypresses,
-               "F21 ", "F22 ", "F23 ", "F24 ", "exec ", "help ", "menu ", "sel ")
-    FOREACHBIT(reportData.keys[15], keypresses,
-               "stop ", "again ", "undo ", "cut ", "copy ", "paste ", "find ", "mute ")
-    FOREACHBIT(reportData.keys[16], keypresses,
-               "volup ", "voldn ", "capslock_l ", "numlock_l ",
-               "scrolllock_l ", "num, ", "num= ", "(other) ")
-    for (int i = 17; i < KEY_BYTES; i++) {
+    for (int bit = 0; bit < NAMED_KEY_BITS; bit++) {
+      if (reportData.allkeys[bit / 8] & (1 << (bit % 8))) length += appendKeyName(keypresses + length, keyNames[bit]);
+    }
+    for (int i = NAMED_KEY_BITS / 8; i < 1 + KEY_BYTES; i++) {
       // A little imprecise, in two ways:
       //   (1) obviously, "(other)" refers to many distinct keys
       //   (2) this might undercount the number of "other" keys pressed
       // Therefore, if any keys are frequently used, they should be handled above and not via "other"
-      if (reportData.keys[i]) keypresses << "(other) ";
+      if (reportData.allkeys[i]) length += appendKeyName(keypresses + length, "(other)");
     }
   }
 
-  std::cout << "Sent virtual HID report. Pressed keys: " << keypresses.str() << std::endl;
-  logUSBEvent_keyboard("Keyboard HID report; pressed keys: " + keypresses.str());
+  publishKeyText("Sent virtual HID report. Pressed keys: ", "Keyboard HID report; pressed keys: ", keypresses, length);
+}
+
+// The report bitmap is compared 64 bits at a time.  On a little-endian host, bit b of
+// allkeys[i] lands in bit 8 * (i % 8) + b of word i / 8, so a bit's index within the
+// words is also its index into keyNames.
+#define REPORT_WORDS ((sizeof(HID_KeyboardReport_Data_t) + 7) / 8)
+static void loadReportWords(const HID_KeyboardReport_Data_t &reportData, uint64_t words[REPORT_WORDS]) {
+  memset(words, 0, REPORT_WORDS * sizeof(uint64_t));
+  memcpy(words, reportData.allkeys, sizeof(reportData.allkeys));
+}
+
+void StandardKeyboardReportConsumer::processKeyboardReportChange(
+  const HID_KeyboardReport_Data_t &lastReportData,
+  const HID_KeyboardReport_Data_t &reportData) {
+  if (!reportKeyboardEdges()) {
+    processKeyboardReport(reportData);
+    return;
+  }
+
+  uint64_t before[REPORT_WORDS], after[REPORT_WORDS];
+  loadReportWords(lastReportData, before);
+  loadReportWords(reportData, after);
+
+  static char edges[KEY_TEXT_SIZE];
+  size_t length = 0;
+  for (unsigned w = 0; w < REPORT_WORDS; w++) {
+    uint64_t changed = before[w] ^ after[w];
+    while (changed) {
+      const unsigned bit = __builtin_ctzll(changed);
+      const unsigned index = w * 64 + bit;
+      edges[length++] = ((after[w] >> bit) & 1) ? '+' : '-';
+      if (index < NAMED_KEY_BITS) {
+        length += appendKeyName(edges + length, keyNames[index]);
+      } else {
+        length += snprintf(edges + length, MAX_KEY_NAME_LENGTH, "0x%02x", index - 8);  // HID usage
+        edges[length++] = ' ';
+      }
+      changed &= changed - 1;
+    }
+  }
+  publishKeyText("Sent virtual HID report. Key changes: ", "Keyboard HID report; key changes: ", edges, length);
 }
 
 Keyboard_ Keyboard;
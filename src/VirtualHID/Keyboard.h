@@ -27,6 +27,14 @@ class KeyboardReportConsumer_ {
   virtual ~KeyboardReportConsumer_() {}
   virtual void processKeyboardReport(
     const HID_KeyboardReport_Data_t &reportData) = 0;
+
+  // Called by Keyboard_::sendReport() with both the previously sent report and the new one.
+  // Consumers that only care about the new state don't need to override this.
+  virtual void processKeyboardReportChange(
+    const HID_KeyboardReport_Data_t &lastReportData,
+    const HID_KeyboardReport_Data_t &reportData) {
+    processKeyboardReport(reportData);
+  }
 };
 
 class StandardKeyboardReportConsumer : public KeyboardReportConsumer_ {
@@ -34,6 +42,12 @@ class StandardKeyboardReportConsumer : public KeyboardReportConsumer_ {
 
   virtual void processKeyboardReport(
     const HID_KeyboardReport_Data_t &reportData) override;
+
+  // With --keyboard-edges, prints only the keys that were pressed or released
+  // (e.g. "+a -lshift") instead of the full list of pressed keys
+  virtual void processKeyboardReportChange(
+    const HID_KeyboardReport_Data_t &lastReportData,
+    const HID_KeyboardReport_Data_t &reportData) override;
 };
 
 class Keyboard_ {
@@ -1,5 +1,4 @@
 #include "Mouse.h"
-#include <iostream>
 #include "virtual_io.h"
 
 Mouse_::Mouse_(void) {}
@@ -53,8 +52,7 @@ void Mouse_::sendReport() {
 }
 
 void Mouse_::sendReportUnchecked() {
-  std::cout << "A virtual Mouse HID report was sent." << std::endl;
-  logUSBEvent("Mouse HID report", &report, sizeof(report));
+  logHIDReport(USB_ENDPOINT_MOUSE, &report, sizeof(report));
 }
 
 Mouse_ Mouse;
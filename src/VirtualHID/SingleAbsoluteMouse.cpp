@@ -1,20 +1,87 @@
 #include "SingleAbsoluteMouse.h"
-#include <iostream>
 #include "virtual_io.h"
 
-SingleAbsoluteMouse_::SingleAbsoluteMouse_(void) {}
+// Logical range of the absolute axes, as declared in KeyboardioHID's report descriptor
+#define ABSOLUTE_AXIS_MAX 32767
+
+SingleAbsoluteMouse_::SingleAbsoluteMouse_(void)
+  :  xAxis(0), yAxis(0), _buttons(0) {
+  memset(&_lastReport, 0, sizeof(_lastReport));
+}
+
+// The rest of the interface is essentially taken directly from KeyboardioHID's AbsoluteMouseAPI
+void SingleAbsoluteMouse_::begin(void) {
+  end();
+}
+void SingleAbsoluteMouse_::end(void) {
+  _buttons = 0;
+  moveTo(xAxis, yAxis, 0);
+}
+
+void SingleAbsoluteMouse_::click(uint8_t b) {
+  _buttons = b;
+  moveTo(xAxis, yAxis, 0);
+  _buttons = 0;
+  moveTo(xAxis, yAxis, 0);
+}
+
+void SingleAbsoluteMouse_::moveTo(uint16_t x, uint16_t y, signed char wheel) {
+  xAxis = x;
+  yAxis = y;
+  HID_MouseAbsoluteReport_Data_t report;
+  report.buttons = _buttons;
+  report.xAxis = x;
+  report.yAxis = y;
+  report.wheel = wheel;
+  sendReport(&report, sizeof(report));
+}
+
+void SingleAbsoluteMouse_::move(int x, int y, signed char wheel) {
+  // clamp to the logical range rather than wrapping around the screen
+  x = constrain(xAxis + x, 0, ABSOLUTE_AXIS_MAX);
+  y = constrain(yAxis + y, 0, ABSOLUTE_AXIS_MAX);
+  moveTo(x, y, wheel);
+}
+
+void SingleAbsoluteMouse_::buttons(uint8_t b) {
+  if (b != _buttons) {
+    _buttons = b;
+    moveTo(xAxis, yAxis, 0);
+  }
+}
+
+void SingleAbsoluteMouse_::press(uint8_t b) {
+  buttons(_buttons | b);
+}
+
+void SingleAbsoluteMouse_::release(uint8_t b) {
+  buttons(_buttons & ~b);
+}
+
+void SingleAbsoluteMouse_::releaseAll(void) {
+  _buttons = 0;
+  moveTo(xAxis, yAxis, 0);
+}
+
+bool SingleAbsoluteMouse_::isPressed(uint8_t b) {
+  return ((b & _buttons) > 0);
+}
 
 void SingleAbsoluteMouse_::sendReport(void* data, int length) {
-  std::cout << "A virtual SingleAbsoluteMouse HID report was sent." << std::endl;
-  logUSBEvent("SingleAbsoluteMouse HID report", data, length);
+  // Don't send if this report is identical to the last one, as it would have no
+  // effect on the host - unless it scrolls, since wheel movement is relative
+  const HID_MouseAbsoluteReport_Data_t* report = (const HID_MouseAbsoluteReport_Data_t*)data;
+  if (length == sizeof(_lastReport) &&
+      memcmp(&_lastReport, data, sizeof(_lastReport)) == 0 &&
+      report->wheel == 0)
+    return;
+
+  sendReportUnchecked(data, length);
+  if (length == sizeof(_lastReport)) memcpy(&_lastReport, data, sizeof(_lastReport));
 }
 
-// Everything else is stubs for now - no effect
-void SingleAbsoluteMouse_::begin(void) {}
-void SingleAbsoluteMouse_::move(signed char x, signed char y, signed char wheel) {}
-void SingleAbsoluteMouse_::moveTo(uint16_t x, uint16_t y, signed char wheel) {}
-void SingleAbsoluteMouse_::click(uint8_t buttons) {}
-void SingleAbsoluteMouse_::press(uint8_t buttons) {}
-void SingleAbsoluteMouse_::release(uint8_t buttons) {}
+void SingleAbsoluteMouse_::sendReportUnchecked(void* data, int length) {
+  logHIDReport(USB_ENDPOINT_ABSOLUTE_MOUSE, data, length);
+}
 
 SingleAbsoluteMouse_ SingleAbsoluteMouse;
@@ -4,20 +4,43 @@
 // with the goal of having an almost identical interface, with different implementation
 
 #include <Arduino.h>
+#include "Mouse.h"  // MOUSE_LEFT etc.
+
+typedef union {
+  // Absolute mouse report: 8 buttons, 2 absolute axes, wheel
+  struct {
+    uint8_t buttons;
+    uint16_t xAxis;
+    uint16_t yAxis;
+    int8_t wheel;
+  } __attribute__((packed));
+} HID_MouseAbsoluteReport_Data_t;
 
 class SingleAbsoluteMouse_ {
  public:
   SingleAbsoluteMouse_(void);
   void begin(void);
-  void move(signed char x, signed char y, signed char wheel);
-  void moveTo(uint16_t x, uint16_t y, signed char wheel);
-  void click(uint8_t buttons);
-  void press(uint8_t buttons);
-  void release(uint8_t buttons);
+  void end(void);
+  void click(uint8_t b = MOUSE_LEFT);
+  void moveTo(uint16_t x, uint16_t y, signed char wheel = 0);
+  void move(int x, int y, signed char wheel = 0);
+  void press(uint8_t b = MOUSE_LEFT);   // press LEFT by default
+  void release(uint8_t b = MOUSE_LEFT); // release LEFT by default
+  void releaseAll(void);
+  bool isPressed(uint8_t b = MOUSE_LEFT); // check LEFT by default
 
   void sendReport(void* data, int length);
-};
 
-extern SingleAbsoluteMouse_ SingleAbsoluteMouse;
+ protected:
+  uint16_t xAxis;
+  uint16_t yAxis;
+  uint8_t _buttons;
+  HID_MouseAbsoluteReport_Data_t _lastReport;
 
+  void buttons(uint8_t b);
 
+ private:
+  void sendReportUnchecked(void* data, int length);
+};
+
+extern SingleAbsoluteMouse_ SingleAbsoluteMouse;
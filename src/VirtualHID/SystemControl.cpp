@@ -1,5 +1,4 @@
 #include "SystemControl.h"
-#include <iostream>
 #include "virtual_io.h"
 
 SystemControl_::SystemControl_(void) {}
@@ -28,8 +27,7 @@ void SystemControl_::press(uint8_t s) {
 }
 
 void SystemControl_::sendReport(void* data, int length) {
-  std::cout << "A virtual SystemControl HID report with value " << *(uint8_t*)data << " was sent." << std::endl;
-  logUSBEvent("SystemControl HID report", data, length);
+  logHIDReport(USB_ENDPOINT_SYSTEM_CONTROL, data, length);
 }
 
 SystemControl_ SystemControl;
@@ -1,27 +1,25 @@
 #include "Arduino.h"
+#include "virtual_clock.h"
 
-// TODO: better time emulation
-// this is pretty hacky, but hopefully helps most code behave sanely
+// Time is virtual: it advances by the scan period once per cycle (see
+// virtual_clock.h), so reading it has no side effects.
 // note: 'weak' attribute allows users to override with their own implementation of millis()
 __attribute__((weak))
 unsigned long millis(void) {
-  static unsigned long time = 0;
-  return time++;
+  return virtualClockMicros() / 1000;
 }
+__attribute__((weak))
 unsigned long micros(void) {
-  return millis()*1000;
+  return virtualClockMicros();
 }
 
 
-// yes, these are pretty stupid with the current millis() and micros()
-// but hopefully they stays fine if/when we get a better millis() and micros()
+// Nothing else runs while the sketch waits, so waiting just moves the clock
 
 void delay(unsigned long ms) {
-  unsigned long end = millis() + ms;
-  while(millis() < end);
+  virtualClockAdvance((uint64_t)ms * 1000);
 }
 
 void delayMicroseconds(unsigned int us) {
-  unsigned long end = micros() + us;
-  while(micros() < end);
+  virtualClockAdvance(us);
 }
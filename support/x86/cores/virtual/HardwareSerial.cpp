@@ -1,15 +1,24 @@
 #include "HardwareSerial.h"
 #include "Arduino.h"
+#include "virtual_io.h"
 
 // see comments in the real HardwareSerial.cpp
 void serialEvent() {}
 void serialEvent1() {}
 void serialEvent2() {}
 void serialEvent3() {}
-bool Serial0_available() {}
-bool Serial1_available() {}
-bool Serial2_available() {}
-bool Serial3_available() {}
+bool Serial0_available() {
+  return false;
+}
+bool Serial1_available() {
+  return false;
+}
+bool Serial2_available() {
+  return false;
+}
+bool Serial3_available() {
+  return false;
+}
 
 void serialEventRun(void) {
   if (Serial0_available && serialEvent && Serial0_available()) serialEvent();
@@ -20,27 +29,30 @@ void serialEventRun(void) {
 
 unsigned HardwareSerial::serialNumber = 0;
 
-HardwareSerial::HardwareSerial() {}
+HardwareSerial::HardwareSerial()
+  :  port(-1) {
+}
 
+// Output for each begin() goes to its own results/serial_N.txt
 void HardwareSerial::begin(unsigned long baud, byte config) {
-  char filename[64];
-  snprintf(filename, 64, "results/serial_%u.txt", serialNumber++);
-  out = fopen(filename, "w");
+  port = serialNumber++;
+  logSerial(port, NULL, 0);
 }
 
 void HardwareSerial::end() {
-  if (out) fclose(out);
+  if (port >= 0) flushSerial(port);
+  port = -1;
 }
 
 int HardwareSerial::availableForWrite(void) {
-  return out ? 1000 : 0;
+  return (port >= 0) ? 1000 : 0;
 }
 size_t HardwareSerial::write(uint8_t c) {
-  if (out) fputc(c, out);
+  if (port >= 0) logSerial(port, &c, 1);
   return 1;
 }
 void HardwareSerial::flush(void) {
-  if (out) fflush(out);
+  if (port >= 0) flushSerial(port);
 }
 
 // TODO make input serial connections better.
@@ -36,7 +36,7 @@ class HardwareSerial : public Stream {
   }
  private:
   static unsigned serialNumber;
-  FILE* out;
+  int port;  // -1 until begin()
 };
 // The default Arduino core only provides each of these HardwareSerial objects if
 // various things are #defined.  We always provide them for virtual hardware.
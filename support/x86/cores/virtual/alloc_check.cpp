@@ -0,0 +1,54 @@
+#include "alloc_check.h"
+#include <new>
+#include <stdlib.h>
+
+#ifdef KALEIDOSCOPE_VIRTUAL_LIBRARY
+// A shared library's operator new would replace the host process's as well
+unsigned long threadAllocations(void) {
+  return 0;
+}
+#else
+// Replaces the global allocation functions; everything the C++ standard library
+// allocates goes through these
+static thread_local unsigned long allocations = 0;
+
+unsigned long threadAllocations(void) {
+  return allocations;
+}
+
+void* operator new(size_t size) {
+  allocations++;
+  void* p = malloc(size ? size : 1);
+  if (!p) abort();  // no exceptions in this build
+  return p;
+}
+
+void* operator new[](size_t size) {
+  return operator new(size);
+}
+
+void* operator new(size_t size, const std::nothrow_t&) noexcept {
+  allocations++;
+  return malloc(size ? size : 1);
+}
+
+void* operator new[](size_t size, const std::nothrow_t&) noexcept {
+  return operator new(size, std::nothrow);
+}
+
+void operator delete(void* p) noexcept {
+  free(p);
+}
+
+void operator delete[](void* p) noexcept {
+  free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+  free(p);
+}
+
+void operator delete[](void* p, size_t) noexcept {
+  free(p);
+}
+#endif
@@ -0,0 +1,7 @@
+#pragma once
+
+// Counts heap allocations made through operator new.  The count is kept per
+// thread, so the simulation thread can check that a cycle didn't allocate
+// regardless of what the event bus thread is doing.
+// Not counted (always 0) in the library build, which leaves operator new alone.
+unsigned long threadAllocations(void);
@@ -0,0 +1,228 @@
+#include "checkpoint.h"
+#include "virtual_clock.h"
+#include <vector>
+#include <stdio.h>
+#include <string.h>
+#include <link.h>  // dl_iterate_phdr()
+#include <sys/stat.h>
+
+#define CHECKPOINT_MAGIC "KVCHKPT1"
+#define CHECKPOINT_VERSION 1
+#define BUILD_ID_SIZE 64
+
+typedef struct {
+  char magic[8];  // CHECKPOINT_MAGIC
+  uint32_t version;
+  uint32_t buildIdLength;
+  uint8_t buildId[BUILD_ID_SIZE];
+  uint32_t cycle;
+  uint32_t scanPeriod;
+  uint64_t clockMicros;
+  uint32_t regions;  // followed by as many CheckpointRegions, then their contents in order
+  uint32_t reserved;
+} CheckpointHeader;
+
+#ifndef KALEIDOSCOPE_VIRTUAL_LIBRARY
+// From the default linker script (and crt1.o's __data_start)
+extern char __data_start[], _edata[], __bss_start[], _end[];
+#endif
+// From checkpoint.ld; null if the executable wasn't linked with it
+extern char __virtual_core_data_start[] __attribute__((weak));
+extern char __virtual_core_data_end[] __attribute__((weak));
+extern char __virtual_core_bss_start[] __attribute__((weak));
+extern char __virtual_core_bss_end[] __attribute__((weak));
+
+// Adds what's left of [start, end) once the 'count' excluded ranges are cut out of it
+static void addRegion(std::vector<CheckpointRegion>& regions, uint64_t start, uint64_t end,
+                      const CheckpointRegion* excluded, size_t count) {
+  for (size_t i = 0; i < count && start < end; i++) {
+    const uint64_t cutStart = excluded[i].address, cutEnd = excluded[i].address + excluded[i].size;
+    if (cutEnd <= start || cutStart >= end) continue;
+    if (cutStart > start) addRegion(regions, start, cutStart, excluded + i + 1, count - i - 1);
+    start = cutEnd;
+  }
+  if (start < end) {
+    CheckpointRegion region = {start, end - start};
+    regions.push_back(region);
+  }
+}
+
+#ifdef KALEIDOSCOPE_VIRTUAL_LIBRARY
+typedef struct {
+  std::vector<CheckpointRegion> segments;  // writable
+  CheckpointRegion relro;  // writable only while it's relocated
+} LibrarySegments;
+
+// The segments of the shared library this is in
+static int findLibrarySegments(struct dl_phdr_info* info, size_t size, void* data) {
+  LibrarySegments* library = (LibrarySegments*)data;
+  const uint64_t here = (uint64_t)(void*)findLibrarySegments;
+  bool found = false;
+  for (int i = 0; i < info->dlpi_phnum; i++) {
+    const ElfW(Phdr)& segment = info->dlpi_phdr[i];
+    const uint64_t start = info->dlpi_addr + segment.p_vaddr;
+    if (segment.p_type == PT_LOAD && here >= start && here < start + segment.p_memsz) found = true;
+  }
+  if (!found) return 0;
+  for (int i = 0; i < info->dlpi_phnum; i++) {
+    const ElfW(Phdr)& segment = info->dlpi_phdr[i];
+    const CheckpointRegion region = {info->dlpi_addr + segment.p_vaddr, segment.p_memsz};
+    if (segment.p_type == PT_LOAD && (segment.p_flags & PF_W)) library->segments.push_back(region);
+    else if (segment.p_type == PT_GNU_RELRO) library->relro = region;
+  }
+  return 1;
+}
+#endif
+
+bool checkpointRegions(std::vector<CheckpointRegion>& regions) {
+  if (!__virtual_core_data_start || !__virtual_core_bss_start) {
+    fprintf(stderr, "Error: checkpoints need the executable to be linked with cores/virtual/checkpoint.ld\n");
+    return false;
+  }
+  const CheckpointRegion core[] = {
+    {(uint64_t)__virtual_core_data_start, (uint64_t)(__virtual_core_data_end - __virtual_core_data_start)},
+    {(uint64_t)__virtual_core_bss_start, (uint64_t)(__virtual_core_bss_end - __virtual_core_bss_start)},
+  };
+  regions.clear();
+#ifdef KALEIDOSCOPE_VIRTUAL_LIBRARY
+  // a shared library's data has no linker-defined bounds: its writable segments, less RELRO
+  LibrarySegments library;
+  library.relro.address = library.relro.size = 0;
+  dl_iterate_phdr(findLibrarySegments, &library);
+  const CheckpointRegion excluded[] = {core[0], core[1], library.relro};
+  for (size_t i = 0; i < library.segments.size(); i++) {
+    const CheckpointRegion& segment = library.segments[i];
+    addRegion(regions, segment.address, segment.address + segment.size, excluded, 3);
+  }
+#else
+  addRegion(regions, (uint64_t)__data_start, (uint64_t)_edata, core, 2);
+  addRegion(regions, (uint64_t)__bss_start, (uint64_t)_end, core, 2);
+#endif
+  return true;
+}
+
+typedef struct {
+  bool relocated;  // a PIE, loaded at a different address each run
+  uint32_t length;
+  uint8_t id[BUILD_ID_SIZE];
+} BuildId;
+
+// The executable is the first object dl_iterate_phdr() visits
+static int findBuildId(struct dl_phdr_info* info, size_t size, void* data) {
+  BuildId* buildId = (BuildId*)data;
+  buildId->relocated = info->dlpi_addr != 0;
+  for (int i = 0; i < info->dlpi_phnum; i++) {
+    const ElfW(Phdr)& segment = info->dlpi_phdr[i];
+    if (segment.p_type != PT_NOTE) continue;
+    const char* note = (const char*)(info->dlpi_addr + segment.p_vaddr);
+    const char* notesEnd = note + segment.p_memsz;
+    while (note + sizeof(ElfW(Nhdr)) <= notesEnd) {
+      const ElfW(Nhdr)* header = (const ElfW(Nhdr)*)note;
+      const char* name = note + sizeof(ElfW(Nhdr));
+      const char* desc = name + ((header->n_namesz + 3) & ~3u);
+      if (header->n_type == NT_GNU_BUILD_ID && header->n_namesz == 4 && memcmp(name, "GNU", 4) == 0 &&
+          header->n_descsz <= BUILD_ID_SIZE) {
+        buildId->length = header->n_descsz;
+        memcpy(buildId->id, desc, header->n_descsz);
+        return 1;
+      }
+      note = desc + ((header->n_descsz + 3) & ~3u);
+    }
+  }
+  return 1;
+}
+
+static bool getBuildId(BuildId& buildId) {
+  memset(&buildId, 0, sizeof(buildId));
+  dl_iterate_phdr(findBuildId, &buildId);
+  if (buildId.relocated) {
+    fprintf(stderr, "Error: checkpoints need the executable to be linked with -no-pie\n");
+    return false;
+  }
+  if (!buildId.length) {
+    fprintf(stderr, "Error: checkpoints need the executable to be linked with -Wl,--build-id\n");
+    return false;
+  }
+  return true;
+}
+
+bool checkpointSave(const char* path, uint32_t cycle, uint64_t clockMicros) {
+  BuildId buildId;
+  std::vector<CheckpointRegion> regions;
+  if (!getBuildId(buildId) || !checkpointRegions(regions)) return false;
+
+  CheckpointHeader header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, CHECKPOINT_MAGIC, sizeof(header.magic));
+  header.version = CHECKPOINT_VERSION;
+  header.buildIdLength = buildId.length;
+  memcpy(header.buildId, buildId.id, buildId.length);
+  header.cycle = cycle;
+  header.scanPeriod = virtualClockPeriod();
+  header.clockMicros = clockMicros;
+  header.regions = regions.size();
+
+  FILE* file = fopen(path, "wb");
+  if (!file) {
+    fprintf(stderr, "Error opening checkpoint %s\n", path);
+    return false;
+  }
+  bool written = fwrite(&header, sizeof(header), 1, file) == 1 &&
+                 fwrite(regions.data(), sizeof(CheckpointRegion), regions.size(), file) == regions.size();
+  for (size_t i = 0; i < regions.size() && written; i++) {
+    written = fwrite((const void*)regions[i].address, 1, regions[i].size, file) == regions[i].size;
+  }
+  if (fclose(file) != 0) written = false;
+  if (!written) fprintf(stderr, "Error writing checkpoint %s\n", path);
+  return written;
+}
+
+bool checkpointRestore(const char* path, uint32_t* cycle, uint64_t* clockMicros) {
+  BuildId buildId;
+  std::vector<CheckpointRegion> regions;
+  if (!getBuildId(buildId) || !checkpointRegions(regions)) return false;
+
+  FILE* file = fopen(path, "rb");
+  if (!file) {
+    fprintf(stderr, "Error opening checkpoint %s\n", path);
+    return false;
+  }
+  CheckpointHeader header;
+  std::vector<CheckpointRegion> saved;
+  const char* problem = NULL;
+  if (fread(&header, sizeof(header), 1, file) != 1 || memcmp(header.magic, CHECKPOINT_MAGIC, sizeof(header.magic)) != 0) {
+    problem = "not a checkpoint";
+  } else if (header.version != CHECKPOINT_VERSION) {
+    problem = "saved by a different version";
+  } else if (header.buildIdLength != buildId.length || memcmp(header.buildId, buildId.id, buildId.length) != 0) {
+    problem = "saved by a different build of the sketch";
+  } else if (header.scanPeriod != virtualClockPeriod()) {
+    problem = "saved with a different --scan-period";
+  } else if (header.regions != regions.size()) {
+    problem = "its memory layout doesn't match";
+  } else {
+    saved.resize(regions.size());
+    if (fread(saved.data(), sizeof(CheckpointRegion), saved.size(), file) != saved.size() ||
+        memcmp(saved.data(), regions.data(), saved.size() * sizeof(CheckpointRegion)) != 0) {
+      problem = "its memory layout doesn't match";
+    }
+  }
+  if (!problem) {
+    // checked before anything is overwritten, so a short file can't leave memory half restored
+    uint64_t expected = sizeof(header) + regions.size() * sizeof(CheckpointRegion);
+    for (size_t i = 0; i < regions.size(); i++) expected += regions[i].size;
+    struct stat info;
+    if (fstat(fileno(file), &info) != 0 || (uint64_t)info.st_size != expected) problem = "its size doesn't match";
+  }
+  for (size_t i = 0; i < regions.size() && !problem; i++) {
+    if (fread((void*)regions[i].address, 1, regions[i].size, file) != regions[i].size) problem = "unreadable";
+  }
+  fclose(file);
+  if (problem) {
+    fprintf(stderr, "Error: can't restore checkpoint %s: %s\n", path, problem);
+    return false;
+  }
+  *cycle = header.cycle;
+  *clockMicros = header.clockMicros;
+  return true;
+}
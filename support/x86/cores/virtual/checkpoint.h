@@ -0,0 +1,46 @@
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+
+// Checkpoints of a run (--checkpoint=CYCLES:FILE, --restore=FILE).
+//
+// A checkpoint is the executable's writable data and bss, apart from the
+// simulator core's own (core.a's, which checkpoint.ld gathers into sections of
+// their own) and copies of shared-library objects such as std::cout, along
+// with the cycle number and the virtual clock.  That covers the sketch, its
+// plugins, the Virtual hardware and the HID report state.  Restoring one
+// reads it straight back into place, after setup() has run as usual, so the
+// run goes on from where the checkpointed one was, at the end of that cycle.
+//
+// The heap isn't saved: the simulator's own buffers and streams share it, and
+// their layout depends on the options and paths, and the allocator's state is
+// in libc.  Firmware is expected not to allocate (see --check-allocations).
+// Nor is libc's state, e.g. random()'s.
+//
+// Only the very same executable (by its GNU build-id) can restore a
+// checkpoint, and it has to be linked with -no-pie so that its data is at the
+// same addresses every time (platform.txt does both).
+
+// For the few variables outside the core that mustn't be restored, such as
+// those pointing into the heap
+#define CHECKPOINT_EXCLUDED __attribute__((section(".bss.checkpoint_excluded")))
+
+typedef struct {
+  uint64_t address;
+  uint64_t size;
+} CheckpointRegion;
+
+// The memory a checkpoint holds (and that --time-travel snapshots).  Returns
+// FALSE after printing an error if the executable wasn't linked with
+// checkpoint.ld.
+bool checkpointRegions(std::vector<CheckpointRegion>& regions);
+
+// Returns FALSE after printing an error if the file can't be written, or if
+// this build can't checkpoint
+bool checkpointSave(const char* path, uint32_t cycle, uint64_t clockMicros);
+
+// Returns FALSE after printing an error if the file can't be read or wasn't
+// saved by this build, with the same --scan-period; memory is only
+// overwritten once all that has been checked
+bool checkpointRestore(const char* path, uint32_t* cycle, uint64_t* clockMicros);
@@ -0,0 +1,286 @@
+#include "corpus.h"
+#include "virtual_io.h"
+#include <iostream>
+#include <fstream>
+#include <map>
+#include <utility>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+typedef struct {
+  std::string path;
+  std::string outputDir;
+} CorpusScript;
+
+// A line of input shared by every script through this node; the root (node 0) has none
+struct CorpusNode {
+  std::string line;
+  std::vector<unsigned> children;  // nodes
+  std::vector<unsigned> endings;  // scripts whose last line this is
+  unsigned scripts;  // ending here or further down
+};
+
+static std::vector<CorpusScript> scripts;
+static std::vector<CorpusNode> nodes;
+static bool enabled = false;
+static unsigned current = 0;  // the node this process has reached
+static bool determined = false;  // down to one script, with its outputs open
+// Exit status of each script once reported, or -1; shared by all the processes
+static int* statuses = NULL;
+static unsigned samples = 0;
+static std::vector<std::string> standaloneOptions;
+
+bool corpusLoad(const char* listPath, const std::string& defaultOutputDir) {
+  std::ifstream list(listPath);
+  if (!list) {
+    std::cerr << "Error opening corpus list \"" << listPath << "\"" << std::endl;
+    return false;
+  }
+  std::map<std::pair<unsigned, std::string>, unsigned> childNodes;
+  nodes.resize(1);
+  nodes[0].scripts = 0;
+  std::string entry, line;
+  while (std::getline(list, entry)) {
+    if (entry.empty() || entry[0] == '#') continue;
+    const size_t spacepos = entry.find(' ');
+    CorpusScript script;
+    script.path = entry.substr(0, spacepos);
+    script.outputDir = runOutputDir(script.path.c_str(), (spacepos == std::string::npos) ? defaultOutputDir : entry.substr(spacepos + 1));
+    std::ifstream in(script.path.c_str());
+    if (!in) {
+      std::cerr << "Error opening input file \"" << script.path << "\"" << std::endl;
+      return false;
+    }
+    unsigned node = 0;
+    nodes[0].scripts++;
+    while (std::getline(in, line)) {
+      const std::pair<unsigned, std::string> key(node, line);
+      std::map<std::pair<unsigned, std::string>, unsigned>::const_iterator found = childNodes.find(key);
+      if (found == childNodes.end()) {
+        CorpusNode child;
+        child.line = line;
+        child.scripts = 0;
+        nodes.push_back(child);
+        nodes[node].children.push_back(nodes.size() - 1);
+        found = childNodes.insert(std::make_pair(key, (unsigned)nodes.size() - 1)).first;
+      }
+      node = found->second;
+      nodes[node].scripts++;
+    }
+    nodes[node].endings.push_back(scripts.size());
+    scripts.push_back(script);
+  }
+  if (scripts.empty()) {
+    std::cerr << "Error: no scripts in corpus list \"" << listPath << "\"" << std::endl;
+    return false;
+  }
+  void* shared = mmap(NULL, scripts.size() * sizeof(int), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (shared == MAP_FAILED) {
+    std::cerr << "Error: can't map memory for the corpus run" << std::endl;
+    return false;
+  }
+  statuses = (int*)shared;
+  for (size_t i = 0; i < scripts.size(); i++) statuses[i] = -1;
+  enabled = true;
+  return true;
+}
+
+bool corpusEnabled(void) {
+  return enabled;
+}
+
+void corpusSetVerify(unsigned count, const std::vector<std::string>& options) {
+  samples = count;
+  standaloneOptions = options;
+}
+
+// Every script ending at 'node' or further down
+static void scriptsUnder(unsigned node, std::vector<unsigned>& found) {
+  std::vector<unsigned> pending(1, node);
+  while (!pending.empty()) {
+    const CorpusNode& next = nodes[pending.back()];
+    pending.pop_back();
+    found.insert(found.end(), next.endings.begin(), next.endings.end());
+    pending.insert(pending.end(), next.children.begin(), next.children.end());
+  }
+}
+
+static void report(unsigned script, int status) {
+  if (statuses[script] != -1) return;
+  statuses[script] = status;
+  if (WIFSIGNALED(status)) std::cout << "signal " << WTERMSIG(status);
+  else std::cout << "exit " << WEXITSTATUS(status);
+  std::cout << " " << scripts[script].path << " " << scripts[script].outputDir << std::endl;
+}
+
+// Reports the scripts under 'node' that no process has reported yet: the one
+// the process that ended there was left with, or all of them if it ended early
+static void reportUnder(unsigned node, int status) {
+  std::vector<unsigned> found;
+  scriptsUnder(node, found);
+  for (size_t i = 0; i < found.size(); i++) report(found[i], status);
+}
+
+// This process is down to 'script': open its outputs, which also hands the
+// output held so far to them
+static void beginScript(unsigned script) {
+  determined = true;
+  if (!beginRunOutputs(scripts[script].path.c_str(), scripts[script].outputDir)) exit(1);
+}
+
+bool corpusNextLine(std::string& line) {
+  const CorpusNode& node = nodes[current];
+  // the ways on from here: first the scripts that end here, then the children
+  const unsigned ways = node.endings.size() + node.children.size();
+  unsigned way = ways - 1;
+  for (unsigned other = 0; other + 1 < ways; other++) {
+    std::cout.flush();  // or the child would write it again
+    fflush(NULL);
+    const pid_t pid = fork();
+    if (pid == 0) {
+      way = other;
+      break;
+    }
+    int status = W_EXITCODE(1, 0);
+    if (pid < 0) std::cerr << "Error: fork failed, errno " << errno << std::endl;
+    else waitpid(pid, &status, 0);
+    if (other < node.endings.size()) report(node.endings[other], status);
+    else reportUnder(node.children[other - node.endings.size()], status);
+  }
+  if (way < node.endings.size()) {
+    if (!determined) beginScript(node.endings[way]);
+    return false;
+  }
+  current = node.children[way - node.endings.size()];
+  if (!determined && nodes[current].scripts == 1) {
+    std::vector<unsigned> found;
+    scriptsUnder(current, found);
+    beginScript(found[0]);
+  }
+  line = nodes[current].line;
+  return true;
+}
+
+static bool readFile(const std::string& path, std::string& contents) {
+  std::ifstream in(path.c_str(), std::ios::binary);
+  if (!in) return false;
+  contents.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+  return true;
+}
+
+// Wall-clock timings, and a recorder that only starts once a run is down to one script
+static bool comparable(const char* name) {
+  return strcmp(name, "timeline.json") != 0 && strcmp(name, "flight.bin") != 0;
+}
+
+// Whether the files in directories 'a' and 'b' are the same; if not, 'why' says which isn't
+static bool sameFiles(const std::string& a, const std::string& b, std::string& why) {
+  for (int pass = 0; pass < 2; pass++) {
+    const std::string& from = pass ? b : a;
+    const std::string& to = pass ? a : b;
+    DIR* dir = opendir(from.c_str());
+    if (!dir) {
+      why = from + " is missing";
+      return false;
+    }
+    while (struct dirent* entry = readdir(dir)) {
+      const std::string path = from + "/" + entry->d_name;
+      struct stat info;
+      if (stat(path.c_str(), &info) != 0 || !S_ISREG(info.st_mode) || !comparable(entry->d_name)) continue;
+      std::string ours, theirs;
+      // the second pass only looks for files missing from 'a'
+      if (!readFile(path, ours) || !readFile(to + "/" + entry->d_name, theirs) || (!pass && ours != theirs)) {
+        why = std::string(entry->d_name) + " differs";
+        closedir(dir);
+        return false;
+      }
+    }
+    closedir(dir);
+  }
+  return true;
+}
+
+static void removeDirectory(const std::string& path) {
+  DIR* dir = opendir(path.c_str());
+  if (!dir) return;
+  while (struct dirent* entry = readdir(dir)) {
+    if (strcmp(entry->d_name, ".") != 0 && strcmp(entry->d_name, "..") != 0) unlink((path + "/" + entry->d_name).c_str());
+  }
+  closedir(dir);
+  rmdir(path.c_str());
+}
+
+// Runs 'script' standalone, with its output in 'dir'; returns its exit status
+static int runStandalone(const CorpusScript& script, const std::string& dir) {
+  mkdir(dir.c_str(), S_IRWXU | S_IRWXG | S_IROTH | S_IXOTH);
+  std::vector<std::string> args(1, "kaleidoscope-virtual");
+  args.insert(args.end(), standaloneOptions.begin(), standaloneOptions.end());
+  args.push_back("--output-dir=" + dir);
+  args.push_back(script.path);
+  std::cout.flush();
+  fflush(NULL);
+  const pid_t pid = fork();
+  if (pid == 0) {
+    std::vector<char*> argv;
+    for (size_t i = 0; i < args.size(); i++) argv.push_back((char*)args[i].c_str());
+    argv.push_back(NULL);
+    const int out = open((dir + "/stdout.txt").c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    const int in = open("/dev/null", O_RDONLY);
+    dup2(out, STDOUT_FILENO);
+    dup2(in, STDIN_FILENO);
+    execv("/proc/self/exe", argv.data());
+    _exit(127);
+  }
+  int status = W_EXITCODE(127, 0);
+  if (pid > 0) waitpid(pid, &status, 0);
+  return status;
+}
+
+// Returns FALSE if any sample differs
+static bool verify(void) {
+  const unsigned count = (samples < scripts.size()) ? samples : scripts.size();
+  bool allSame = true;
+  for (unsigned k = 0; k < count; k++) {
+    const CorpusScript& script = scripts[k * scripts.size() / count];
+    const std::string dir = script.outputDir + ".verify";
+    const int status = runStandalone(script, dir);
+    std::string why;
+    if (status != statuses[&script - &scripts[0]]) {
+      why = "exit status differs";
+    } else if (sameFiles(script.outputDir, dir, why)) {
+      std::cout << "verified " << script.path << std::endl;
+      removeDirectory(dir);
+      continue;
+    }
+    std::cout << "verify failed " << script.path << ": " << why << " (standalone run in " << dir << ")" << std::endl;
+    allSame = false;
+  }
+  return allSame;
+}
+
+void corpusRun(void) {
+  std::cout.flush();
+  fflush(NULL);
+  const pid_t pid = fork();
+  if (pid == 0) {
+    if (nodes[0].scripts == 1) beginScript(0);
+    return;
+  }
+  int status = W_EXITCODE(1, 0);
+  if (pid < 0) std::cerr << "Error: fork failed, errno " << errno << std::endl;
+  else waitpid(pid, &status, 0);
+  reportUnder(0, status);
+  bool ok = verify();
+  for (size_t i = 0; i < scripts.size(); i++) {
+    if (statuses[i] != 0) ok = false;
+  }
+  exit(ok ? 0 : 1);
+}
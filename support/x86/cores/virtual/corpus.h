@@ -0,0 +1,38 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+// Prefix-sharing runs of a corpus of scripts (--corpus=LIST).
+//
+// The scripts are merged into a trie of their lines, one per cycle.  After
+// setup(), a single process walks the trie; where the scripts under it
+// diverge, it forks a child for each other branch and waits for it before
+// going on down the last one itself, so every distinct prefix is simulated
+// exactly once.  The event bus holds all output (see eventBusHold()) until a
+// process is down to a single script; then that script's outputs are opened,
+// so they come out identical to a standalone run's.
+//
+// As each script's run ends, "exit STATUS SCRIPT OUTPUT_DIR" (or "signal N
+// ...") is printed on stdout.  If a run ends in a prefix shared with other
+// scripts (e.g. "Q", or a crash), they all get its status but no output files.
+
+// Reads the list (lines of "SCRIPT [OUTPUT_DIR]", the directory defaulting to
+// 'defaultOutputDir') and every script in it; returns FALSE after printing an
+// error if any can't be read
+bool corpusLoad(const char* listPath, const std::string& defaultOutputDir);
+bool corpusEnabled(void);
+
+// Once the corpus has run, run 'samples' of its scripts (spread evenly over the
+// list) standalone, with these command-line options, and check that every
+// output file and the exit status are the same
+void corpusSetVerify(unsigned samples, const std::vector<std::string>& options);
+
+// After setup(): forks the process that walks the trie, and returns in it.
+// The original process waits for every script to finish, verifies, and exits
+// (with 1 if any script failed or differed).
+void corpusRun(void);
+
+// The line of input for the current cycle in this process, forking first if
+// the scripts diverge here; FALSE at the end of this process's script
+bool corpusNextLine(std::string& line);
@@ -0,0 +1,142 @@
+#include "event_bus.h"
+#include "virtual_io.h"
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <string.h>
+#include <sched.h>  // sched_yield()
+#include <time.h>  // nanosleep()
+
+#define RING_EVENTS 4096  // must be a power of two
+
+static Event ring[RING_EVENTS];
+// Total events published/consumed so far.  Only the simulation thread writes
+// 'published' and only the bus thread writes 'consumed'.
+static std::atomic<unsigned long long> published(0);
+static std::atomic<unsigned long long> consumed(0);
+static std::atomic<bool> stopping(false);
+
+static std::vector<EventSink*> sinks;
+static std::thread* busThread = NULL;
+static bool shutDown = false;
+static std::vector<Event>* held = NULL;  // see eventBusHold()
+
+void eventBusAddSink(EventSink* sink) {
+  sinks.push_back(sink);
+}
+
+bool eventBusRunning(void) {
+  return busThread != NULL;
+}
+
+// Spin briefly, then yield, then sleep; for whichever side is waiting on the other
+static void backoff(unsigned& idle) {
+  idle++;
+  if (idle < 64) return;
+  if (idle < 128) {
+    sched_yield();
+    return;
+  }
+  struct timespec pause = {0, 50000};
+  nanosleep(&pause, NULL);
+}
+
+static void drain(unsigned long long upTo) {
+  unsigned long long next = consumed.load(std::memory_order_relaxed);
+  for (; next < upTo; next++) {
+    const Event& event = ring[next & (RING_EVENTS - 1)];
+    for (size_t i = 0; i < sinks.size(); i++) sinks[i]->consume(event);
+    consumed.store(next + 1, std::memory_order_release);
+  }
+}
+
+static void busLoop(void) {
+  unsigned idle = 0;
+  while (true) {
+    const unsigned long long available = published.load(std::memory_order_acquire);
+    if (available != consumed.load(std::memory_order_relaxed)) {
+      drain(available);
+      idle = 0;
+    } else if (stopping.load(std::memory_order_acquire)) {
+      if (published.load(std::memory_order_acquire) == available) break;
+    } else {
+      backoff(idle);
+    }
+  }
+}
+
+void eventBusHold(void) {
+  if (!held && !busThread) held = new std::vector<Event>;
+}
+
+void eventBusDropHeld(void) {
+  if (held) held->clear();
+}
+
+static Event& reserve(unsigned long long slot);
+
+void eventBusStart(void) {
+  if (busThread) return;
+  busThread = new std::thread(busLoop);
+  if (!held) return;
+  for (size_t i = 0; i < held->size(); i++) {
+    const unsigned long long slot = published.load(std::memory_order_relaxed);
+    memcpy(&reserve(slot), &(*held)[i], sizeof(Event));
+    published.store(slot + 1, std::memory_order_release);
+  }
+  delete held;
+  held = NULL;
+}
+
+static Event& reserve(unsigned long long slot) {
+  unsigned idle = 0;
+  while (slot - consumed.load(std::memory_order_acquire) >= RING_EVENTS) {
+    // Without a bus thread (e.g. before eventBusStart()), drain on this thread instead
+    if (busThread) backoff(idle);
+    else drain(published.load(std::memory_order_relaxed));
+  }
+  return ring[slot & (RING_EVENTS - 1)];
+}
+
+void eventBusPublish(EventType type, uint8_t device, const void* payload, size_t length) {
+  const uint8_t* bytes = (const uint8_t*)payload;
+  const uint32_t cycle = currentCycle();
+  const uint64_t time = currentTimeMicros();
+  do {
+    const unsigned long long slot = published.load(std::memory_order_relaxed);
+    if (held) held->resize(held->size() + 1);
+    Event& event = held ? held->back() : reserve(slot);
+    const size_t chunk = (length > EVENT_PAYLOAD_SIZE) ? EVENT_PAYLOAD_SIZE : length;
+    event.timeMicros = time;
+    event.cycle = cycle;
+    event.type = type;
+    event.device = device;
+    event.flags = (length > chunk) ? EVENT_FLAG_CONTINUED : 0;
+    event.length = chunk;
+    if (chunk) memcpy(event.payload, bytes, chunk);
+    if (!held) published.store(slot + 1, std::memory_order_release);
+    bytes += chunk;
+    length -= chunk;
+  } while (length > 0);
+}
+
+void eventBusSync(void) {
+  const unsigned long long target = published.load(std::memory_order_relaxed);
+  if (!busThread) {
+    drain(target);
+    return;
+  }
+  unsigned idle = 0;
+  while (consumed.load(std::memory_order_acquire) < target) backoff(idle);
+}
+
+void eventBusShutdown(void) {
+  if (shutDown) return;
+  shutDown = true;
+  if (busThread) {
+    stopping.store(true, std::memory_order_release);
+    busThread->join();
+  }
+  drain(published.load(std::memory_order_relaxed));
+  for (size_t i = 0; i < sinks.size(); i++) sinks[i]->finish();
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+// All output of the simulation (HID reports, LED frames, serial bytes, console
+// text) is published as fixed-size events on a single-producer/single-consumer
+// ring.  The simulation thread only copies the event into the ring; the sinks
+// (text files, host models, checkers, ...) run on a background thread that
+// drains it.  At exit the ring is drained completely and every sink's finish()
+// is called in the order the sinks were added, so the final output is
+// deterministic.
+
+typedef enum {
+  EVENT_CYCLE,       // start of cycle 'cycle'; no payload
+  EVENT_REPORT,      // HID report; 'device' is the UsbEndpoint, payload is the raw report
+  EVENT_USB_TEXT,    // description of a report for the USB log (e.g. the keyboard's key list)
+  EVENT_LED_FRAME,   // payload is the r, g, b bytes of every LED
+  EVENT_SERIAL,      // bytes written to serial port number 'device'; empty when the port is opened
+  EVENT_CONSOLE,     // a line of text for stdout (without the newline)
+  EVENT_INPUT,       // the line of input read for the current cycle
+  EVENT_TIMELINE,    // a chunk of timeline records is ready (see timeline.h); 'device' is its number, no payload
+} EventType;
+
+// Set on an event whose payload continues in the next event (of the same type)
+#define EVENT_FLAG_CONTINUED 0x01
+
+#define EVENT_PAYLOAD_SIZE 240
+
+typedef struct {
+  uint64_t timeMicros;
+  uint32_t cycle;
+  uint8_t type;  // EventType
+  uint8_t device;
+  uint8_t flags;
+  uint8_t length;  // of payload
+  uint8_t payload[EVENT_PAYLOAD_SIZE];
+} Event;  // 256 bytes
+
+class EventSink {
+ public:
+  virtual ~EventSink() {}
+  // Called on the bus thread for each event, in the order they were published
+  virtual void consume(const Event& event) = 0;
+  // Called once at exit, after every event has been consumed
+  virtual void finish(void) {}
+};
+
+// Sinks must be added before eventBusStart()
+void eventBusAddSink(EventSink* sink);
+void eventBusStart(void);
+
+// Until eventBusStart(), keep every event published, rather than only as many
+// as fit in the ring, and hand them all to the sinks when it starts.  For runs
+// that are forked after producing output (--fork-server, --corpus), whose
+// outputs are only opened in the child.
+void eventBusHold(void);
+// Forgets the events held so far, e.g. setup()'s output in a run restored from
+// a checkpoint (--restore), whose checkpointed run had it already
+void eventBusDropHeld(void);
+bool eventBusRunning(void);
+
+// Publishes an event stamped with the current cycle and time.  Payloads longer
+// than EVENT_PAYLOAD_SIZE are split across several events.
+void eventBusPublish(EventType type, uint8_t device, const void* payload, size_t length);
+
+// Blocks until every event published so far has been consumed
+void eventBusSync(void);
+
+// Drains the ring and finishes all sinks; called once at exit
+void eventBusShutdown(void);
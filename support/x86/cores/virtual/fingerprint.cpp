@@ -0,0 +1,186 @@
+#include "fingerprint.h"
+#include "event_bus.h"
+#include "virtual_io.h"
+#include <string>
+#include <vector>
+#include <atomic>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdarg.h>
+
+#define FNV_OFFSET_BASIS 0xcbf29ce484222325ULL
+#define FNV_PRIME 0x100000001b3ULL
+
+static bool enabled = false;
+static unsigned interval = 1000;
+static std::string expectedPath;
+static std::atomic<bool> mismatch(false);
+
+void fingerprintSetInterval(unsigned cycles) {
+  interval = cycles ? cycles : 1;
+}
+
+void fingerprintExpect(const char* path) {
+  expectedPath = path;
+}
+
+bool fingerprintEnabled(void) {
+  return enabled;
+}
+
+bool fingerprintMismatch(void) {
+  return mismatch.load(std::memory_order_relaxed);
+}
+
+typedef struct {
+  unsigned cycle;
+  uint64_t hash;
+} Checkpoint;
+
+// The expected fingerprint, if any
+static bool expecting = false;
+static unsigned expectedCycles = 0;
+static uint64_t expectedFinal = 0;
+static std::vector<Checkpoint> expectedCheckpoints;
+
+static bool loadExpected(void) {
+  FILE* file = fopen(expectedPath.c_str(), "r");
+  if (!file) {
+    fprintf(stderr, "Error opening expected fingerprint \"%s\"\n", expectedPath.c_str());
+    return false;
+  }
+  char line[128];
+  bool valid = fgets(line, sizeof(line), file) && strncmp(line, FINGERPRINT_MAGIC " ", strlen(FINGERPRINT_MAGIC) + 1) == 0;
+  bool haveFinal = false;
+  while (valid && fgets(line, sizeof(line), file)) {
+    Checkpoint checkpoint;
+    unsigned long long hash;
+    if (sscanf(line, "final %u %llx", &expectedCycles, &hash) == 2) {
+      expectedFinal = hash;
+      haveFinal = true;
+    } else if (sscanf(line, "interval %u", &interval) == 1) {
+      if (!interval) valid = false;
+    } else if (sscanf(line, "checkpoint %u %llx", &checkpoint.cycle, &hash) == 2) {
+      checkpoint.hash = hash;
+      expectedCheckpoints.push_back(checkpoint);
+    } else {
+      valid = false;
+    }
+  }
+  fclose(file);
+  if (!valid || !haveFinal) {
+    fprintf(stderr, "Error: \"%s\" is not a fingerprint file\n", expectedPath.c_str());
+    return false;
+  }
+  expecting = true;
+  return true;
+}
+
+class FingerprintSink : public EventSink {
+ public:
+  FingerprintSink() : hash(FNV_OFFSET_BASIS), cycles(0), nextExpected(0), failed(false) {}
+
+  virtual void consume(const Event& event) override {
+    switch (event.type) {
+    case EVENT_CYCLE:
+      // every boundary since the last cycle (--fast-forward may have skipped some,
+      // which had no output)
+      for (unsigned at = (cycles + interval - 1) / interval * interval; at <= event.cycle; at += interval) {
+        if (at) checkpoint(at);
+      }
+      cycles = event.cycle + 1;
+      break;
+    case EVENT_REPORT:
+    case EVENT_LED_FRAME:
+    case EVENT_SERIAL:
+      if (event.length == 0) break;  // a serial port being opened isn't output
+      add(event);
+      break;
+    default:
+      break;
+    }
+  }
+
+  virtual void finish(void) override {
+    if (expecting && !failed) {
+      // every checkpoint matched, so the difference (if any) is after the last one
+      const unsigned common = (cycles < expectedCycles) ? cycles : expectedCycles;
+      const unsigned from = common - common % interval;
+      if (cycles != expectedCycles) {
+        fail(from, "the run ended at cycle %u, but the expected one at cycle %u", cycles, expectedCycles);
+      } else if (hash != expectedFinal) {
+        fail(from, "final hash %016llx, expected %016llx", (unsigned long long)hash, (unsigned long long)expectedFinal);
+      }
+    }
+    const std::string path = resultsPath("fingerprint.txt");
+    FILE* file = fopen(path.c_str(), "w");
+    if (!file) {
+      fprintf(stderr, "Error opening %s\n", path.c_str());
+      return;
+    }
+    fprintf(file, "%s %d\n", FINGERPRINT_MAGIC, FINGERPRINT_VERSION);
+    fprintf(file, "final %u %016llx\n", cycles, (unsigned long long)hash);
+    fprintf(file, "interval %u\n", interval);
+    for (size_t i = 0; i < checkpoints.size(); i++) {
+      fprintf(file, "checkpoint %u %016llx\n", checkpoints[i].cycle, (unsigned long long)checkpoints[i].hash);
+    }
+    fclose(file);
+  }
+
+ private:
+  void mix(const uint8_t* bytes, size_t length) {
+    for (size_t i = 0; i < length; i++) hash = (hash ^ bytes[i]) * FNV_PRIME;
+  }
+
+  void add(const Event& event) {
+    const uint8_t header[6] = {
+      event.type, event.device,
+      (uint8_t)event.cycle, (uint8_t)(event.cycle >> 8), (uint8_t)(event.cycle >> 16), (uint8_t)(event.cycle >> 24),
+    };
+    mix(header, sizeof(header));
+    mix(event.payload, event.length);
+  }
+
+  void checkpoint(unsigned cycle) {
+    Checkpoint checkpoint;
+    checkpoint.cycle = cycle;
+    checkpoint.hash = hash;
+    checkpoints.push_back(checkpoint);
+    if (!expecting || failed) return;
+    // the expected checkpoints are in order, and so are these
+    while (nextExpected < expectedCheckpoints.size() && expectedCheckpoints[nextExpected].cycle < cycle) nextExpected++;
+    if (nextExpected == expectedCheckpoints.size() || expectedCheckpoints[nextExpected].cycle != cycle) return;
+    const uint64_t expected = expectedCheckpoints[nextExpected].hash;
+    if (expected != hash) {
+      fail(cycle - interval, "checkpoint hash %016llx at cycle %u, expected %016llx",
+           (unsigned long long)hash, cycle, (unsigned long long)expected);
+    }
+  }
+
+  void fail(unsigned from, const char* format, ...) __attribute__((format(printf, 3, 4))) {
+    failed = true;
+    mismatch.store(true, std::memory_order_relaxed);
+    fprintf(stderr, "Error: output differs from fingerprint %s, first between cycle %u and cycle %u (",
+            expectedPath.c_str(), from, from + interval);
+    va_list args;
+    va_start(args, format);
+    vfprintf(stderr, format, args);
+    va_end(args);
+    fprintf(stderr, ")\n");
+  }
+
+  uint64_t hash;
+  unsigned cycles;  // number of cycles started so far
+  std::vector<Checkpoint> checkpoints;
+  size_t nextExpected;
+  bool failed;
+};
+
+bool fingerprintBegin(void) {
+  static FingerprintSink sink;
+  if (!expectedPath.empty() && !loadExpected()) return false;
+  enabled = true;
+  eventBusAddSink(&sink);
+  return true;
+}
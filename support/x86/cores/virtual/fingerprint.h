@@ -0,0 +1,38 @@
+#pragma once
+
+#include <stdbool.h>
+
+// Fingerprint of a run's output, for golden checks without golden traces.
+//
+// A sink on the event bus folds every HID report, LED frame and chunk of serial
+// output (with its type, device and cycle) into a running 64-bit FNV-1a hash.
+// Every K cycles the running hash is kept as a checkpoint.  At exit the final
+// hash and the checkpoints are written to results/fingerprint.txt:
+//
+//   kaleidoscope-virtual-fingerprint 1
+//   final <cycles> <hash>           all output of cycles 0 to <cycles> - 1
+//   interval <K>
+//   checkpoint <cycle> <hash>       all output of the cycles before <cycle>
+//   ...
+//
+// Two runs produced the same output if their "final" lines are equal.  If they
+// aren't, the first checkpoint that differs bounds the first difference to a
+// window of K cycles, which can then be looked at with --expect-usb or --trace.
+
+#define FINGERPRINT_MAGIC "kaleidoscope-virtual-fingerprint"
+#define FINGERPRINT_VERSION 1
+
+// Settings; these must be applied before fingerprintBegin()
+void fingerprintSetInterval(unsigned cycles);  // default 1000
+// As well as writing the fingerprint, compare it with the one in 'path' as
+// checkpoints are reached.  The interval of that file is used.
+void fingerprintExpect(const char* path);
+
+// Adds the sink to the event bus.  Returns TRUE if successful, FALSE if the
+// expected fingerprint couldn't be read.
+bool fingerprintBegin(void);
+bool fingerprintEnabled(void);
+
+// TRUE once the fingerprint is known to differ from the expected one (the
+// difference has been reported on stderr)
+bool fingerprintMismatch(void);
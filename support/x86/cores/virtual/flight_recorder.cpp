@@ -0,0 +1,104 @@
+#include "flight_recorder.h"
+#include "event_bus.h"
+#include "virtual_io.h"
+#include <string>
+#include <atomic>  // std::atomic_signal_fence()
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+static bool enabled = false;
+static unsigned cyclesKept = 10000;
+
+static FlightHeader* header = NULL;
+static FlightCycleIndex* cycleIndex = NULL;
+static FlightRecord* records = NULL;
+
+void flightRecorderSetCycles(unsigned cycles) {
+  cyclesKept = cycles ? cycles : 1;
+}
+
+bool flightRecorderEnabled(void) {
+  return enabled;
+}
+
+// Only the order of the stores matters: the file is read after this process is
+// gone, so nothing else can observe them out of order except the compiler
+static inline void storeFence(void) {
+  std::atomic_signal_fence(std::memory_order_release);
+}
+
+void flightRecorderRecord(uint8_t type, uint8_t device, const void* payload, unsigned length, uint32_t cycle, uint64_t timeMicros) {
+  if (!enabled) return;
+  uint64_t next = header->recordsWritten;
+  if (type == EVENT_CYCLE) {
+    FlightCycleIndex& entry = cycleIndex[header->cyclesWritten % header->indexEntries];
+    entry.cycle = cycle;
+    entry.firstRecord = next;
+    storeFence();
+    header->cyclesWritten++;
+  }
+  const uint8_t* bytes = (const uint8_t*)payload;
+  if (type == EVENT_SERIAL && next > 0 && length > 0) {
+    // top up the previous record if it holds this port's output from this cycle
+    FlightRecord& last = records[(next - 1) % header->dataRecords];
+    if (last.type == EVENT_SERIAL && last.device == device && last.cycle == cycle && last.length < FLIGHT_PAYLOAD_SIZE) {
+      unsigned chunk = FLIGHT_PAYLOAD_SIZE - last.length;
+      if (chunk > length) chunk = length;
+      memcpy(last.payload + last.length, bytes, chunk);
+      storeFence();
+      last.length += chunk;
+      bytes += chunk;
+      length -= chunk;
+      if (length == 0) return;
+    }
+  }
+  do {
+    FlightRecord& record = records[next % header->dataRecords];
+    const unsigned chunk = (length > FLIGHT_PAYLOAD_SIZE) ? FLIGHT_PAYLOAD_SIZE : length;
+    record.timeMicros = timeMicros;
+    record.cycle = cycle;
+    record.type = type;
+    record.device = device;
+    record.flags = (length > chunk) ? EVENT_FLAG_CONTINUED : 0;
+    record.length = chunk;
+    if (chunk) memcpy(record.payload, bytes, chunk);
+    storeFence();
+    header->recordsWritten = ++next;
+    bytes += chunk;
+    length -= chunk;
+  } while (length > 0);
+}
+
+bool flightRecorderBegin(void) {
+  const uint64_t dataRecords = (uint64_t)cyclesKept * FLIGHT_RECORDS_PER_CYCLE;
+  const size_t size = sizeof(FlightHeader) + cyclesKept * sizeof(FlightCycleIndex) + dataRecords * sizeof(FlightRecord);
+  const std::string path = resultsPath("flight.bin");
+  const int fd = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0 || ftruncate(fd, size) != 0) {
+    fprintf(stderr, "Error creating %s\n", path.c_str());
+    if (fd >= 0) close(fd);
+    return false;
+  }
+  void* map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);  // the mapping keeps the file open
+  if (map == MAP_FAILED) {
+    fprintf(stderr, "Error mapping %s\n", path.c_str());
+    return false;
+  }
+
+  header = (FlightHeader*)map;
+  cycleIndex = (FlightCycleIndex*)(header + 1);
+  records = (FlightRecord*)(cycleIndex + cyclesKept);
+  memcpy(header->magic, FLIGHT_MAGIC, sizeof(header->magic));
+  header->version = FLIGHT_VERSION;
+  header->recordSize = sizeof(FlightRecord);
+  header->indexEntries = cyclesKept;
+  header->dataRecords = dataRecords;
+  header->recordsWritten = 0;
+  header->cyclesWritten = 0;
+  enabled = true;
+  return true;
+}
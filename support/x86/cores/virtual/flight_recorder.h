@@ -0,0 +1,68 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Crash-safe flight recorder.
+//
+// Every event published on the event bus (input lines, reports, LED frames,
+// serial bytes, console text) is also copied, on the simulation thread, into
+// a fixed-size ring in a shared memory mapping of results/flight.bin.  These
+// are plain stores into the page cache: no system calls, no buffering.  If the
+// sketch crashes, the kernel still writes the pages back, so the file holds
+// the cycles leading up to the crash: up to N of them, fewer if they produced
+// more than FLIGHT_RECORDS_PER_CYCLE records each on average, since the oldest
+// records are overwritten first.  tools/flight-decode.cpp dumps it, starting
+// at the oldest cycle whose records are all still there.
+
+#define FLIGHT_MAGIC "KVFLIGHT"  // 8 bytes, no NUL
+#define FLIGHT_VERSION 1
+#define FLIGHT_PAYLOAD_SIZE 48
+#define FLIGHT_RECORDS_PER_CYCLE 16  // data ring is sized for this many records per cycle on average
+#define FLIGHT_MAX_CYCLES 1000000  // about 1 GB of flight.bin
+
+// File layout: FlightHeader, then 'indexEntries' FlightCycleIndex entries, then
+// 'dataRecords' FlightRecord records.  All fields are little-endian.
+typedef struct {
+  char magic[8];
+  uint32_t version;
+  uint32_t recordSize;  // sizeof(FlightRecord)
+  uint32_t indexEntries;  // number of cycles kept
+  uint32_t reserved;
+  uint64_t dataRecords;  // capacity of the record ring
+  // Updated after the record/entry they count is complete, so a crash can only
+  // lose the one being written
+  uint64_t recordsWritten;
+  uint64_t cyclesWritten;
+} FlightHeader;
+
+// Ring entry for the start of a cycle
+typedef struct {
+  uint32_t cycle;
+  uint32_t reserved;
+  uint64_t firstRecord;  // value of recordsWritten when the cycle started
+} FlightCycleIndex;
+
+// Same header as an Event (see event_bus.h), with a smaller payload; longer
+// payloads span several records, each but the last with EVENT_FLAG_CONTINUED
+typedef struct {
+  uint64_t timeMicros;
+  uint32_t cycle;
+  uint8_t type;  // EventType
+  uint8_t device;
+  uint8_t flags;
+  uint8_t length;  // of payload
+  uint8_t payload[FLIGHT_PAYLOAD_SIZE];
+} FlightRecord;  // 64 bytes
+
+// Settings; these must be applied before flightRecorderBegin()
+void flightRecorderSetCycles(unsigned cycles);
+
+// Returns TRUE if successful, FALSE if results/flight.bin couldn't be created
+bool flightRecorderBegin(void);
+bool flightRecorderEnabled(void);
+
+// Called by virtual_io for every event it publishes, on the simulation thread.
+// Serial bytes are recorded as they are written rather than when they are
+// published, and consecutive writes to a port within a cycle share records.
+void flightRecorderRecord(uint8_t type, uint8_t device, const void* payload, unsigned length, uint32_t cycle, uint64_t timeMicros);
@@ -0,0 +1,222 @@
+#include "host_cursor.h"
+#include "event_bus.h"
+#include "virtual_io.h"
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+// A stretch of motion ends once the cursor has been still for this long
+#define MOTION_GAP_MICROS 50000ULL
+// Speed is measured over a sliding window, so movement that MouseKeys only sends
+// every few cycles still reads as a steady speed rather than alternating 0 and max
+#define SPEED_WINDOW_MICROS 16000ULL
+#define SPEED_HISTORY 256
+
+typedef struct {
+  unsigned long long time;
+  double distance;  // cumulative, within the current stretch of motion
+} DistanceMark;
+
+typedef struct {
+  bool active;
+  unsigned startCycle;
+  unsigned lastCycle;
+  unsigned long long startTime;
+  unsigned long long endTime;  // end of the last cycle with movement
+  double distance;
+  long dx;
+  long dy;
+  double topSpeed;  // counts per second
+  unsigned long long topSpeedAfter;  // micros from start of motion
+  DistanceMark history[SPEED_HISTORY];
+  unsigned historyHead;
+  unsigned historyCount;
+} Motion;
+
+static bool enabled = false;
+static FILE* samplefile = NULL;
+static FILE* summaryfile = NULL;
+
+static HostCursorSample sample;  // accumulates the current cycle
+static bool movedLastCycle = false;
+static Motion motion;
+
+// whole-run statistics
+static unsigned long motions = 0;
+static unsigned long totalReports = 0;
+static unsigned long totalJumps = 0;  // absolute changes of position
+static double totalDistance = 0;
+static unsigned long long totalMotionMicros = 0;
+static double topSpeed = 0;
+
+bool hostCursorEnabled(void) {
+  return enabled;
+}
+
+// Relative report, as sent by Mouse
+static void move(uint8_t buttons, int dx, int dy, int vWheel, int hWheel) {
+  sample.buttons = buttons;
+  sample.dx += dx;
+  sample.dy += dy;
+  sample.x += dx;
+  sample.y += dy;
+  sample.vWheel += vWheel;
+  sample.hWheel += hWheel;
+  if (sample.reports < 255) sample.reports++;
+  totalReports++;
+}
+
+// Absolute report, as sent by SingleAbsoluteMouse.  The cursor jumps to the report's
+// logical coordinates (0-32767 on both axes); the jump is a change of position, kept
+// out of dx, dy and so of the distance and speed of motion.
+static void moveTo(uint8_t buttons, int x, int y, int vWheel) {
+  move(buttons, 0, 0, vWheel, 0);
+  if (sample.x != x || sample.y != y) {
+    sample.x = x;
+    sample.y = y;
+    sample.jumped = 1;
+    totalJumps++;
+  }
+}
+
+static double windowedSpeed(unsigned long long now) {
+  // distance covered since the newest mark at or before (now - window)
+  double before = 0;
+  for (unsigned i = 0; i < motion.historyCount; i++) {
+    const DistanceMark& mark = motion.history[(motion.historyHead + SPEED_HISTORY - 1 - i) % SPEED_HISTORY];
+    if (mark.time + SPEED_WINDOW_MICROS <= now) {
+      before = mark.distance;
+      break;
+    }
+  }
+  return (motion.distance - before) * 1e6 / SPEED_WINDOW_MICROS;
+}
+
+static void endMotion(void) {
+  if (!motion.active) return;
+  motion.active = false;
+  motions++;
+  const unsigned long long duration = motion.endTime - motion.startTime;
+  totalDistance += motion.distance;
+  totalMotionMicros += duration;
+  if (motion.topSpeed > topSpeed) topSpeed = motion.topSpeed;
+  fprintf(summaryfile, "Motion %lu: cycles %u-%u (%llu us), distance %.1f, net (%+ld, %+ld), "
+          "top speed %.0f counts/s reached after %llu us, %.1f counts per second of motion\n",
+          motions, motion.startCycle, motion.lastCycle, duration, motion.distance, motion.dx, motion.dy,
+          motion.topSpeed, motion.topSpeedAfter, duration ? motion.distance * 1e6 / duration : 0.0);
+}
+
+static void trackMotion(unsigned long long start, unsigned long long end, bool moved) {
+  if (!moved) {
+    if (motion.active && start - motion.endTime >= MOTION_GAP_MICROS) endMotion();
+    return;
+  }
+  if (!motion.active) {
+    memset(&motion, 0, sizeof(motion));
+    motion.active = true;
+    motion.startCycle = sample.cycle;
+    motion.startTime = start;
+    motion.history[0].time = start;  // distance 0 at the start of motion
+    motion.historyHead = 1;
+    motion.historyCount = 1;
+  }
+  motion.lastCycle = sample.cycle;
+  motion.endTime = end;
+  motion.distance += sqrt((double)sample.dx * sample.dx + (double)sample.dy * sample.dy);
+  motion.dx += sample.dx;
+  motion.dy += sample.dy;
+
+  // the movement happened during this cycle, so it's measured at the cycle's end
+  DistanceMark& mark = motion.history[motion.historyHead];
+  mark.time = end;
+  mark.distance = motion.distance;
+  motion.historyHead = (motion.historyHead + 1) % SPEED_HISTORY;
+  if (motion.historyCount < SPEED_HISTORY) motion.historyCount++;
+
+  // small margin so that rounding in the running distance doesn't count as speeding up
+  const double speed = windowedSpeed(end);
+  if (speed > motion.topSpeed + 0.5) {
+    motion.topSpeed = speed;
+    motion.topSpeedAfter = end - motion.startTime;
+  }
+}
+
+static void endCycle(unsigned cycle, unsigned long long startMicros, unsigned long long endMicros) {
+  const bool moved = sample.dx || sample.dy;
+  sample.timeMicros = startMicros;
+  sample.cycle = cycle;
+  trackMotion(startMicros, endMicros, moved);
+  if (sample.reports || movedLastCycle) fwrite(&sample, sizeof(sample), 1, samplefile);
+  movedLastCycle = moved;
+
+  sample.dx = sample.dy = 0;
+  sample.reports = 0;
+  sample.jumped = 0;
+}
+
+// cycle marker most recently seen
+static unsigned cycle = 0;
+static unsigned long long cycleStart = 0;
+
+static void report(const Event& event) {
+  const uint8_t* data = event.payload;
+  if (event.device == USB_ENDPOINT_MOUSE && event.length >= 5) {
+    // buttons, x, y, vWheel, hWheel; all signed bytes but the buttons
+    move(data[0], (int8_t)data[1], (int8_t)data[2], (int8_t)data[3], (int8_t)data[4]);
+  } else if (event.device == USB_ENDPOINT_ABSOLUTE_MOUSE && event.length == 6) {
+    // buttons, x and y as little-endian 16-bit values, signed wheel byte
+    moveTo(data[0], data[1] | (data[2] << 8), data[3] | (data[4] << 8), (int8_t)data[5]);
+  }
+}
+
+static void finish(void) {
+  // reports sent during the cycle that was interrupted by the end of the script
+  if (sample.reports) endCycle(cycle, cycleStart, cycleStart);
+  endMotion();
+  fprintf(summaryfile, "\nTotal: %lu stretch(es) of motion, %lu reports, distance %.1f over %.3f s of motion "
+          "(%.1f counts/s), top speed %.0f counts/s, %lu absolute jump(s); final position (%d, %d), "
+          "wheel (%d, %d)\n",
+          motions, totalReports, totalDistance, totalMotionMicros / 1e6,
+          totalMotionMicros ? totalDistance * 1e6 / totalMotionMicros : 0.0,
+          topSpeed, totalJumps, sample.x, sample.y, sample.vWheel, sample.hWheel);
+  fclose(summaryfile);
+  fclose(samplefile);
+}
+
+class HostCursorSink : public EventSink {
+ public:
+  virtual void consume(const Event& event) override {
+    if (event.type == EVENT_REPORT) {
+      report(event);
+    } else if (event.type == EVENT_CYCLE && event.cycle != cycle) {
+      endCycle(cycle, cycleStart, event.timeMicros);
+      cycle = event.cycle;
+      cycleStart = event.timeMicros;
+    }
+  }
+
+  virtual void finish(void) override {
+    ::finish();
+  }
+};
+
+bool hostCursorBegin(void) {
+  static HostCursorSink sink;
+  samplefile = fopen(resultsPath("mouse.bin").c_str(), "wb");
+  summaryfile = fopen(resultsPath("mouse.txt").c_str(), "w");
+  if (!samplefile || !summaryfile) {
+    fprintf(stderr, "Error opening %s or %s\n", resultsPath("mouse.bin").c_str(), resultsPath("mouse.txt").c_str());
+    return false;
+  }
+  HostCursorHeader header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, HOST_CURSOR_MAGIC, sizeof(HOST_CURSOR_MAGIC));
+  header.version = HOST_CURSOR_VERSION;
+  header.sampleSize = sizeof(HostCursorSample);
+  fwrite(&header, sizeof(header), 1, samplefile);
+
+  memset(&sample, 0, sizeof(sample));
+  enabled = true;
+  eventBusAddSink(&sink);
+  return true;
+}
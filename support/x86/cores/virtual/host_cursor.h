@@ -0,0 +1,46 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Host-side model of the mouse cursor.
+//
+// Every mouse report the sketch sends is integrated into a cursor position, the
+// way a host without pointer acceleration would do it (as a sink on the event
+// bus, so the reports are decoded off the simulation thread).  Each cycle in which the
+// mouse reported something (plus the first still cycle after any motion) is
+// appended to results/mouse.bin as one HostCursorSample, and summary statistics
+// of each stretch of relative motion (time to reach top speed, distance per
+// second of motion, ...) are written to results/mouse.txt at exit.  This lets MouseKeys
+// acceleration curves be compared across builds without re-parsing USB.txt.
+
+#define HOST_CURSOR_MAGIC "KVMOUSE"  // followed by a NUL to fill 8 bytes
+#define HOST_CURSOR_VERSION 2
+
+// File layout: HostCursorHeader, then HostCursorSample records until EOF.
+// All fields are little-endian.
+typedef struct {
+  char magic[8];
+  uint32_t version;
+  uint32_t sampleSize;  // sizeof(HostCursorSample)
+} HostCursorHeader;
+
+typedef struct {
+  uint64_t timeMicros;  // virtual time at the start of the cycle
+  uint32_t cycle;
+  int32_t x;  // cursor position after this cycle
+  int32_t y;
+  int32_t vWheel;  // wheel totals after this cycle
+  int32_t hWheel;
+  int32_t dx;  // relative movement during this cycle, i.e. velocity in counts per cycle
+  int32_t dy;
+  uint8_t buttons;
+  uint8_t reports;  // number of reports sent during this cycle
+  uint8_t jumped;  // 1 if an absolute report moved the cursor (not counted in dx, dy)
+  uint8_t reserved;
+} __attribute__((packed)) HostCursorSample;
+
+// Adds the model to the event bus.  Returns TRUE if successful, FALSE if the
+// output files couldn't be opened.
+bool hostCursorBegin(void);
+bool hostCursorEnabled(void);
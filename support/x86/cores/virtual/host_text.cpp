@@ -0,0 +1,235 @@
+#include "host_text.h"
+#include "event_bus.h"
+#include "virtual_io.h"
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+
+#define REPORT_BYTES 29  // modifiers + 28 bytes of key bitmap
+#define MAX_LINE_LENGTH 4096
+
+// HID usages and modifier bits the decoder cares about
+#define USAGE_BACKSPACE 0x2A
+#define USAGE_CAPS_LOCK 0x39
+#define MOD_CTRL (0x01 | 0x10)
+#define MOD_SHIFT (0x02 | 0x20)
+#define MOD_ALT 0x04
+#define MOD_GUI (0x08 | 0x80)
+#define MOD_ALTGR 0x40
+
+typedef struct {
+  uint8_t usage;
+  const char* normal;
+  const char* shifted;
+  const char* altgr;  // NULL if AltGr does nothing special
+  bool caps;  // caps lock swaps normal and shifted, as for letters
+} KeyText;
+
+// US layout; keys that produce no text (navigation, F-keys, ...) are simply absent
+static const KeyText usLayout[] = {
+  {0x04, "a", "A", NULL, true}, {0x05, "b", "B", NULL, true}, {0x06, "c", "C", NULL, true}, {0x07, "d", "D", NULL, true},
+  {0x08, "e", "E", NULL, true}, {0x09, "f", "F", NULL, true}, {0x0A, "g", "G", NULL, true}, {0x0B, "h", "H", NULL, true},
+  {0x0C, "i", "I", NULL, true}, {0x0D, "j", "J", NULL, true}, {0x0E, "k", "K", NULL, true}, {0x0F, "l", "L", NULL, true},
+  {0x10, "m", "M", NULL, true}, {0x11, "n", "N", NULL, true}, {0x12, "o", "O", NULL, true}, {0x13, "p", "P", NULL, true},
+  {0x14, "q", "Q", NULL, true}, {0x15, "r", "R", NULL, true}, {0x16, "s", "S", NULL, true}, {0x17, "t", "T", NULL, true},
+  {0x18, "u", "U", NULL, true}, {0x19, "v", "V", NULL, true}, {0x1A, "w", "W", NULL, true}, {0x1B, "x", "X", NULL, true},
+  {0x1C, "y", "Y", NULL, true}, {0x1D, "z", "Z", NULL, true},
+  {0x1E, "1", "!", NULL, false}, {0x1F, "2", "@", NULL, false}, {0x20, "3", "#", NULL, false}, {0x21, "4", "$", NULL, false},
+  {0x22, "5", "%", NULL, false}, {0x23, "6", "^", NULL, false}, {0x24, "7", "&", NULL, false}, {0x25, "8", "*", NULL, false},
+  {0x26, "9", "(", NULL, false}, {0x27, "0", ")", NULL, false},
+  {0x28, "\n", "\n", NULL, false}, {0x2B, "\t", "\t", NULL, false}, {0x2C, " ", " ", NULL, false},
+  {0x2D, "-", "_", NULL, false}, {0x2E, "=", "+", NULL, false}, {0x2F, "[", "{", NULL, false}, {0x30, "]", "}", NULL, false},
+  {0x31, "\\", "|", NULL, false}, {0x32, "#", "~", NULL, false}, {0x33, ";", ":", NULL, false}, {0x34, "'", "\"", NULL, false},
+  {0x35, "`", "~", NULL, false}, {0x36, ",", "<", NULL, false}, {0x37, ".", ">", NULL, false}, {0x38, "/", "?", NULL, false},
+  // keypad, assuming the host has num lock on
+  {0x54, "/", "/", NULL, false}, {0x55, "*", "*", NULL, false}, {0x56, "-", "-", NULL, false}, {0x57, "+", "+", NULL, false},
+  {0x58, "\n", "\n", NULL, false}, {0x59, "1", "1", NULL, false}, {0x5A, "2", "2", NULL, false}, {0x5B, "3", "3", NULL, false},
+  {0x5C, "4", "4", NULL, false}, {0x5D, "5", "5", NULL, false}, {0x5E, "6", "6", NULL, false}, {0x5F, "7", "7", NULL, false},
+  {0x60, "8", "8", NULL, false}, {0x61, "9", "9", NULL, false}, {0x62, "0", "0", NULL, false}, {0x63, ".", ".", NULL, false},
+  {0x64, "\\", "|", NULL, false}, {0x67, "=", "=", NULL, false},
+};
+
+// German (QWERTZ), as differences from the US layout.  Dead keys (^, ´, `) are
+// emitted as their own character.
+static const KeyText deLayout[] = {
+  {0x08, "e", "E", "€", true}, {0x10, "m", "M", "µ", true}, {0x14, "q", "Q", "@", true},
+  {0x1C, "z", "Z", NULL, true}, {0x1D, "y", "Y", NULL, true},
+  {0x1F, "2", "\"", "²", false}, {0x20, "3", "§", "³", false}, {0x23, "6", "&", NULL, false}, {0x24, "7", "/", "{", false},
+  {0x25, "8", "(", "[", false}, {0x26, "9", ")", "]", false}, {0x27, "0", "=", "}", false},
+  {0x2D, "ß", "?", "\\", false}, {0x2E, "´", "`", NULL, false}, {0x2F, "ü", "Ü", NULL, true}, {0x30, "+", "*", "~", false},
+  {0x31, "#", "'", NULL, false}, {0x32, "#", "'", NULL, false}, {0x33, "ö", "Ö", NULL, true}, {0x34, "ä", "Ä", NULL, true},
+  {0x35, "^", "°", NULL, false}, {0x36, ",", ";", NULL, false}, {0x37, ".", ":", NULL, false}, {0x38, "-", "_", NULL, false},
+  {0x63, ",", ",", NULL, false}, {0x64, "<", ">", "|", false},
+};
+
+// US Dvorak, as differences from the US layout
+static const KeyText dvorakLayout[] = {
+  {0x14, "'", "\"", NULL, false}, {0x1A, ",", "<", NULL, false}, {0x08, ".", ">", NULL, false}, {0x15, "p", "P", NULL, true},
+  {0x17, "y", "Y", NULL, true}, {0x1C, "f", "F", NULL, true}, {0x18, "g", "G", NULL, true}, {0x0C, "c", "C", NULL, true},
+  {0x12, "r", "R", NULL, true}, {0x13, "l", "L", NULL, true}, {0x2F, "/", "?", NULL, false}, {0x30, "=", "+", NULL, false},
+  {0x04, "a", "A", NULL, true}, {0x16, "o", "O", NULL, true}, {0x07, "e", "E", NULL, true}, {0x09, "u", "U", NULL, true},
+  {0x0A, "i", "I", NULL, true}, {0x0B, "d", "D", NULL, true}, {0x0D, "h", "H", NULL, true}, {0x0E, "t", "T", NULL, true},
+  {0x0F, "n", "N", NULL, true}, {0x33, "s", "S", NULL, true}, {0x34, "-", "_", NULL, false},
+  {0x1D, ";", ":", NULL, false}, {0x1B, "q", "Q", NULL, true}, {0x06, "j", "J", NULL, true}, {0x19, "k", "K", NULL, true},
+  {0x05, "x", "X", NULL, true}, {0x11, "b", "B", NULL, true}, {0x10, "m", "M", NULL, true}, {0x36, "w", "W", NULL, true},
+  {0x37, "v", "V", NULL, true}, {0x38, "z", "Z", NULL, true},
+  {0x2D, "[", "{", NULL, false}, {0x2E, "]", "}", NULL, false},
+};
+
+#define LAYOUT_SIZE(layout) (sizeof(layout) / sizeof(layout[0]))
+
+static bool enabled = false;
+static FILE* textfile = NULL;
+static const KeyText* keymap[256];  // built from the US layout plus the chosen layout's overrides
+static const KeyText* layoutOverrides = NULL;
+static size_t layoutOverrideCount = 0;
+
+static uint8_t lastReport[REPORT_BYTES];
+static bool capsLock = false;
+
+static unsigned repeatDelayMicros = 660000;  // X11's defaults: 660 ms, then 25 per second
+static unsigned repeatIntervalMicros = 40000;
+static int repeatUsage = -1;  // -1 if no key is repeating
+static unsigned long long nextRepeat;
+
+static char line[MAX_LINE_LENGTH];
+static size_t lineLength = 0;
+
+bool hostTextSetLayout(const char* name) {
+  if (strcmp(name, "us") == 0) {
+    layoutOverrides = NULL;
+    layoutOverrideCount = 0;
+  } else if (strcmp(name, "de") == 0) {
+    layoutOverrides = deLayout;
+    layoutOverrideCount = LAYOUT_SIZE(deLayout);
+  } else if (strcmp(name, "dvorak") == 0) {
+    layoutOverrides = dvorakLayout;
+    layoutOverrideCount = LAYOUT_SIZE(dvorakLayout);
+  } else {
+    return false;
+  }
+  return true;
+}
+
+void hostTextSetRepeat(unsigned delayMs, unsigned rateHz) {
+  repeatDelayMicros = delayMs * 1000;
+  repeatIntervalMicros = rateHz ? 1000000 / rateHz : 0;
+}
+
+bool hostTextEnabled(void) {
+  return enabled;
+}
+
+static void flushLine(void) {
+  fwrite(line, 1, lineLength, textfile);
+  lineLength = 0;
+}
+
+static void emitText(const char* text) {
+  const size_t length = strlen(text);
+  if (lineLength + length > MAX_LINE_LENGTH) flushLine();
+  memcpy(line + lineLength, text, length);
+  lineLength += length;
+  if (text[0] == '\n') flushLine();
+}
+
+static void emitBackspace(void) {
+  if (lineLength == 0) {
+    // the rest of the line has already been written out; record the backspace itself
+    fputc('\b', textfile);
+    return;
+  }
+  // remove one UTF-8 character: continuation bytes look like 10xxxxxx
+  do {
+    lineLength--;
+  } while (lineLength > 0 && (line[lineLength] & 0xC0) == 0x80);
+}
+
+static void typeKey(uint8_t usage, uint8_t modifiers) {
+  if (usage == USAGE_BACKSPACE) {
+    emitBackspace();
+    return;
+  }
+  const KeyText* key = keymap[usage];
+  if (!key) return;
+  // shortcuts don't produce text (AltGr is right alt, which is allowed)
+  if (modifiers & (MOD_CTRL | MOD_GUI | MOD_ALT)) return;
+
+  if ((modifiers & MOD_ALTGR)) {
+    if (key->altgr) emitText(key->altgr);
+    return;
+  }
+  bool shifted = (modifiers & MOD_SHIFT) != 0;
+  if (capsLock && key->caps) shifted = !shifted;
+  emitText(shifted ? key->shifted : key->normal);
+}
+
+static bool isPressed(const uint8_t* report, unsigned usage) {
+  return report[1 + usage / 8] & (1 << (usage % 8));
+}
+
+// Keyboard report (modifier byte followed by the key bitmap) sent at virtual time 'now'
+static void keyboardReport(const uint8_t* report, int length, unsigned long long now) {
+  if (length != REPORT_BYTES) return;
+
+  if (repeatUsage >= 0 && !isPressed(report, repeatUsage)) repeatUsage = -1;
+
+  // newly pressed keys, in usage order
+  for (unsigned i = 1; i < REPORT_BYTES; i++) {
+    uint8_t pressed = report[i] & ~lastReport[i];
+    while (pressed) {
+      const unsigned bit = __builtin_ctz(pressed);
+      const unsigned usage = (i - 1) * 8 + bit;
+      pressed &= pressed - 1;
+      if (usage == USAGE_CAPS_LOCK) {
+        capsLock = !capsLock;
+        continue;
+      }
+      typeKey(usage, report[0]);
+      if (keymap[usage] || usage == USAGE_BACKSPACE) {
+        repeatUsage = usage;
+        nextRepeat = now + repeatDelayMicros;
+      }
+    }
+  }
+  memcpy(lastReport, report, REPORT_BYTES);
+}
+
+// Emit auto-repeats scheduled up to (and including) the given virtual time
+static void advance(unsigned long long nowMicros) {
+  if (repeatUsage < 0 || !repeatIntervalMicros) return;
+  for (; nextRepeat <= nowMicros; nextRepeat += repeatIntervalMicros) typeKey(repeatUsage, lastReport[0]);
+}
+
+static void finish(void) {
+  flushLine();
+  fclose(textfile);
+}
+
+class HostTextSink : public EventSink {
+ public:
+  virtual void consume(const Event& event) override {
+    if (event.type == EVENT_REPORT && event.device == USB_ENDPOINT_KEYBOARD) keyboardReport(event.payload, event.length, event.timeMicros);
+    else if (event.type == EVENT_CYCLE) advance(event.timeMicros);
+  }
+
+  virtual void finish(void) override {
+    ::finish();
+  }
+};
+
+bool hostTextBegin(void) {
+  static HostTextSink sink;
+  textfile = fopen(resultsPath("text.txt").c_str(), "w");
+  if (!textfile) {
+    fprintf(stderr, "Error opening %s\n", resultsPath("text.txt").c_str());
+    return false;
+  }
+  memset(keymap, 0, sizeof(keymap));
+  for (size_t i = 0; i < LAYOUT_SIZE(usLayout); i++) keymap[usLayout[i].usage] = &usLayout[i];
+  for (size_t i = 0; i < layoutOverrideCount; i++) keymap[layoutOverrides[i].usage] = &layoutOverrides[i];
+  memset(lastReport, 0, sizeof(lastReport));
+  enabled = true;
+  eventBusAddSink(&sink);
+  return true;
+}
@@ -0,0 +1,21 @@
+#pragma once
+
+#include <stdbool.h>
+
+// Host-side reconstruction of typed text.
+//
+// Keyboard reports are decoded (as a sink on the event bus) the way a host with the
+// configured keyboard layout would turn them into characters: shift, AltGr and
+// caps lock are applied, chords with ctrl/alt/gui produce no text, and the most
+// recently pressed key auto-repeats on the virtual clock while it's held.
+// Backspace edits the current line.  Text is written to results/text.txt one
+// line at a time, so long runs never hold more than a line in memory.
+
+// Settings; these must be applied before hostTextBegin()
+bool hostTextSetLayout(const char* name);  // "us" (default), "de" or "dvorak"; FALSE if unknown
+void hostTextSetRepeat(unsigned delayMs, unsigned rateHz);  // rateHz 0 disables auto-repeat
+
+// Adds the decoder to the event bus.  Returns TRUE if successful, FALSE if
+// results/text.txt couldn't be opened.
+bool hostTextBegin(void);
+bool hostTextEnabled(void);
@@ -19,7 +19,7 @@
 
 #include <Arduino.h>
 #include "virtual_io.h"
-#include <iostream>
+#include "timeline.h"
 
 // atexit is defined in stdlib.h which is included in Arduino.h
 // There the function can be declared "noexept" or without "noexecpt"
@@ -44,6 +44,18 @@ void init(void) {
   // We don't need to do anything.
 }
 
+void runCycle(void) {
+  beginCycle();
+  {
+    TimelineScope span(TIMELINE_LOOP);
+    loop();
+  }
+  if (serialEventRun) serialEventRun();
+  nextCycle();
+}
+
+// The library build has no main(); the test driver runs the cycles (see virtual_library.h)
+#ifndef KALEIDOSCOPE_VIRTUAL_LIBRARY
 int main(int argc, char* argv[]) {
   if (!initVirtualInput(argc, argv)) return 1;
 
@@ -51,14 +63,11 @@ int main(int argc, char* argv[]) {
   initVariant();
 
   setup();
+  if (!startRun()) return 1;
 
-  while (true) {
-    std::cout << "Starting cycle " << currentCycle() << std::endl;
-    loop();
-    if (serialEventRun) serialEventRun();
-    nextCycle();
-  }
+  while (true) runCycle();
 
   return 0;
 }
+#endif
 
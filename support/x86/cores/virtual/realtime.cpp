@@ -0,0 +1,91 @@
+#include "realtime.h"
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/timerfd.h>
+
+static int timer = -1;
+static uint64_t period = 0;  // nanoseconds
+static bool started = false;
+static uint64_t startedAt = 0;
+static uint64_t ticks = 0;  // periods since startedAt
+static unsigned long long waits = 0;
+static unsigned long long overruns = 0;  // periods missed altogether
+
+// Wake-up latency, in microseconds after the tick; the last bucket is "or more"
+#define LATENCY_BUCKETS 10001
+static unsigned long long latencies[LATENCY_BUCKETS];
+static uint64_t maxLatency = 0;  // nanoseconds
+
+static uint64_t now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+bool realtimeBegin(uint32_t periodMicros) {
+  timer = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+  if (timer < 0) {
+    fprintf(stderr, "Error: can't create a timer for --realtime: %s\n", strerror(errno));
+    return false;
+  }
+  period = (uint64_t)periodMicros * 1000;
+  return true;
+}
+
+// Started at the end of the first cycle, so that setup() doesn't count as an overrun
+static void start(void) {
+  struct itimerspec spec;
+  spec.it_interval.tv_sec = period / 1000000000ULL;
+  spec.it_interval.tv_nsec = period % 1000000000ULL;
+  spec.it_value = spec.it_interval;
+  startedAt = now();
+  if (timerfd_settime(timer, 0, &spec, NULL) != 0) {
+    fprintf(stderr, "Error: can't start the timer for --realtime: %s\n", strerror(errno));
+  }
+  started = true;
+}
+
+bool realtimeEnabled(void) {
+  return timer >= 0;
+}
+
+unsigned realtimeWait(void) {
+  if (!started) start();
+  uint64_t expirations = 0;
+  while (read(timer, &expirations, sizeof(expirations)) != sizeof(expirations)) {
+    if (errno != EINTR) return 1;
+  }
+  // the latest of the ticks that expired is the one this wake-up is for
+  ticks += expirations;
+  const uint64_t t = now();
+  const uint64_t due = startedAt + ticks * period;
+  const uint64_t latency = (t > due) ? t - due : 0;
+  const uint64_t micros = latency / 1000;
+  latencies[(micros < LATENCY_BUCKETS - 1) ? micros : LATENCY_BUCKETS - 1]++;
+  if (latency > maxLatency) maxLatency = latency;
+  waits++;
+  overruns += expirations - 1;
+  return expirations;
+}
+
+// The latency (in microseconds) that 'fraction' of the wake-ups were within
+static unsigned percentile(double fraction) {
+  const unsigned long long rank = (unsigned long long)(fraction * waits);
+  unsigned long long seen = 0;
+  for (unsigned bucket = 0; bucket < LATENCY_BUCKETS; bucket++) {
+    seen += latencies[bucket];
+    if (seen > rank) return bucket;
+  }
+  return LATENCY_BUCKETS - 1;
+}
+
+void realtimePrint(void) {
+  if (!realtimeEnabled() || !waits) return;
+  fprintf(stderr, "Real-time pacing (%llu us period, %llu cycles):\n", (unsigned long long)(period / 1000), waits);
+  fprintf(stderr, "  wake-up latency p50 %u us, p90 %u us, p99 %u us, p99.9 %u us, max %.1f us\n",
+          percentile(0.5), percentile(0.9), percentile(0.99), percentile(0.999), maxLatency / 1000.0);
+  fprintf(stderr, "  overruns    %llu period(s) missed\n", overruns);
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Real-time pacing (--realtime): one scan cycle per scan period of wall-clock
+// time, driven by a periodic timerfd, so that timing behaviour (hold-tap
+// timeouts, double taps, ...) can be tried by hand.
+//
+// The main loop waits for the timer at the end of each cycle; the timer starts
+// at the end of the first one.  If a cycle
+// overran its period, the virtual clock is moved on by all the periods that
+// passed, so it never falls behind the wall clock.  How late each wake-up was
+// is collected in a histogram, and printed as percentiles at exit.
+
+// Returns FALSE (after printing why) if the timer can't be created
+bool realtimeBegin(uint32_t periodMicros);
+bool realtimeEnabled(void);
+
+// Waits for the next tick of the timer.  Returns the number of periods since
+// the previous call: 1, or more if the cycle overran.
+unsigned realtimeWait(void);
+
+// Prints the wake-up latency percentiles and overruns on stderr
+void realtimePrint(void);
@@ -0,0 +1,203 @@
+#include "rolling_log.h"
+#include "virtual_io.h"
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <zlib.h>
+#include <unistd.h>  // unlink()
+
+static unsigned long long segmentBytesCap = 0;
+static unsigned segmentCyclesCap = 0;
+static bool compressSegments = false;
+static bool retention = false;
+static unsigned keepFirst = 0;
+static unsigned keepLast = 0;
+
+void rollingLogSetSegmentBytes(unsigned long long bytes) {
+  segmentBytesCap = bytes;
+}
+
+void rollingLogSetSegmentCycles(unsigned cycles) {
+  segmentCyclesCap = cycles;
+}
+
+void rollingLogSetCompression(bool compress) {
+  compressSegments = compress;
+}
+
+void rollingLogSetRetention(unsigned first, unsigned last) {
+  retention = true;
+  keepFirst = first;
+  keepLast = last;
+}
+
+bool rollingLogEnabled(void) {
+  return segmentBytesCap || segmentCyclesCap;
+}
+
+// --- Background thread: compresses finished segments and deletes old ones, in order ---
+
+typedef struct {
+  std::string path;
+  bool remove;  // delete the segment (compressed or not) instead of compressing it
+} SegmentJob;
+
+static std::deque<SegmentJob> jobs;
+static std::mutex jobsLock;
+static std::condition_variable jobsChanged;
+static std::thread* worker = NULL;
+static bool stopping = false;
+
+static void compress(const std::string& path) {
+  FILE* in = fopen(path.c_str(), "rb");
+  gzFile out = gzopen((path + ".gz").c_str(), "wb1");  // fastest level; logs are repetitive anyway
+  if (!in || !out) {
+    fprintf(stderr, "Error compressing %s\n", path.c_str());
+    if (in) fclose(in);
+    if (out) gzclose(out);
+    return;
+  }
+  static char block[1 << 16];
+  size_t length;
+  bool ok = true;
+  while ((length = fread(block, 1, sizeof(block), in)) > 0) {
+    if (gzwrite(out, block, length) != (int)length) {
+      ok = false;
+      break;
+    }
+  }
+  fclose(in);
+  if (gzclose(out) != Z_OK || !ok) {
+    fprintf(stderr, "Error compressing %s\n", path.c_str());
+    unlink((path + ".gz").c_str());
+    return;
+  }
+  unlink(path.c_str());
+}
+
+static void workerLoop(void) {
+  std::unique_lock<std::mutex> lock(jobsLock);
+  while (true) {
+    if (jobs.empty()) {
+      if (stopping) return;
+      jobsChanged.wait(lock);
+      continue;
+    }
+    const SegmentJob job = jobs.front();
+    jobs.pop_front();
+    lock.unlock();
+    if (job.remove) {
+      unlink(job.path.c_str());
+      unlink((job.path + ".gz").c_str());
+    } else {
+      compress(job.path);
+    }
+    lock.lock();
+  }
+}
+
+static void queueJob(const std::string& path, bool remove) {
+  std::lock_guard<std::mutex> lock(jobsLock);
+  SegmentJob job;
+  job.path = path;
+  job.remove = remove;
+  jobs.push_back(job);
+  if (!worker) worker = new std::thread(workerLoop);
+  jobsChanged.notify_one();
+}
+
+void rollingLogsFinish(void) {
+  {
+    std::lock_guard<std::mutex> lock(jobsLock);
+    if (!worker) return;
+    stopping = true;
+    jobsChanged.notify_one();
+  }
+  worker->join();
+  delete worker;
+  worker = NULL;
+}
+
+// --- RollingLog ---
+
+RollingLog::RollingLog(const char* filename, bool flushEachWrite)
+  : flushEachWrite(flushEachWrite), file(NULL), segment(0), segmentBytes(0), segmentFirstCycle(0), segmentEmpty(true) {
+  base = filename;
+  const size_t dotpos = base.rfind('.');
+  if (dotpos != std::string::npos && dotpos > 0) {
+    extension = base.substr(dotpos);
+    base.erase(dotpos);
+  }
+}
+
+std::string RollingLog::segmentPath(unsigned index) const {
+  char number[16];
+  snprintf(number, sizeof(number), ".%06u", index);
+  return resultsPath((base + number + extension).c_str());
+}
+
+bool RollingLog::openSegment(void) {
+  const std::string path = segmentPath(segment);
+  file = fopen(path.c_str(), "w");
+  if (!file) {
+    fprintf(stderr, "Error opening %s\n", path.c_str());
+    return false;
+  }
+  segmentBytes = 0;
+  segmentEmpty = true;
+  return true;
+}
+
+bool RollingLog::open(void) {
+  return openSegment();
+}
+
+// Finishes the current segment and starts the next one.  Compression and
+// deletion are left to the background thread.
+void RollingLog::rotate(void) {
+  fclose(file);
+  file = NULL;
+  const unsigned finished = segment++;
+  // the segment that drops out of the last 'keepLast' now that another one has
+  // started; with none of the last kept, the one just finished
+  bool expire;
+  unsigned expired;
+  if (keepLast) {
+    expire = retention && segment >= keepLast && segment - keepLast >= keepFirst;
+    expired = segment - keepLast;
+  } else {
+    expire = retention && finished >= keepFirst;
+    expired = finished;
+  }
+  if (compressSegments && !(expire && expired == finished)) queueJob(segmentPath(finished), false);
+  if (expire) queueJob(segmentPath(expired), true);
+  openSegment();
+}
+
+void RollingLog::write(uint32_t cycle, const char* text, size_t length) {
+  if (!segmentEmpty &&
+      ((segmentBytesCap && segmentBytes >= segmentBytesCap) ||
+       (segmentCyclesCap && cycle - segmentFirstCycle >= segmentCyclesCap))) {
+    rotate();
+  }
+  if (!file) return;  // the new segment couldn't be created
+  if (segmentEmpty) {
+    segmentFirstCycle = cycle;
+    segmentEmpty = false;
+  }
+  fwrite(text, 1, length, file);
+  if (flushEachWrite) fflush(file);
+  segmentBytes += length;
+}
+
+void RollingLog::close(void) {
+  if (!file) return;
+  fclose(file);
+  file = NULL;
+  if (retention && !keepLast && segment >= keepFirst) {
+    queueJob(segmentPath(segment), true);  // the last segment isn't one of the first either
+  } else if (compressSegments && !segmentEmpty) {
+    queueJob(segmentPath(segment), false);
+  }
+}
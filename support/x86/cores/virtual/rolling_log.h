@@ -0,0 +1,51 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string>
+
+// Size-capped logs for long runs.
+//
+// With a segment size or cycle cap set, a log such as results/USB.txt is instead
+// written as a series of segments, results/USB.000000.txt, USB.000001.txt, ...
+// A new segment is started (between records) once the current one reaches the
+// cap.  Finished segments can be gzip-compressed (to USB.000000.txt.gz, ...) and
+// old ones deleted according to the retention policy; both happen on a
+// background thread, so rotating only costs the writer an fclose() and fopen().
+
+// Settings; these must be applied before any log is opened
+void rollingLogSetSegmentBytes(unsigned long long bytes);  // 0 for no size cap
+void rollingLogSetSegmentCycles(unsigned cycles);  // 0 for no cycle cap
+void rollingLogSetCompression(bool compress);
+void rollingLogSetRetention(unsigned first, unsigned last);  // keep the first 'first' and last 'last' segments (either may be 0)
+bool rollingLogEnabled(void);  // TRUE if logs are to be split into segments
+
+class RollingLog {
+ public:
+  // 'filename' is the name of the unsplit log, e.g. "USB.txt"
+  RollingLog(const char* filename, bool flushEachWrite);
+
+  // Returns TRUE if successful, FALSE if the first segment couldn't be created
+  bool open(void);
+  // 'cycle' is the cycle the text was produced in; the text is never split across segments
+  void write(uint32_t cycle, const char* text, size_t length);
+  void close(void);
+
+ private:
+  std::string segmentPath(unsigned index) const;
+  bool openSegment(void);
+  void rotate(void);
+
+  std::string base;  // "USB"
+  std::string extension;  // ".txt"
+  bool flushEachWrite;
+  FILE* file;
+  unsigned segment;  // index of the segment being written
+  unsigned long long segmentBytes;
+  uint32_t segmentFirstCycle;
+  bool segmentEmpty;
+};
+
+// Waits for the background thread to compress and delete everything queued; at exit
+void rollingLogsFinish(void);
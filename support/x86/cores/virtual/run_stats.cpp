@@ -0,0 +1,73 @@
+#include "run_stats.h"
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+#include <sys/resource.h>  // getrusage()
+
+static bool enabled = false;
+static uint64_t startedAt = 0;
+static uint64_t phaseStartedAt = 0;
+static RunPhase currentPhase = RUN_PHASE_SETUP;
+static uint64_t phaseNanos[RUN_PHASE_COUNT];
+static unsigned long long reports = 0;
+static unsigned long long droppedConsoleLines = 0;
+
+static uint64_t now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+void runStatsBegin(void) {
+  enabled = true;
+  startedAt = phaseStartedAt = now();
+  currentPhase = RUN_PHASE_SETUP;
+}
+
+bool runStatsEnabled(void) {
+  return enabled;
+}
+
+void runStatsEnter(RunPhase phase) {
+  if (!enabled || phase == currentPhase) return;
+  const uint64_t t = now();
+  phaseNanos[currentPhase] += t - phaseStartedAt;
+  phaseStartedAt = t;
+  currentPhase = phase;
+}
+
+void runStatsAddReport(void) {
+  reports++;
+}
+
+void runStatsAddDroppedConsoleLine(void) {
+  droppedConsoleLines++;
+}
+
+static double perSecond(unsigned long long count, double seconds) {
+  return (seconds > 0) ? count / seconds : 0;
+}
+
+void runStatsPrint(unsigned cycles) {
+  if (!enabled) return;
+  const uint64_t t = now();
+  phaseNanos[currentPhase] += t - phaseStartedAt;
+  phaseStartedAt = t;
+  const double wall = (t - startedAt) / 1e9;
+
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  const double cpu = usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6 + usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+
+  static const char* names[RUN_PHASE_COUNT] = {"setup", "input", "loop()", "output"};
+  fprintf(stderr, "Run statistics:\n");
+  fprintf(stderr, "  cycles      %u in %.3f s wall clock (%.0f cycles/s)\n", cycles, wall, perSecond(cycles, wall));
+  fprintf(stderr, "  reports     %llu (%.0f reports/s)\n", reports, perSecond(reports, wall));
+  for (int phase = 0; phase < RUN_PHASE_COUNT; phase++) {
+    const double seconds = phaseNanos[phase] / 1e9;
+    fprintf(stderr, "  %-11s %.3f s (%.1f%%)\n", names[phase], seconds, (wall > 0) ? 100 * seconds / wall : 0);
+  }
+  fprintf(stderr, "  CPU time    %.3f s (all threads)\n", cpu);
+  fprintf(stderr, "  peak RSS    %.1f MiB\n", usage.ru_maxrss / 1024.0);  // ru_maxrss is in KiB on Linux
+  if (droppedConsoleLines) fprintf(stderr, "  console     %llu line(s) not printed (--headless)\n", droppedConsoleLines);
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <stdbool.h>
+
+// Throughput statistics for a run (--stats, implied by --headless).
+//
+// The simulation thread's wall-clock time is split into phases as it moves
+// between them; at exit the totals are printed on stderr along with cycles
+// and reports per second and the peak resident set size.
+
+typedef enum {
+  RUN_PHASE_SETUP,  // from startup until the first cycle: setup() and opening outputs
+  RUN_PHASE_INPUT,  // reading and publishing each cycle's line of input
+  RUN_PHASE_LOOP,  // loop(), apart from reading input
+  RUN_PHASE_OUTPUT,  // publishing cycle events and serial output, and draining the event bus at exit
+  RUN_PHASE_COUNT,
+} RunPhase;
+
+void runStatsBegin(void);
+bool runStatsEnabled(void);
+
+// The simulation thread enters 'phase' now.  Cheap enough to call a few times
+// per cycle; does nothing unless enabled.
+void runStatsEnter(RunPhase phase);
+void runStatsAddReport(void);
+void runStatsAddDroppedConsoleLine(void);
+
+// Prints the statistics on stderr; 'cycles' is the number of cycles run
+void runStatsPrint(unsigned cycles);
@@ -0,0 +1,308 @@
+#include "structured_trace.h"
+#include "event_bus.h"
+#include "virtual_io.h"
+#include <string>
+#include <stdio.h>
+#include <string.h>
+
+static bool enabled = false;
+static bool cbor = false;
+static FILE* tracefile = NULL;
+
+bool structuredTraceSetFormat(const char* name) {
+  if (strcmp(name, "jsonl") == 0) cbor = false;
+  else if (strcmp(name, "cbor") == 0) cbor = true;
+  else return false;
+  return true;
+}
+
+bool structuredTraceEnabled(void) {
+  return enabled;
+}
+
+// Builds one record at a time; the two encodings only differ in here
+class RecordEncoder {
+ public:
+  virtual ~RecordEncoder() {}
+  virtual void begin(const char* type) = 0;
+  virtual void integer(const char* key, long long value) = 0;
+  virtual void text(const char* key, const char* text) = 0;
+  virtual void bytes(const char* key, const uint8_t* data, size_t length) = 0;  // hex in JSON
+  virtual void characters(const char* key, const uint8_t* data, size_t length) = 0;  // a string of bytes in JSON
+  virtual void integers(const char* key, const unsigned* values, size_t count) = 0;
+  virtual void end(void) = 0;
+
+  std::string out;
+};
+
+class JsonEncoder : public RecordEncoder {
+ public:
+  virtual void begin(const char* type) override {
+    out.assign("{\"type\":\"");
+    out.append(type);
+    out.push_back('"');
+  }
+
+  virtual void integer(const char* key, long long value) override {
+    char number[24];
+    startField(key);
+    out.append(number, snprintf(number, sizeof(number), "%lld", value));
+  }
+
+  virtual void text(const char* key, const char* text) override {
+    startField(key);
+    quote((const uint8_t*)text, strlen(text));
+  }
+
+  virtual void bytes(const char* key, const uint8_t* data, size_t length) override {
+    startField(key);
+    static const char digits[] = "0123456789abcdef";
+    out.push_back('"');
+    for (size_t i = 0; i < length; i++) {
+      out.push_back(digits[data[i] >> 4]);
+      out.push_back(digits[data[i] & 0xf]);
+    }
+    out.push_back('"');
+  }
+
+  virtual void characters(const char* key, const uint8_t* data, size_t length) override {
+    startField(key);
+    quote(data, length);
+  }
+
+  virtual void integers(const char* key, const unsigned* values, size_t count) override {
+    char number[16];
+    startField(key);
+    out.push_back('[');
+    for (size_t i = 0; i < count; i++) {
+      if (i) out.push_back(',');
+      out.append(number, snprintf(number, sizeof(number), "%u", values[i]));
+    }
+    out.push_back(']');
+  }
+
+  virtual void end(void) override {
+    out.append("}\n");
+  }
+
+ private:
+  void startField(const char* key) {
+    out.append(",\"");
+    out.append(key);
+    out.append("\":");
+  }
+
+  // One character per byte: anything but printable ASCII is escaped as \u00XX
+  void quote(const uint8_t* data, size_t length) {
+    out.push_back('"');
+    for (size_t i = 0; i < length; i++) {
+      const uint8_t c = data[i];
+      if (c == '"' || c == '\\') {
+        out.push_back('\\');
+        out.push_back(c);
+      } else if (c == '\n') {
+        out.append("\\n");
+      } else if (c < 0x20 || c >= 0x7f) {
+        char escape[8];
+        out.append(escape, snprintf(escape, sizeof(escape), "\\u%04x", c));
+      } else {
+        out.push_back(c);
+      }
+    }
+    out.push_back('"');
+  }
+};
+
+// Each record is an indefinite-length map, so fields can be added as they are decoded
+class CborEncoder : public RecordEncoder {
+ public:
+  virtual void begin(const char* type) override {
+    out.assign(1, (char)0xbf);
+    text("type", type);
+  }
+
+  virtual void integer(const char* key, long long value) override {
+    string(3, key, strlen(key));
+    if (value >= 0) head(0, value);
+    else head(1, -1 - value);
+  }
+
+  virtual void text(const char* key, const char* text) override {
+    string(3, key, strlen(key));
+    string(3, text, strlen(text));
+  }
+
+  virtual void bytes(const char* key, const uint8_t* data, size_t length) override {
+    string(3, key, strlen(key));
+    string(2, (const char*)data, length);
+  }
+
+  virtual void characters(const char* key, const uint8_t* data, size_t length) override {
+    bytes(key, data, length);
+  }
+
+  virtual void integers(const char* key, const unsigned* values, size_t count) override {
+    string(3, key, strlen(key));
+    head(4, count);
+    for (size_t i = 0; i < count; i++) head(0, values[i]);
+  }
+
+  virtual void end(void) override {
+    out.push_back((char)0xff);
+  }
+
+ private:
+  // Major type and argument, in the shortest form
+  void head(uint8_t major, unsigned long long value) {
+    major <<= 5;
+    if (value < 24) {
+      out.push_back(major | value);
+      return;
+    }
+    int size = (value <= 0xff) ? 1 : (value <= 0xffff) ? 2 : (value <= 0xffffffffULL) ? 4 : 8;
+    out.push_back(major | ((size == 1) ? 24 : (size == 2) ? 25 : (size == 4) ? 26 : 27));
+    for (int shift = 8 * (size - 1); shift >= 0; shift -= 8) out.push_back((char)(value >> shift));
+  }
+
+  void string(uint8_t major, const char* data, size_t length) {
+    head(major, length);
+    out.append(data, length);
+  }
+};
+
+// The fields of each endpoint's reports (see structured_trace.h)
+static void decodeReport(RecordEncoder& encoder, unsigned device, const uint8_t* data, size_t length) {
+  unsigned usages[8 * 28];
+  size_t count = 0;
+  switch (device) {
+  case USB_ENDPOINT_KEYBOARD:
+    // modifier byte, then a bitmap of the usages held
+    if (length < 1) return;
+    encoder.integer("modifiers", data[0]);
+    for (size_t i = 1; i < length && i <= 28; i++) {
+      for (uint8_t bits = data[i]; bits; bits &= bits - 1) usages[count++] = (i - 1) * 8 + __builtin_ctz(bits);
+    }
+    encoder.integers("usages", usages, count);
+    break;
+  case USB_ENDPOINT_MOUSE:
+    if (length < 5) return;
+    encoder.integer("buttons", data[0]);
+    encoder.integer("x", (int8_t)data[1]);
+    encoder.integer("y", (int8_t)data[2]);
+    encoder.integer("wheel", (int8_t)data[3]);
+    encoder.integer("hwheel", (int8_t)data[4]);
+    break;
+  case USB_ENDPOINT_ABSOLUTE_MOUSE:
+    if (length < 6) return;
+    encoder.integer("buttons", data[0]);
+    encoder.integer("x", data[1] | (data[2] << 8));
+    encoder.integer("y", data[3] | (data[4] << 8));
+    encoder.integer("wheel", (int8_t)data[5]);
+    break;
+  case USB_ENDPOINT_CONSUMER_CONTROL:
+    // little-endian 16-bit usages, 0 for an empty slot
+    for (size_t i = 0; i + 1 < length && count < 8; i += 2) {
+      const unsigned usage = data[i] | (data[i + 1] << 8);
+      if (usage) usages[count++] = usage;
+    }
+    encoder.integers("usages", usages, count);
+    break;
+  case USB_ENDPOINT_SYSTEM_CONTROL:
+    for (size_t i = 0; i < length && count < 8; i++) if (data[i]) usages[count++] = data[i];
+    encoder.integers("usages", usages, count);
+    break;
+  default:
+    break;
+  }
+}
+
+class StructuredTraceSink : public EventSink {
+ public:
+  StructuredTraceSink() : encoder(NULL), continuing(false) {
+    payload.reserve(4096);
+  }
+
+  void begin(RecordEncoder* recordEncoder) {
+    encoder = recordEncoder;
+    encoder->out.reserve(4096);
+    encoder->begin("header");
+    encoder->text("schema", TRACE_SCHEMA);
+    encoder->integer("version", TRACE_VERSION);
+    write();
+  }
+
+  virtual void consume(const Event& event) override {
+    if (event.type == EVENT_USB_TEXT || event.type == EVENT_CONSOLE) return;
+    // events split across continuations are one record
+    if (!continuing) payload.clear();
+    payload.append((const char*)event.payload, event.length);
+    continuing = (event.flags & EVENT_FLAG_CONTINUED) != 0;
+    if (continuing) return;
+
+    const uint8_t* data = (const uint8_t*)payload.data();
+    switch (event.type) {
+    case EVENT_CYCLE:
+      startRecord("cycle", event);
+      break;
+    case EVENT_INPUT:
+      startRecord("input", event);
+      encoder->text("text", payload.c_str());
+      break;
+    case EVENT_REPORT:
+      startRecord("report", event);
+      encoder->text("device", usbEndpointName((UsbEndpoint)event.device));
+      encoder->bytes("raw", data, payload.size());
+      decodeReport(*encoder, event.device, data, payload.size());
+      break;
+    case EVENT_LED_FRAME:
+      startRecord("led", event);
+      encoder->bytes("rgb", data, payload.size());
+      break;
+    case EVENT_SERIAL:
+      startRecord("serial", event);
+      encoder->integer("port", event.device);
+      encoder->characters("data", data, payload.size());
+      break;
+    default:
+      return;
+    }
+    write();
+  }
+
+  virtual void finish(void) override {
+    fclose(tracefile);
+  }
+
+ private:
+  void startRecord(const char* type, const Event& event) {
+    encoder->begin(type);
+    encoder->integer("cycle", event.cycle);
+    encoder->integer("time", event.timeMicros);
+  }
+
+  void write(void) {
+    encoder->end();
+    fwrite(encoder->out.data(), 1, encoder->out.size(), tracefile);
+  }
+
+  RecordEncoder* encoder;
+  std::string payload;
+  bool continuing;
+};
+
+bool structuredTraceBegin(void) {
+  static StructuredTraceSink sink;
+  static JsonEncoder json;
+  static CborEncoder binary;
+  const std::string path = resultsPath(cbor ? "trace.cbor" : "trace.jsonl");
+  tracefile = fopen(path.c_str(), "wb");
+  if (!tracefile) {
+    fprintf(stderr, "Error opening %s\n", path.c_str());
+    return false;
+  }
+  setvbuf(tracefile, NULL, _IOFBF, 1 << 20);  // only read after the run; no need to flush often
+  sink.begin(cbor ? (RecordEncoder*)&binary : (RecordEncoder*)&json);
+  enabled = true;
+  eventBusAddSink(&sink);
+  return true;
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <stdbool.h>
+
+// Structured trace of a run, for tools that would otherwise parse USB.txt.
+//
+// A sink on the event bus writes one typed record per cycle, input line, HID
+// report (raw and decoded), LED frame and chunk of serial output, either as
+// JSON Lines (results/trace.jsonl, one object per line) or as a CBOR sequence
+// (results/trace.cbor, one map per record, RFC 8742).  Both encodings carry the
+// same records with the same keys; tools/trace-reader.h reads either.
+//
+// Schema, version TRACE_VERSION.  Every record has "type"; all but the header
+// also have "cycle" and "time" (virtual microseconds).
+//   header: "schema" (TRACE_SCHEMA), "version"; always the first record
+//   cycle:  start of a cycle
+//   input:  "text", the line of input read for the cycle
+//   report: "device" (endpoint name, e.g. "Keyboard"), "raw" (the report bytes),
+//           and the decoded fields for the endpoint:
+//             Keyboard:            "modifiers", "usages" (keys held, ascending)
+//             Mouse:               "buttons", "x", "y", "wheel", "hwheel" (relative)
+//             SingleAbsoluteMouse: "buttons", "x", "y" (absolute), "wheel"
+//             ConsumerControl:     "usages" (non-zero usages in the report)
+//             SystemControl:       "usages"
+//   led:    "rgb", the r, g, b bytes of every LED
+//   serial: "port", "data" (bytes written; empty when the port is opened)
+// Byte strings ("raw", "rgb", "data") are CBOR byte strings; in JSON, "raw" and
+// "rgb" are lowercase hex, and "data" is a string with one character (U+0000
+// to U+00FF) per byte.  New keys may be added without changing the version;
+// readers should skip keys they don't know.
+
+#define TRACE_SCHEMA "kaleidoscope-virtual-trace"
+#define TRACE_VERSION 1
+
+// The "device" names of the report endpoints, indexed by UsbEndpoint (see
+// virtual_io.h).  The same names appear in USB.txt and the other traces; the
+// tools, which don't link the core, use this table too.
+#define TRACE_DEVICE_COUNT 5
+static const char* const traceDeviceNames[TRACE_DEVICE_COUNT] = {
+  "Keyboard",
+  "Mouse",
+  "SingleAbsoluteMouse",
+  "ConsumerControl",
+  "SystemControl",
+};
+
+// Settings; these must be applied before structuredTraceBegin()
+bool structuredTraceSetFormat(const char* name);  // "jsonl" (default) or "cbor"; FALSE if unknown
+
+// Adds the trace writer to the event bus.  Returns TRUE if successful, FALSE if
+// the trace file couldn't be opened.
+bool structuredTraceBegin(void);
+bool structuredTraceEnabled(void);
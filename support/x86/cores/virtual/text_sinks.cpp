@@ -0,0 +1,446 @@
+#include "text_sinks.h"
+#include "event_bus.h"
+#include "virtual_io.h"
+#include "rolling_log.h"
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <atomic>
+#include <stdio.h>
+#include <string.h>
+
+// "00" to "ff", so that a byte is hex-encoded with one 2-byte copy
+static char hexPairs[256][2];
+static void initHexPairs(void) {
+  static const char digits[] = "0123456789abcdef";
+  for (int i = 0; i < 256; i++) {
+    hexPairs[i][0] = digits[i >> 4];
+    hexPairs[i][1] = digits[i & 0xf];
+  }
+}
+
+// Without leading zero
+static inline char* encodeHexByte(char* out, uint8_t byte) {
+  if (byte >= 0x10) *out++ = hexPairs[byte][0];
+  *out++ = hexPairs[byte][1];
+  return out;
+}
+
+// Descriptions of each endpoint's reports, formatted once at startup
+static char reportNotices[USB_ENDPOINT_COUNT][64];  // "A virtual <Name> HID report was sent."
+static char reportPrefixes[USB_ENDPOINT_COUNT][48];  // "<Name> HID report: 0x"
+static void initDescriptors(void) {
+  for (int i = 0; i < USB_ENDPOINT_COUNT; i++) {
+    snprintf(reportNotices[i], sizeof(reportNotices[i]), "A virtual %s HID report was sent.", usbEndpointName((UsbEndpoint)i));
+    snprintf(reportPrefixes[i], sizeof(reportPrefixes[i]), "%s HID report: 0x", usbEndpointName((UsbEndpoint)i));
+  }
+}
+
+// What produced an event, for mismatch reports
+static std::string describeSource(const Event& event) {
+  char description[64];
+  switch (event.type) {
+  case EVENT_REPORT:
+  case EVENT_USB_TEXT:
+    return usbEndpointName((UsbEndpoint)event.device);
+  case EVENT_LED_FRAME:
+    return "LEDs";
+  case EVENT_SERIAL:
+    snprintf(description, sizeof(description), "serial port %u", (unsigned)event.device);
+    return description;
+  default:
+    return "?";
+  }
+}
+
+static std::atomic<bool> mismatch(false);
+
+bool textSinksMismatch(void) {
+  return mismatch.load(std::memory_order_relaxed);
+}
+
+// Where a log goes: either to its file, or (with --expect-*) into a comparison
+// against the expected contents of that file
+class TextOutput {
+ public:
+  virtual ~TextOutput() {}
+  // 'event' is the event the text was formatted from, for reporting mismatches
+  virtual void write(const Event& event, const char* text, size_t length) = 0;
+  virtual void finish(void) {}
+};
+
+class FileOutput : public TextOutput {
+ public:
+  // flushEachWrite keeps the file current for 'tail -f'
+  FileOutput(FILE* file, bool flushEachWrite) : file(file), flushEachWrite(flushEachWrite) {}
+
+  virtual void write(const Event& event, const char* text, size_t length) override {
+    fwrite(text, 1, length, file);
+    if (flushEachWrite) fflush(file);
+  }
+
+  virtual void finish(void) override {
+    fclose(file);
+  }
+
+ private:
+  FILE* file;
+  bool flushEachWrite;
+};
+
+// A log split into segments (see rolling_log.h)
+class RollingOutput : public TextOutput {
+ public:
+  RollingOutput(const char* filename, bool flushEachWrite) : log(filename, flushEachWrite) {}
+
+  bool open(void) {
+    return log.open();
+  }
+
+  virtual void write(const Event& event, const char* text, size_t length) override {
+    log.write(event.cycle, text, length);
+  }
+
+  virtual void finish(void) override {
+    log.close();
+  }
+
+ private:
+  RollingLog log;
+};
+
+// Compares the log, as it is produced, against an expected copy read in at
+// startup.  Only the first difference is reported.
+class ExpectedOutput : public TextOutput {
+ public:
+  ExpectedOutput(const std::string& name, const std::string& path) : name(name), path(path), position(0), failed(false) {}
+
+  bool load(void) {
+    std::ifstream in(path.c_str(), std::ios::binary);
+    if (!in) {
+      std::cerr << "Error opening expected output \"" << path << "\"" << std::endl;
+      return false;
+    }
+    expected.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    return true;
+  }
+
+  virtual void write(const Event& event, const char* text, size_t length) override {
+    if (failed) return;
+    size_t same = 0;
+    while (same < length && position + same < expected.size() && text[same] == expected[position + same]) same++;
+    if (same == length) {
+      position += length;
+      return;
+    }
+    fail();
+    // The line with the difference, from its start (which may have been written earlier)
+    const size_t at = position + same;
+    const size_t lineStart = (at == 0) ? 0 : expected.rfind('\n', at - 1) + 1;  // npos + 1 == 0
+    std::string actual;
+    size_t from = 0;
+    if (lineStart < position) actual = expected.substr(lineStart, position - lineStart);
+    else from = lineStart - position;
+    const char* newline = (const char*)memchr(text + same, '\n', length - same);
+    actual.append(text + from, (newline ? newline - text : length) - from);
+    std::cerr << "Error: " << name << " differs from " << path << " at cycle " << event.cycle
+              << " (" << describeSource(event) << "), line " << lineNumber(lineStart) << ":" << std::endl;
+    std::cerr << "  expected: " << expectedLine(lineStart) << std::endl;
+    std::cerr << "  actual:   " << actual << std::endl;
+  }
+
+  virtual void finish(void) override {
+    if (failed || position == expected.size()) return;
+    fail();
+    const size_t lineStart = (position == 0) ? 0 : expected.rfind('\n', position - 1) + 1;
+    std::cerr << "Error: " << name << " ended at line " << lineNumber(lineStart) << ", but " << path
+              << " continues:" << std::endl;
+    std::cerr << "  expected: " << expectedLine(lineStart) << std::endl;
+  }
+
+ private:
+  void fail(void) {
+    failed = true;
+    mismatch.store(true, std::memory_order_relaxed);
+  }
+
+  size_t lineNumber(size_t offset) {
+    size_t lines = 1;
+    for (size_t i = 0; i < offset; i++) if (expected[i] == '\n') lines++;
+    return lines;
+  }
+
+  std::string expectedLine(size_t lineStart) {
+    if (lineStart >= expected.size()) return "(end of file)";
+    const size_t lineEnd = expected.find('\n', lineStart);
+    return expected.substr(lineStart, (lineEnd == std::string::npos) ? std::string::npos : lineEnd - lineStart);
+  }
+
+  std::string name;
+  std::string path;
+  std::string expected;
+  size_t position;  // how much of 'expected' has been matched
+  bool failed;
+};
+
+// Output for one of the logs; NULL if the file couldn't be opened
+static TextOutput* openOutput(const char* filename, const std::string& expectedPath, bool flushEachWrite) {
+  if (!expectedPath.empty()) {
+    ExpectedOutput* output = new ExpectedOutput(filename, expectedPath);
+    if (output->load()) return output;
+    delete output;
+    return NULL;
+  }
+  if (rollingLogEnabled()) {
+    RollingOutput* output = new RollingOutput(filename, flushEachWrite);
+    if (output->open()) return output;
+    delete output;
+    return NULL;
+  }
+  FILE* file = fopen(resultsPath(filename).c_str(), "w");
+  if (!file) {
+    std::cerr << "Error opening " << resultsPath(filename) << std::endl;
+    return NULL;
+  }
+  return new FileOutput(file, flushEachWrite);
+}
+
+// Builds "Cycle N: " and the payload of each event (plus any continuations) into
+// one record, so that an output sees whole lines
+class LineSink : public EventSink {
+ public:
+  LineSink() : out(NULL), continuing(false) {
+    record.reserve(4096);
+  }
+
+  void setOutput(TextOutput* output) {
+    out = output;
+  }
+
+  virtual void finish(void) override {
+    out->finish();
+  }
+
+ protected:
+  void startRecord(const Event& event) {
+    if (!continuing) {
+      char prefix[32];
+      record.assign(prefix, snprintf(prefix, sizeof(prefix), "Cycle %u: ", (unsigned)event.cycle));
+    }
+    continuing = (event.flags & EVENT_FLAG_CONTINUED) != 0;
+  }
+
+  // Writes the record once its last continuation has been added
+  void endRecord(const Event& event, const char* ending) {
+    if (continuing) return;
+    record.append(ending);
+    out->write(event, record.data(), record.size());
+  }
+
+  TextOutput* out;
+  std::string record;
+  bool continuing;
+};
+
+class ConsoleSink : public EventSink {
+ public:
+  ConsoleSink() : quietCycles(false), cycleUnprinted(false), continuing(false) {}
+
+  void setQuietCycles(bool quiet) {
+    quietCycles = quiet;
+  }
+
+  virtual void consume(const Event& event) override {
+    switch (event.type) {
+    case EVENT_CYCLE:
+      cycleUnprinted = true;
+      if (!quietCycles) printCycle(event);
+      break;
+    case EVENT_REPORT:
+      // keyboard reports are described by the keyboard's report consumer instead
+      if (event.device == USB_ENDPOINT_SYSTEM_CONTROL && event.length) {
+        printCycle(event);
+        std::cout << "A virtual SystemControl HID report with value " << (unsigned int)event.payload[0] << " was sent." << std::endl;
+      } else if (event.device != USB_ENDPOINT_KEYBOARD && event.device < USB_ENDPOINT_COUNT) {
+        printCycle(event);
+        std::cout << reportNotices[event.device] << std::endl;
+      }
+      break;
+    case EVENT_CONSOLE:
+      printCycle(event);
+      std::cout.write((const char*)event.payload, event.length);
+      continuing = (event.flags & EVENT_FLAG_CONTINUED) != 0;
+      if (!continuing) std::cout << std::endl;
+      break;
+    default:
+      break;
+    }
+  }
+
+ private:
+  // The "Starting cycle" marker, once per cycle
+  void printCycle(const Event& event) {
+    if (!cycleUnprinted) return;
+    cycleUnprinted = false;
+    std::cout << "Starting cycle " << event.cycle << std::endl;
+  }
+
+  bool quietCycles;
+  bool cycleUnprinted;
+  bool continuing;
+};
+
+class USBLogSink : public LineSink {
+ public:
+  virtual void consume(const Event& event) override {
+    if (event.type == EVENT_REPORT && event.device != USB_ENDPOINT_KEYBOARD && event.device < USB_ENDPOINT_COUNT) {
+      startRecord(event);
+      record.append(reportPrefixes[event.device]);
+      char hex[2 * EVENT_PAYLOAD_SIZE];
+      for (int i = 0; i < event.length; i++) memcpy(hex + 2 * i, hexPairs[event.payload[i]], 2);
+      record.append(hex, 2 * event.length);
+      endRecord(event, "\n");
+    } else if (event.type == EVENT_USB_TEXT) {
+      startRecord(event);
+      record.append((const char*)event.payload, event.length);
+      endRecord(event, "\n");
+    }
+  }
+};
+
+class LEDLogSink : public LineSink {
+ public:
+  virtual void consume(const Event& event) override {
+    if (event.type != EVENT_LED_FRAME) return;
+    // log format: red.green.blue where values are written in hex; followed by a space, followed by the next LED
+    startRecord(event);
+    char text[3 * EVENT_PAYLOAD_SIZE + EVENT_PAYLOAD_SIZE / 3];  // up to "ff.ff.ff " per LED
+    char* end = text;
+    for (int i = 0; i + 2 < event.length; i += 3) {
+      end = encodeHexByte(end, event.payload[i]);
+      *end++ = '.';
+      end = encodeHexByte(end, event.payload[i + 1]);
+      *end++ = '.';
+      end = encodeHexByte(end, event.payload[i + 2]);
+      *end++ = ' ';
+    }
+    record.append(text, end - text);
+    endRecord(event, "\n\n");
+  }
+};
+
+class SerialLogSink : public EventSink {
+ public:
+  SerialLogSink() : logged(true) {}
+
+  // Whether to write the ports that aren't compared with an expected file
+  void setLogged(bool enabled) {
+    logged = enabled;
+  }
+
+  void expect(unsigned port, const std::string& path) {
+    if (port >= expectedPaths.size()) expectedPaths.resize(port + 1);
+    expectedPaths[port] = path;
+  }
+
+  // Expected outputs are opened up front, so that a port that never opens still
+  // gets compared
+  bool openExpected(void) {
+    outputs.resize(expectedPaths.size(), NULL);
+    for (size_t port = 0; port < expectedPaths.size(); port++) {
+      if (expectedPaths[port].empty()) continue;
+      if (!(outputs[port] = openOutput(filename(port).c_str(), expectedPaths[port], false))) return false;
+    }
+    return true;
+  }
+
+  virtual void consume(const Event& event) override {
+    if (event.type != EVENT_SERIAL) return;
+    if (event.device >= outputs.size()) outputs.resize(event.device + 1, NULL);
+    TextOutput*& out = outputs[event.device];
+    if (!out && (!logged || !(out = openOutput(filename(event.device).c_str(), "", false)))) return;
+    if (event.length) out->write(event, (const char*)event.payload, event.length);
+  }
+
+  virtual void finish(void) override {
+    for (size_t i = 0; i < outputs.size(); i++) if (outputs[i]) outputs[i]->finish();
+  }
+
+ private:
+  static std::string filename(unsigned port) {
+    char name[32];
+    snprintf(name, sizeof(name), "serial_%u.txt", port);
+    return name;
+  }
+
+  std::vector<std::string> expectedPaths;
+  std::vector<TextOutput*> outputs;
+  bool logged;
+};
+
+static ConsoleSink console;
+static USBLogSink usb;
+static LEDLogSink led;
+static SerialLogSink serial;
+static std::string expectedUSB;
+static std::string expectedLED;
+static bool comparing = false;  // any --expect-*
+static bool consoleEnabled = true;
+static bool flushLogs = true;
+static bool usbLogged = true;
+static bool ledLogged = true;
+
+void textSinksExpectUSB(const char* path) {
+  expectedUSB = path;
+  comparing = true;
+}
+
+void textSinksExpectLED(const char* path) {
+  expectedLED = path;
+  comparing = true;
+}
+
+void textSinksExpectSerial(unsigned port, const char* path) {
+  serial.expect(port, path);
+  comparing = true;
+}
+
+bool textSinksComparing(void) {
+  return comparing;
+}
+
+void textSinksSetConsole(bool enabled) {
+  consoleEnabled = enabled;
+}
+
+void textSinksSetFlush(bool flushEachWrite) {
+  flushLogs = flushEachWrite;
+}
+
+void textSinksSetQuietCycles(bool quiet) {
+  console.setQuietCycles(quiet);
+}
+
+void textSinksSetTraces(bool usb, bool led, bool serialPorts) {
+  usbLogged = usb;
+  ledLogged = led;
+  serial.setLogged(serialPorts);
+}
+
+bool addTextSinks(void) {
+  initHexPairs();
+  initDescriptors();
+  const bool usbWanted = usbLogged || !expectedUSB.empty();
+  const bool ledWanted = ledLogged || !expectedLED.empty();
+  TextOutput* usbOutput = usbWanted ? openOutput("USB.txt", expectedUSB, flushLogs) : NULL;
+  TextOutput* ledOutput = ledWanted ? openOutput("LED.txt", expectedLED, flushLogs) : NULL;
+  if ((usbWanted && !usbOutput) || (ledWanted && !ledOutput) || !serial.openExpected()) return false;
+  usb.setOutput(usbOutput);
+  led.setOutput(ledOutput);
+  if (consoleEnabled) eventBusAddSink(&console);
+  if (usbWanted) eventBusAddSink(&usb);
+  if (ledWanted) eventBusAddSink(&led);
+  eventBusAddSink(&serial);
+  return true;
+}
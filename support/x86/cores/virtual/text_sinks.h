@@ -0,0 +1,37 @@
+#pragma once
+
+// The human-readable outputs of the simulator, as sinks on the event bus:
+//   - stdout: cycle markers, report notices and console text
+//   - results/USB.txt: one line per HID report
+//   - results/LED.txt: the state of every LED upon each syncLeds()
+//   - results/serial_N.txt: bytes written to each serial port
+
+// Instead of writing USB.txt, LED.txt or serial_N.txt, compare it as it is
+// produced against an expected copy of the file.  The first difference is
+// reported on stderr.  These must be called before addTextSinks().
+void textSinksExpectUSB(const char* path);
+void textSinksExpectLED(const char* path);
+void textSinksExpectSerial(unsigned port, const char* path);
+
+// Which of the outputs above to produce (all by default).  A trace that is
+// compared with an expected file is produced regardless.  These must also be
+// called before addTextSinks().
+void textSinksSetConsole(bool enabled);
+void textSinksSetTraces(bool usb, bool led, bool serial);
+
+// Whether to flush USB.txt and LED.txt after every line, so that 'tail -f'
+// keeps up (the default); off for --headless, where nobody is watching
+void textSinksSetFlush(bool flushEachWrite);
+
+// Only print "Starting cycle N" on stdout for cycles that print something else
+// (for --realtime, which runs a thousand cycles a second)
+void textSinksSetQuietCycles(bool quiet);
+
+// Returns TRUE if successful, FALSE if a results file (or expected file) couldn't be opened
+bool addTextSinks(void);
+
+// TRUE if any output is compared with an expected file
+bool textSinksComparing(void);
+
+// TRUE once any comparison with an expected file has failed
+bool textSinksMismatch(void);
@@ -0,0 +1,286 @@
+#include "time_travel.h"
+#include "checkpoint.h"
+#include <deque>
+#include <vector>
+#include <algorithm>
+#include <stdio.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+// A page of the snapshotted state, or the part of one that it shares with other data
+typedef struct {
+  uint8_t* address;
+  uint32_t size;
+  bool tracked;  // a whole page, write-protected between snapshots
+} Chunk;
+
+// In the ring, followed by the indexes (uint32_t) of the chunks it holds,
+// their contents in the same order, and then the line of input
+typedef struct {
+  uint32_t cycle;  // the state at the start of this cycle
+  uint32_t chunks;
+  uint64_t clockMicros;
+  uint32_t lineLength;  // of the cycle before's line
+  uint32_t full;
+} SnapshotHeader;
+
+typedef struct {
+  size_t offset;  // in the ring
+  size_t length;
+  uint32_t cycle;
+  bool full;
+} Snapshot;
+
+static bool enabled = false;
+static std::vector<Chunk> chunks;  // in address order
+static volatile uint8_t* dirty = NULL;  // per chunk: written since the last snapshot (always, if untracked)
+static uint8_t* ring = NULL;
+static size_t capacity = 0;
+static std::deque<Snapshot> snapshots;  // oldest first; the first is always full
+static struct sigaction previousHandler;
+static bool rewindRequested = false;
+static unsigned rewindTo = 0;
+static bool replayRequested = false;
+static std::deque<std::string> replayLines;
+static int (*volatile forGdb)(unsigned) = NULL;
+
+// The first chunk that ends after 'address', or chunks.size()
+static size_t chunkAt(const uint8_t* address) {
+  size_t low = 0, high = chunks.size();
+  while (low < high) {
+    const size_t middle = (low + high) / 2;
+    if (chunks[middle].address + chunks[middle].size <= address) low = middle + 1;
+    else high = middle;
+  }
+  return low;
+}
+
+__attribute__((noinline)) void timeTravelForeignFault(void) {
+  sigaction(SIGSEGV, &previousHandler, NULL);  // it faults again on return, and goes there
+}
+
+static void onFault(int signal, siginfo_t* info, void* context) {
+  const uint8_t* address = (const uint8_t*)info->si_addr;
+  const size_t i = chunkAt(address);
+  if (i < chunks.size() && chunks[i].tracked && chunks[i].address <= address && !dirty[i]) {
+    dirty[i] = 1;
+    mprotect(chunks[i].address, chunks[i].size, PROT_READ | PROT_WRITE);
+    return;
+  }
+  timeTravelForeignFault();
+}
+
+// Write-protects the tracked chunks written since the last snapshot
+static void protectDirty(void) {
+  for (size_t i = 0; i < chunks.size(); i++) {
+    if (!chunks[i].tracked || !dirty[i]) continue;
+    mprotect(chunks[i].address, chunks[i].size, PROT_READ);
+    dirty[i] = 0;
+  }
+}
+
+static size_t snapshotLength(bool full, size_t lineLength) {
+  size_t length = sizeof(SnapshotHeader) + lineLength;
+  for (size_t i = 0; i < chunks.size(); i++) {
+    if (full || dirty[i]) length += sizeof(uint32_t) + chunks[i].size;
+  }
+  return (length + 7) & ~(size_t)7;
+}
+
+// Where in the ring 'length' bytes would go after the newest snapshot; FALSE if they don't fit
+static bool fits(size_t length, size_t& at) {
+  if (snapshots.empty()) {
+    at = 0;
+    return length <= capacity;
+  }
+  const size_t head = snapshots.front().offset;
+  const size_t tail = snapshots.back().offset + snapshots.back().length;
+  if (tail > head) {
+    at = (capacity - tail >= length) ? tail : 0;
+    return at == tail || head >= length;
+  }
+  at = tail;
+  return head - tail >= length;
+}
+
+// Drops the oldest full snapshot and the deltas that depend on it
+static void dropOldest(void) {
+  snapshots.pop_front();
+  while (!snapshots.empty() && !snapshots.front().full) snapshots.pop_front();
+}
+
+bool timeTravelBegin(unsigned long long budget, unsigned cycle, uint64_t clockMicros) {
+  std::vector<CheckpointRegion> regions;
+  if (!checkpointRegions(regions)) return false;
+  const uintptr_t pageSize = sysconf(_SC_PAGESIZE);
+  for (size_t r = 0; r < regions.size(); r++) {
+    const uintptr_t end = regions[r].address + regions[r].size;
+    for (uintptr_t start = regions[r].address; start < end; ) {
+      const uintptr_t pageEnd = (start & ~(pageSize - 1)) + pageSize;
+      const uintptr_t chunkEnd = std::min(pageEnd, end);
+      Chunk chunk = {(uint8_t*)start, (uint32_t)(chunkEnd - start), chunkEnd - start == pageSize};
+      chunks.push_back(chunk);
+      start = chunkEnd;
+    }
+  }
+  std::sort(chunks.begin(), chunks.end(), [](const Chunk& a, const Chunk& b) { return a.address < b.address; });
+
+  // room for a full snapshot and the deltas after it, as well as the one before
+  const size_t full = snapshotLength(true, 0);
+  if (budget < 4 * full) {
+    fprintf(stderr, "Error: --time-travel needs a budget of at least %zu bytes for this sketch\n", 4 * full);
+    return false;
+  }
+  capacity = budget;
+  void* mapping = mmap(NULL, capacity, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (mapping == MAP_FAILED) {
+    fprintf(stderr, "Error: can't map %zu bytes for --time-travel\n", capacity);
+    return false;
+  }
+  ring = (uint8_t*)mapping;
+  dirty = new uint8_t[chunks.size()];
+  for (size_t i = 0; i < chunks.size(); i++) dirty[i] = 1;
+
+  struct sigaction action;
+  memset(&action, 0, sizeof(action));
+  action.sa_sigaction = onFault;
+  action.sa_flags = SA_SIGINFO;
+  sigemptyset(&action.sa_mask);
+  sigaction(SIGSEGV, &action, &previousHandler);
+  forGdb = virtualRewind;  // so that --gc-sections keeps it
+  enabled = true;
+  timeTravelRecord(cycle, clockMicros, NULL, 0);
+  return true;
+}
+
+bool timeTravelEnabled(void) {
+  return enabled;
+}
+
+void timeTravelRecord(unsigned cycle, uint64_t clockMicros, const char* line, size_t length) {
+  if (!enabled) return;
+  unsigned lastFull = 0;
+  for (size_t i = snapshots.size(); i-- > 0; ) {
+    if (snapshots[i].full) {
+      lastFull = snapshots[i].cycle;
+      break;
+    }
+  }
+  bool full = snapshots.empty() || cycle - lastFull >= TIME_TRAVEL_FULL_INTERVAL;
+  size_t snapshotSize = snapshotLength(full, length);
+  size_t at;
+  while (!fits(snapshotSize, at)) {
+    dropOldest();
+    if (snapshots.empty() && !full) {
+      // the deltas since the last full snapshot fill the ring on their own
+      full = true;
+      snapshotSize = snapshotLength(true, length);
+    }
+  }
+
+  uint8_t* out = ring + at;
+  SnapshotHeader header = {cycle, 0, clockMicros, (uint32_t)length, full};
+  uint32_t* indexes = (uint32_t*)(out + sizeof(header));
+  for (size_t i = 0; i < chunks.size(); i++) {
+    if (full || dirty[i]) indexes[header.chunks++] = i;
+  }
+  uint8_t* contents = (uint8_t*)(indexes + header.chunks);
+  for (uint32_t k = 0; k < header.chunks; k++) {
+    const Chunk& chunk = chunks[indexes[k]];
+    memcpy(contents, chunk.address, chunk.size);
+    contents += chunk.size;
+  }
+  if (length) memcpy(contents, line, length);
+  memcpy(out, &header, sizeof(header));
+  Snapshot snapshot = {at, snapshotSize, cycle, full};
+  snapshots.push_back(snapshot);
+  protectDirty();
+}
+
+// The snapshot of the start of 'cycle', or snapshots.size()
+static size_t findSnapshot(unsigned cycle) {
+  for (size_t i = snapshots.size(); i-- > 0; ) {
+    if (snapshots[i].cycle == cycle) return i;
+    if (snapshots[i].cycle < cycle) break;
+  }
+  return snapshots.size();
+}
+
+bool timeTravelRequest(unsigned cycle, bool replay) {
+  if (!enabled) {
+    fprintf(stderr, "Error: rewinding needs --time-travel\n");
+    return false;
+  }
+  if (findSnapshot(cycle) == snapshots.size()) {
+    fprintf(stderr, "Error: can't rewind to cycle %u; the window is cycles %u to %u\n", cycle, snapshots.front().cycle,
+            snapshots.back().cycle);
+    return false;
+  }
+  rewindRequested = true;
+  rewindTo = cycle;
+  replayRequested = replay;
+  return true;
+}
+
+int virtualRewind(unsigned cycle) {
+  return timeTravelRequest(cycle, true);
+}
+
+// Writes a snapshot's chunks back into place; returns its header
+static SnapshotHeader apply(const Snapshot& snapshot) {
+  const uint8_t* in = ring + snapshot.offset;
+  SnapshotHeader header;
+  memcpy(&header, in, sizeof(header));
+  const uint32_t* indexes = (const uint32_t*)(in + sizeof(header));
+  const uint8_t* contents = (const uint8_t*)(indexes + header.chunks);
+  for (uint32_t k = 0; k < header.chunks; k++) {
+    const Chunk& chunk = chunks[indexes[k]];
+    memcpy(chunk.address, contents, chunk.size);  // a protected page faults, and is marked dirty
+    contents += chunk.size;
+  }
+  return header;
+}
+
+static std::string lineOf(const Snapshot& snapshot) {
+  const uint8_t* in = ring + snapshot.offset;
+  SnapshotHeader header;
+  memcpy(&header, in, sizeof(header));
+  const uint32_t* indexes = (const uint32_t*)(in + sizeof(header));
+  const uint8_t* contents = (const uint8_t*)(indexes + header.chunks);
+  for (uint32_t k = 0; k < header.chunks; k++) contents += chunks[indexes[k]].size;
+  return std::string((const char*)contents, header.lineLength);
+}
+
+bool timeTravelRewind(unsigned* cycle, uint64_t* clockMicros) {
+  if (!rewindRequested) return false;
+  rewindRequested = false;
+  const size_t target = findSnapshot(rewindTo);
+  if (target == snapshots.size()) return false;  // dropped since it was requested
+  size_t first = target;
+  while (!snapshots[first].full) first--;
+  SnapshotHeader header;
+  for (size_t i = first; i <= target; i++) header = apply(snapshots[i]);
+
+  // the lines of the cycles rewound over, ahead of any still to be replayed
+  std::deque<std::string> lines;
+  if (replayRequested) {
+    for (size_t i = target + 1; i < snapshots.size(); i++) lines.push_back(lineOf(snapshots[i]));
+    lines.insert(lines.end(), replayLines.begin(), replayLines.end());
+  }
+  replayLines.swap(lines);
+  snapshots.erase(snapshots.begin() + target + 1, snapshots.end());
+  // memory is now as the last snapshot left it, so deltas start afresh
+  protectDirty();
+  *cycle = header.cycle;
+  *clockMicros = header.clockMicros;
+  return true;
+}
+
+bool timeTravelReplayLine(std::string& line) {
+  if (replayLines.empty()) return false;
+  line = replayLines.front();
+  replayLines.pop_front();
+  return true;
+}
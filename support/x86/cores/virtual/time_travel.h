@@ -0,0 +1,61 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+
+// Time-travel debugging (--time-travel[=BUDGET]).
+//
+// At every cycle boundary, the state a checkpoint would hold (see
+// checkpoint.h) is snapshotted into an in-memory ring, along with the cycle's
+// line of input: a full snapshot every TIME_TRAVEL_FULL_INTERVAL cycles, and
+// in between only the pages written since the previous snapshot.  Whole pages
+// of that state are write-protected after each snapshot, so the first write
+// to one in a cycle faults and marks it dirty; the few pages it shares with
+// other data are copied every time.  The oldest snapshots are dropped, a full
+// snapshot and the deltas after it at a time, to keep the ring within BUDGET
+// bytes.
+//
+// Rewinding to a cycle in the window takes effect at the end of the current
+// cycle: the state at the start of that cycle is rebuilt from the full
+// snapshot before it and the deltas since, the cycle number and virtual clock
+// are set back, and the snapshots after it are dropped.  From gdb,
+// virtualRewind() then replays the input of the cycles rewound over, so the
+// run goes the same way again (see tools/time-travel.gdb); "@rewind CYCLE" in
+// the input instead goes on with the input that follows it.
+
+#define TIME_TRAVEL_FULL_INTERVAL 1000  // cycles between full snapshots
+#define TIME_TRAVEL_DEFAULT_BUDGET (64ULL << 20)
+
+// Starts with a full snapshot of the state at the start of 'cycle'; returns
+// FALSE after printing an error if this build can't, or 'budget' is too small
+bool timeTravelBegin(unsigned long long budget, unsigned cycle, uint64_t clockMicros);
+bool timeTravelEnabled(void);
+
+// At each cycle boundary: snapshots the state at the start of 'cycle', and
+// keeps the line of input of the cycle before
+void timeTravelRecord(unsigned cycle, uint64_t clockMicros, const char* line, size_t length);
+
+// Asks to rewind to the start of 'cycle' at the end of the current cycle, and
+// whether to replay the input since then.  Returns FALSE after printing an
+// error if it isn't in the window.
+bool timeTravelRequest(unsigned cycle, bool replay);
+
+// After timeTravelRecord(): carries out a requested rewind, returning TRUE and
+// the cycle and clock to go on from
+bool timeTravelRewind(unsigned* cycle, uint64_t* clockMicros);
+
+// The next line of input to replay after a rewind, if any
+bool timeTravelReplayLine(std::string& line);
+
+extern "C" {
+// For gdb ("call virtualRewind(N)"): rewinds to the start of cycle N at the
+// end of the current cycle and replays the input since.  Returns 0 if N is
+// outside the window.
+int virtualRewind(unsigned cycle);
+
+// Where a fault that isn't a write to a snapshotted page goes on to the
+// previous handler (e.g. the default, which ends the run); a place for gdb to
+// stop, as it has to let the snapshot faults through
+void timeTravelForeignFault(void);
+}
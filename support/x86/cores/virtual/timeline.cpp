@@ -0,0 +1,343 @@
+#include "timeline.h"
+#include "event_bus.h"
+#include "virtual_io.h"
+#include "virtual_clock.h"
+#include <string>
+#include <atomic>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>  // clock_gettime()
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>  // __rdtsc()
+#endif
+
+static bool enabled = false;
+static TimelineDetail detail = TIMELINE_DETAIL_CYCLES;
+static FILE* timelinefile = NULL;
+static uint64_t originTicks = 0;  // timelineNow() at timelineBegin()
+static uint64_t originNanos = 0;  // CLOCK_MONOTONIC at timelineBegin()
+
+static const char* names[TIMELINE_NAME_COUNT] = {
+  "cycle",
+  "loop",
+  "readMatrix",
+  "actOnMatrixScan",
+  "handleKeyswitchEvent",
+  "syncLeds",
+  "report",
+};
+
+// The least detail that records each name
+static const TimelineDetail detailOf[TIMELINE_NAME_COUNT] = {
+  TIMELINE_DETAIL_CYCLES,
+  TIMELINE_DETAIL_PHASES,
+  TIMELINE_DETAIL_PHASES,
+  TIMELINE_DETAIL_PHASES,
+  TIMELINE_DETAIL_KEYS,
+  TIMELINE_DETAIL_PHASES,
+  TIMELINE_DETAIL_PHASES,
+};
+
+// A span (or, with end == start, an instant) on the wall-clock timeline
+typedef struct {
+  uint64_t start;
+  uint64_t end;
+  uint32_t cycle;
+  uint32_t arg;
+  uint32_t name;  // TimelineName
+  uint32_t instant;
+} TimelineRecord;  // 32 bytes
+
+#define CHUNK_RECORDS 32768  // 1 MiB per chunk
+
+typedef struct {
+  TimelineRecord records[CHUNK_RECORDS];
+  unsigned count;
+  // timelineNow() and CLOCK_MONOTONIC when the chunk was handed off, to convert
+  // the records' ticks to nanoseconds
+  uint64_t ticks;
+  uint64_t nanos;
+  std::atomic<bool> busy;  // handed to the sink and not yet written
+} TimelineChunk;
+
+static TimelineChunk chunks[2];
+static unsigned filling = 0;  // chunk the simulation thread is adding to
+
+void timelineSetDetail(TimelineDetail newDetail) {
+  detail = newDetail;
+}
+
+bool timelineEnabled(void) {
+  return enabled;
+}
+
+bool timelineRecords(TimelineName name) {
+  return enabled && detailOf[name] <= detail;
+}
+
+static uint64_t monotonicNanos(void) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+// The TSC where there is one: it's read in about half the time of
+// clock_gettime(), which is most of what a span costs
+uint64_t timelineNow(void) {
+#if defined(__x86_64__) || defined(__i386__)
+  return __rdtsc();
+#else
+  return monotonicNanos();
+#endif
+}
+
+// Gives the current chunk to the sink, and continues in the other one once the
+// sink is done with it
+static void handOff(void) {
+  chunks[filling].ticks = timelineNow();
+  chunks[filling].nanos = monotonicNanos();
+  chunks[filling].busy.store(true, std::memory_order_relaxed);
+  eventBusPublish(EVENT_TIMELINE, filling, NULL, 0);  // publishing releases the records
+  filling ^= 1;
+  if (chunks[filling].busy.load(std::memory_order_acquire)) eventBusSync();
+  chunks[filling].count = 0;
+}
+
+static void record(TimelineName name, uint64_t start, uint64_t end, uint32_t arg, bool instant) {
+  TimelineChunk& chunk = chunks[filling];
+  TimelineRecord& record = chunk.records[chunk.count];
+  record.start = start;
+  record.end = end;
+  record.cycle = currentCycle();
+  record.arg = arg;
+  record.name = name;
+  record.instant = instant;
+  if (++chunk.count == CHUNK_RECORDS) handOff();
+}
+
+void timelineSpan(TimelineName name, uint64_t start, uint32_t arg) {
+  if (timelineRecords(name)) record(name, start, timelineNow(), arg, false);
+}
+
+void timelineInstant(TimelineName name, uint32_t arg) {
+  if (!timelineRecords(name)) return;
+  const uint64_t now = timelineNow();
+  record(name, now, now, arg, true);
+}
+
+void timelineFlush(void) {
+  if (enabled && chunks[filling].count) handOff();
+}
+
+#define WALL_PID 1
+#define VIRTUAL_PID 2
+#define VIRTUAL_CYCLE_TID 1
+#define VIRTUAL_OUTPUT_TID 2
+
+// Formats one trace event without printf, which would be most of the cost of
+// writing the timeline
+class EventText {
+ public:
+  EventText() : end(text) {}
+
+  EventText& operator<<(const char* s) {
+    while (*s) *end++ = *s++;
+    return *this;
+  }
+
+  EventText& operator<<(unsigned long long value) {
+    char digits[20];
+    int count = 0;
+    do {
+      digits[count++] = '0' + value % 10;
+      value /= 10;
+    } while (value);
+    while (count) *end++ = digits[--count];
+    return *this;
+  }
+
+  // Nanoseconds as microseconds with three decimals, the unit of "ts" and "dur"
+  EventText& nanos(uint64_t value) {
+    *this << (unsigned long long)(value / 1000);
+    const unsigned fraction = value % 1000;
+    *end++ = '.';
+    *end++ = '0' + fraction / 100;
+    *end++ = '0' + fraction / 10 % 10;
+    *end++ = '0' + fraction % 10;
+    return *this;
+  }
+
+  const char* data(void) const {
+    return text;
+  }
+  size_t length(void) const {
+    return end - text;
+  }
+
+ private:
+  char text[512];  // far more than any event needs
+  char* end;
+};
+
+class TimelineSink : public EventSink {
+ public:
+  TimelineSink() : length(0), first(true), lastCycle(0), lastCycleStart(0), anyCycle(false), nanosPerTick(1.0) {}
+
+  void begin(void) {
+    for (int i = 0; i < TIMELINE_NAME_COUNT; i++) {
+      EventText prefix;
+      prefix << "{\"name\":\"" << names[i] << "\",\"ph\":\"X\",\"pid\":" << WALL_PID << ",\"tid\":1,\"ts\":";
+      wallSpanPrefixes[i].assign(prefix.data(), prefix.length());
+    }
+    for (int i = 0; i < USB_ENDPOINT_COUNT; i++) {
+      EventText wall, virtualTime;
+      wall << "{\"name\":\"" << usbEndpointName((UsbEndpoint)i) << " report\",\"ph\":\"i\",\"s\":\"t\",\"pid\":"
+           << WALL_PID << ",\"tid\":1,\"ts\":";
+      wallReportPrefixes[i].assign(wall.data(), wall.length());
+      virtualTime << "{\"name\":\"" << usbEndpointName((UsbEndpoint)i) << " report\",\"ph\":\"i\",\"s\":\"t\",\"pid\":"
+                  << VIRTUAL_PID << ",\"tid\":" << VIRTUAL_OUTPUT_TID << ",\"ts\":";
+      virtualReportPrefixes[i].assign(virtualTime.data(), virtualTime.length());
+    }
+    EventText led;
+    led << "{\"name\":\"LED frame\",\"ph\":\"i\",\"s\":\"t\",\"pid\":" << VIRTUAL_PID << ",\"tid\":" << VIRTUAL_OUTPUT_TID << ",\"ts\":";
+    virtualLEDPrefix.assign(led.data(), led.length());
+
+    fputs("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n", timelinefile);
+    metadata("process_name", WALL_PID, 0, "Simulation (wall clock)");
+    metadata("thread_name", WALL_PID, 1, "simulation thread");
+    metadata("process_name", VIRTUAL_PID, 0, "Virtual time");
+    metadata("thread_name", VIRTUAL_PID, VIRTUAL_CYCLE_TID, "cycles");
+    metadata("thread_name", VIRTUAL_PID, VIRTUAL_OUTPUT_TID, "reports and LEDs");
+  }
+
+  virtual void consume(const Event& event) override {
+    EventText out;
+    switch (event.type) {
+    case EVENT_TIMELINE:
+      writeChunk(chunks[event.device]);
+      return;
+    case EVENT_CYCLE:
+      if (anyCycle) virtualCycle(event.timeMicros);
+      anyCycle = true;
+      lastCycle = event.cycle;
+      lastCycleStart = event.timeMicros;
+      return;
+    case EVENT_REPORT:
+      if (event.device >= USB_ENDPOINT_COUNT || (event.flags & EVENT_FLAG_CONTINUED)) return;
+      out << virtualReportPrefixes[event.device].c_str();
+      break;
+    case EVENT_LED_FRAME:
+      if (event.flags & EVENT_FLAG_CONTINUED) return;
+      out << virtualLEDPrefix.c_str();
+      break;
+    default:
+      return;
+    }
+    out << (unsigned long long)event.timeMicros << "}";
+    write(out);
+  }
+
+  virtual void finish(void) override {
+    if (anyCycle) virtualCycle(lastCycleStart + virtualClockPeriod());  // the cycle in progress at exit, at its nominal length
+    flush();
+    fputs("\n]}\n", timelinefile);
+    fclose(timelinefile);
+  }
+
+ private:
+  // Adds one trace event, preceded by the separator if it isn't the first.  The
+  // file is written a megabyte at a time.
+  void write(const EventText& out) {
+    if (length + out.length() + 2 > sizeof(buffer)) flush();
+    if (!first) {
+      buffer[length++] = ',';
+      buffer[length++] = '\n';
+    }
+    first = false;
+    memcpy(buffer + length, out.data(), out.length());
+    length += out.length();
+  }
+
+  void flush(void) {
+    fwrite(buffer, 1, length, timelinefile);
+    length = 0;
+  }
+
+  void metadata(const char* name, unsigned pid, unsigned tid, const char* value) {
+    EventText out;
+    out << "{\"name\":\"" << name << "\",\"ph\":\"M\",\"pid\":" << pid << ",\"tid\":" << tid
+        << ",\"args\":{\"name\":\"" << value << "\"}}";
+    write(out);
+  }
+
+  void virtualCycle(unsigned long long end) {
+    EventText out;
+    out << "{\"name\":\"cycle " << lastCycle << "\",\"ph\":\"X\",\"pid\":" << VIRTUAL_PID << ",\"tid\":" << VIRTUAL_CYCLE_TID
+        << ",\"ts\":" << lastCycleStart << ",\"dur\":" << end - lastCycleStart << ",\"args\":{\"cycle\":" << lastCycle << "}}";
+    write(out);
+  }
+
+  void writeChunk(TimelineChunk& chunk) {
+    // calibrated over the whole run so far
+    const uint64_t ticks = chunk.ticks - originTicks;
+    nanosPerTick = ticks ? (double)(chunk.nanos - originNanos) / ticks : 1.0;
+    for (unsigned i = 0; i < chunk.count; i++) writeRecord(chunk.records[i]);
+    chunk.busy.store(false, std::memory_order_release);
+  }
+
+  uint64_t toNanos(uint64_t ticks) const {
+    return (uint64_t)(ticks * nanosPerTick);
+  }
+
+  // The cycle number is only given on the cycle span; the others nest inside it
+  void writeRecord(const TimelineRecord& record) {
+    EventText out;
+    if (record.instant) {
+      out << wallReportPrefixes[(record.arg < USB_ENDPOINT_COUNT) ? record.arg : 0].c_str();
+      out.nanos(toNanos(record.start - originTicks));
+    } else {
+      out << wallSpanPrefixes[(record.name < TIMELINE_NAME_COUNT) ? record.name : 0].c_str();
+      out.nanos(toNanos(record.start - originTicks));
+      out << ",\"dur\":";
+      out.nanos(toNanos(record.end - record.start));
+      if (record.name == TIMELINE_CYCLE) {
+        out << ",\"args\":{\"cycle\":" << record.cycle << "}";
+      } else if (record.name == TIMELINE_HANDLE_KEYSWITCH_EVENT) {
+        out << ",\"args\":{\"row\":" << (record.arg >> 16) << ",\"col\":" << ((record.arg >> 8) & 0xff)
+            << ",\"keyState\":" << (record.arg & 0xff) << "}";
+      }
+    }
+    out << "}";
+    write(out);
+  }
+
+  // Everything up to the timestamp, for each kind of event
+  std::string wallSpanPrefixes[TIMELINE_NAME_COUNT];
+  std::string wallReportPrefixes[USB_ENDPOINT_COUNT];
+  std::string virtualReportPrefixes[USB_ENDPOINT_COUNT];
+  std::string virtualLEDPrefix;
+
+  char buffer[1 << 20];
+  size_t length;
+  bool first;
+  unsigned lastCycle;
+  unsigned long long lastCycleStart;
+  bool anyCycle;
+  double nanosPerTick;  // of timelineNow()
+};
+
+bool timelineBegin(void) {
+  static TimelineSink sink;
+  const std::string path = resultsPath("timeline.json");
+  timelinefile = fopen(path.c_str(), "w");
+  if (!timelinefile) {
+    fprintf(stderr, "Error opening %s\n", path.c_str());
+    return false;
+  }
+  sink.begin();
+  originNanos = monotonicNanos();
+  originTicks = timelineNow();
+  enabled = true;
+  eventBusAddSink(&sink);
+  return true;
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Timeline of the simulation, in Chrome trace-event format (results/timeline.json;
+// open it in chrome://tracing or https://ui.perfetto.dev).
+//
+// Two processes appear on the timeline:
+//   - "Simulation (wall clock)": spans measured on the simulation thread for each
+//     cycle, and, depending on the TimelineDetail, its phases (loop(),
+//     readMatrix(), actOnMatrixScan(), syncLeds()) with an instant for each HID
+//     report sent, and every handleKeyswitchEvent() for a key that is or was
+//     pressed
+//   - "Virtual time": each cycle, HID report and LED frame at its virtual time,
+//     taken from the event bus
+// Spans are stored as fixed-size records in one of two large in-memory chunks.
+// A full chunk is handed to a sink on the event bus, which formats and writes
+// it while the simulation fills the other one.
+
+typedef enum {
+  TIMELINE_CYCLE,
+  TIMELINE_LOOP,
+  TIMELINE_READ_MATRIX,
+  TIMELINE_ACT_ON_MATRIX_SCAN,
+  TIMELINE_HANDLE_KEYSWITCH_EVENT,  // arg: row << 16 | col << 8 | keyState
+  TIMELINE_SYNC_LEDS,
+  TIMELINE_REPORT,  // instant; arg: UsbEndpoint
+  TIMELINE_NAME_COUNT,
+} TimelineName;
+
+// What the wall-clock track records; each level adds to the one before.  Every
+// span costs the simulation thread two clock reads, which for a small sketch is
+// a large part of a cycle, so the finer levels are opt-in.
+typedef enum {
+  TIMELINE_DETAIL_CYCLES,  // each cycle
+  TIMELINE_DETAIL_PHASES,  // loop(), readMatrix(), actOnMatrixScan(), syncLeds() and reports
+  TIMELINE_DETAIL_KEYS,  // handleKeyswitchEvent()
+} TimelineDetail;
+
+// Settings; these must be applied before timelineBegin()
+void timelineSetDetail(TimelineDetail detail);
+
+// Adds the timeline writer to the event bus.  Returns TRUE if successful, FALSE
+// if results/timeline.json couldn't be opened.
+bool timelineBegin(void);
+bool timelineEnabled(void);
+// TRUE if the timeline is enabled, with enough detail to record 'name'
+bool timelineRecords(TimelineName name);
+
+// Wall-clock time for timelineSpan(), in ticks of a clock that the writer converts
+// to nanoseconds since timelineBegin()
+uint64_t timelineNow(void);
+// Records a span from 'start' until now, if timelineRecords(name)
+void timelineSpan(TimelineName name, uint64_t start, uint32_t arg);
+void timelineInstant(TimelineName name, uint32_t arg);
+// Hands the partly-filled chunk to the event bus; called at exit
+void timelineFlush(void);
+
+// Records a span for the lifetime of the object, if timelineRecords(name)
+class TimelineScope {
+ public:
+  explicit TimelineScope(TimelineName name, uint32_t arg = 0)
+    : name(name), arg(arg), enabled(timelineRecords(name)), start(enabled ? timelineNow() : 0) {}
+  ~TimelineScope() {
+    if (enabled) timelineSpan(name, start, arg);
+  }
+
+ private:
+  TimelineName name;
+  uint32_t arg;
+  bool enabled;
+  uint64_t start;
+};
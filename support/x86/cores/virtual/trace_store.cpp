@@ -0,0 +1,191 @@
+#include "trace_store.h"
+#include "event_bus.h"
+#include "virtual_io.h"
+#include <string>
+#include <vector>
+#include <stdio.h>
+#include <string.h>
+
+static bool enabled = false;
+
+bool traceStoreEnabled(void) {
+  return enabled;
+}
+
+static const uint8_t padding[4] = {0, 0, 0, 0};
+
+// The block being filled for one event type
+class StoreBlock {
+ public:
+  explicit StoreBlock(uint8_t type) : type(type) {
+    cycles.reserve(STORE_BLOCK_RECORDS);
+    offsets.reserve(STORE_BLOCK_RECORDS + 1);
+    devices.reserve(STORE_BLOCK_RECORDS);
+    payload.reserve(STORE_BLOCK_PAYLOAD + EVENT_PAYLOAD_SIZE);
+    clear();
+  }
+
+  bool full(void) const {
+    return cycles.size() >= STORE_BLOCK_RECORDS || payload.size() >= STORE_BLOCK_PAYLOAD;
+  }
+
+  void add(uint32_t cycle, uint8_t device, const uint8_t* data, size_t length) {
+    cycles.push_back(cycle);
+    devices.push_back(device);
+    payload.insert(payload.end(), data, data + length);
+    offsets.push_back(payload.size());
+    header.devices |= 1u << (device < 31 ? device : 31);
+    const size_t statsLength = (length < STORE_STATS_BYTES) ? length : STORE_STATS_BYTES;
+    for (size_t i = 0; i < statsLength; i++) {
+      if (i >= header.statsLength) {
+        // first record this long
+        minimum[i] = maximum[i] = bitsSet[i] = data[i];
+        continue;
+      }
+      if (data[i] < minimum[i]) minimum[i] = data[i];
+      if (data[i] > maximum[i]) maximum[i] = data[i];
+      bitsSet[i] |= data[i];
+    }
+    if (statsLength > header.statsLength) header.statsLength = statsLength;
+  }
+
+  // Writes the block (if it has any records) at 'offset', adds its header to
+  // 'index' and starts a new one.  Returns the number of bytes written.
+  size_t write(FILE* file, uint64_t offset, std::vector<StoreBlockHeader>& index) {
+    if (cycles.empty()) return 0;
+    header.count = cycles.size();
+    header.firstCycle = cycles.front();
+    header.lastCycle = cycles.back();
+    header.offset = offset;
+    header.size = sizeof(header) + padded(cycles.size() * 4) + padded(offsets.size() * 4) + padded(devices.size()) +
+                  3 * padded(header.statsLength) + padded(payload.size());
+    fwrite(&header, sizeof(header), 1, file);
+    column(file, cycles.data(), cycles.size() * 4);
+    column(file, offsets.data(), offsets.size() * 4);
+    column(file, devices.data(), devices.size());
+    column(file, minimum, header.statsLength);
+    column(file, maximum, header.statsLength);
+    column(file, bitsSet, header.statsLength);
+    column(file, payload.data(), payload.size());
+    index.push_back(header);
+    const size_t size = header.size;
+    clear();
+    return size;
+  }
+
+ private:
+  static size_t padded(size_t length) {
+    return (length + 3) & ~(size_t)3;
+  }
+
+  static void column(FILE* file, const void* data, size_t length) {
+    fwrite(data, 1, length, file);
+    fwrite(padding, 1, padded(length) - length, file);
+  }
+
+  void clear(void) {
+    memset(&header, 0, sizeof(header));
+    memcpy(header.marker, "BLK_", 4);
+    header.type = type;
+    cycles.clear();
+    offsets.clear();
+    offsets.push_back(0);
+    devices.clear();
+    payload.clear();
+  }
+
+  uint8_t type;
+  StoreBlockHeader header;
+  std::vector<uint32_t> cycles;
+  std::vector<uint32_t> offsets;
+  std::vector<uint8_t> devices;
+  std::vector<uint8_t> payload;
+  uint8_t minimum[STORE_STATS_BYTES];
+  uint8_t maximum[STORE_STATS_BYTES];
+  uint8_t bitsSet[STORE_STATS_BYTES];
+};
+
+class TraceStoreSink : public EventSink {
+ public:
+  TraceStoreSink()
+    : file(NULL), offset(0), reports(EVENT_REPORT), leds(EVENT_LED_FRAME), serial(EVENT_SERIAL), inputs(EVENT_INPUT),
+      continuing(false) {
+    record.reserve(4096);
+  }
+
+  bool begin(FILE* storeFile) {
+    file = storeFile;
+    StoreHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, STORE_MAGIC, sizeof(header.magic));
+    header.version = STORE_VERSION;
+    header.blockHeaderSize = sizeof(StoreBlockHeader);
+    offset = fwrite(&header, 1, sizeof(header), file);
+    return offset == sizeof(header);
+  }
+
+  virtual void consume(const Event& event) override {
+    StoreBlock* block;
+    switch (event.type) {
+    case EVENT_REPORT: block = &reports; break;
+    case EVENT_LED_FRAME: block = &leds; break;
+    case EVENT_SERIAL: block = &serial; break;
+    case EVENT_INPUT: block = &inputs; break;
+    default: return;
+    }
+    // events split across continuations are one record
+    if (!continuing) record.clear();
+    record.append((const char*)event.payload, event.length);
+    continuing = (event.flags & EVENT_FLAG_CONTINUED) != 0;
+    if (continuing) return;
+    if (record.empty()) return;  // a serial port being opened, or a blank input line
+
+    block->add(event.cycle, event.device, (const uint8_t*)record.data(), record.size());
+    if (block->full()) offset += block->write(file, offset, index);
+  }
+
+  virtual void finish(void) override {
+    offset += reports.write(file, offset, index);
+    offset += leds.write(file, offset, index);
+    offset += serial.write(file, offset, index);
+    offset += inputs.write(file, offset, index);
+    StoreTrailer trailer;
+    memset(&trailer, 0, sizeof(trailer));
+    trailer.indexOffset = offset;
+    trailer.blocks = index.size();
+    memcpy(trailer.magic, STORE_MAGIC, sizeof(trailer.magic));
+    if (!index.empty()) fwrite(index.data(), sizeof(StoreBlockHeader), index.size(), file);
+    fwrite(&trailer, sizeof(trailer), 1, file);
+    if (fclose(file) != 0) fprintf(stderr, "Error writing %s\n", resultsPath("trace.store").c_str());
+  }
+
+ private:
+  FILE* file;
+  uint64_t offset;
+  StoreBlock reports;
+  StoreBlock leds;
+  StoreBlock serial;
+  StoreBlock inputs;
+  std::vector<StoreBlockHeader> index;
+  std::string record;
+  bool continuing;
+};
+
+bool traceStoreBegin(void) {
+  static TraceStoreSink sink;
+  const std::string path = resultsPath("trace.store");
+  FILE* file = fopen(path.c_str(), "wb");
+  if (!file) {
+    fprintf(stderr, "Error opening %s\n", path.c_str());
+    return false;
+  }
+  setvbuf(file, NULL, _IOFBF, 1 << 20);  // only read after the run; no need to flush often
+  if (!sink.begin(file)) {
+    fprintf(stderr, "Error writing %s\n", path.c_str());
+    fclose(file);
+    return false;
+  }
+  enabled = true;
+  eventBusAddSink(&sink);
+  return true;
+}
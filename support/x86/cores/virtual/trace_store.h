@@ -0,0 +1,64 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Indexed columnar trace store (results/trace.store, see --trace-store).
+//
+// Reports, LED frames, serial output and input lines are kept in blocks of
+// one event type each, with the fields of a block stored as columns: all the
+// cycles, then all the devices, then the payload offsets, then the payloads.
+// Every block carries its cycle range, the devices it has and, for each
+// payload byte position, the minimum, maximum and bitwise OR of that byte
+// over the block.  An index of the block headers is written at the end, so a
+// reader (tools/trace-store.h, tools/trace-query.cpp) can binary search by
+// cycle and skip the blocks whose stats rule out a predicate, without reading
+// them.  If the run didn't exit cleanly the index is missing, but the blocks
+// can still be found by walking the block headers.
+
+#define STORE_MAGIC "KVSTORE_"  // 8 bytes, no NUL
+#define STORE_VERSION 1
+#define STORE_BLOCK_RECORDS 4096  // a block is written when it has this many records,
+#define STORE_BLOCK_PAYLOAD (256 * 1024)  // or this many payload bytes
+#define STORE_STATS_BYTES 256  // payload byte positions with stats
+
+// File layout: StoreHeader, then blocks, then 'blocks' StoreBlockHeader (the
+// index), then StoreTrailer.  All fields are little-endian.
+typedef struct {
+  char magic[8];
+  uint32_t version;
+  uint32_t blockHeaderSize;  // sizeof(StoreBlockHeader)
+} StoreHeader;
+
+// Each block is a StoreBlockHeader followed by these columns, each padded to
+// a multiple of 4 bytes:
+//   uint32_t cycles[count];         ascending
+//   uint32_t offsets[count + 1];    record i's payload is payload[offsets[i] .. offsets[i + 1])
+//   uint8_t devices[count];         UsbEndpoint for reports, port for serial
+//   uint8_t minimum[statsLength];   byte stats over the records at least that long
+//   uint8_t maximum[statsLength];
+//   uint8_t bitsSet[statsLength];   bitwise OR
+//   uint8_t payload[offsets[count]];
+typedef struct {
+  char marker[4];  // "BLK_"
+  uint8_t type;  // EventType: EVENT_REPORT, EVENT_LED_FRAME, EVENT_SERIAL or EVENT_INPUT
+  uint8_t reserved[3];
+  uint32_t count;  // of records
+  uint32_t firstCycle;
+  uint32_t lastCycle;
+  uint32_t devices;  // bit N set if any record has device N (devices above 31 set bit 31)
+  uint32_t statsLength;  // longest payload in the block, up to STORE_STATS_BYTES
+  uint32_t size;  // of the block, including this header
+  uint64_t offset;  // of the block in the file
+} StoreBlockHeader;  // 40 bytes
+
+typedef struct {
+  uint64_t indexOffset;
+  uint32_t blocks;
+  uint32_t reserved;
+  char magic[8];
+} StoreTrailer;
+
+// Returns TRUE if successful, FALSE if results/trace.store couldn't be created
+bool traceStoreBegin(void);
+bool traceStoreEnabled(void);
@@ -0,0 +1,246 @@
+#include "usb_host.h"
+#include "event_bus.h"
+#include <iostream>
+#include <fstream>
+#include <iomanip>
+#include <string.h>
+#include <stdint.h>
+
+#define MAX_REPORT_LENGTH 64  // max packet size of a full-speed interrupt endpoint
+#define MAX_QUEUE_DEPTH USB_HOST_MAX_QUEUE_DEPTH
+#define MICROS_PER_FRAME 1000ULL
+
+typedef struct {
+  unsigned long long submitted;  // virtual time
+  unsigned cycle;
+  bool waited;  // was passed over by at least one poll
+  int length;
+  uint8_t data[MAX_REPORT_LENGTH];
+} PendingReport;
+
+typedef struct {
+  unsigned intervalMs;
+
+  PendingReport queue[MAX_QUEUE_DEPTH];
+  unsigned head;
+  unsigned count;
+
+  // statistics
+  unsigned long sent;
+  unsigned long received;
+  unsigned long delayed;
+  unsigned long merged;
+  unsigned long dropped;
+  unsigned long long bytes;
+  unsigned long long latencySum;
+  unsigned long long latencyMax;
+  unsigned burstMax;
+  unsigned burstMaxCycle;
+  unsigned burst;
+  unsigned burstCycle;
+} Endpoint;
+
+static bool enabled = false;
+static unsigned queueDepth = 2;  // ATmega32u4 HID endpoints are double-banked
+static Endpoint endpoints[USB_ENDPOINT_COUNT];
+static std::ostream* hoststream = NULL;
+
+static unsigned long long nextFrame = 0;
+static unsigned long long framesWithTraffic = 0;
+static unsigned long long totalBytes = 0;
+static unsigned maxBytesPerFrame = 0;
+static unsigned long long maxBytesFrame = 0;
+
+static void initEndpointsOnce(void) {
+  static bool initialized = false;
+  if (initialized) return;
+  initialized = true;
+  for (int i = 0; i < USB_ENDPOINT_COUNT; i++) {
+    memset(&endpoints[i], 0, sizeof(endpoints[i]));
+    endpoints[i].intervalMs = 1;
+  }
+}
+
+void usbHostSetPollInterval(unsigned ms) {
+  initEndpointsOnce();
+  for (int i = 0; i < USB_ENDPOINT_COUNT; i++) endpoints[i].intervalMs = ms ? ms : 1;
+}
+
+void usbHostSetPollInterval(UsbEndpoint endpoint, unsigned ms) {
+  initEndpointsOnce();
+  if (endpoint < USB_ENDPOINT_COUNT) endpoints[endpoint].intervalMs = ms ? ms : 1;
+}
+
+void usbHostSetQueueDepth(unsigned reports) {
+  if (reports < 1) reports = 1;
+  if (reports > MAX_QUEUE_DEPTH) reports = MAX_QUEUE_DEPTH;
+  queueDepth = reports;
+}
+
+bool usbHostEnabled(void) {
+  return enabled;
+}
+
+static void logReport(const PendingReport& report) {
+  *hoststream << ": 0x" << std::hex;
+  for (int i = 0; i < report.length; i++) *hoststream << std::setfill('0') << std::setw(2) << (unsigned int)report.data[i];
+  *hoststream << std::dec << std::endl;
+}
+
+static void pollEndpoint(UsbEndpoint ep, unsigned long long frame, unsigned& frameBytes) {
+  Endpoint& e = endpoints[ep];
+  const unsigned long long pollTime = frame * MICROS_PER_FRAME;
+  if (e.count == 0 || e.queue[e.head].submitted >= pollTime) return;
+
+  // One transaction per poll: the host takes the oldest waiting report
+  PendingReport& report = e.queue[e.head];
+  const unsigned long long latency = pollTime - report.submitted;
+  e.received++;
+  e.bytes += report.length;
+  e.latencySum += latency;
+  if (latency > e.latencyMax) e.latencyMax = latency;
+  if (report.waited) e.delayed++;
+  frameBytes += report.length;
+
+  *hoststream << "Frame " << frame << ": " << usbEndpointName(ep) << " report from cycle " << report.cycle
+              << " received after " << latency << " us" << (report.waited ? " (delayed)" : "");
+  logReport(report);
+
+  e.head = (e.head + 1) % MAX_QUEUE_DEPTH;
+  e.count--;
+
+  // Anything else that was already waiting has now missed a poll
+  for (unsigned i = 0; i < e.count; i++) {
+    PendingReport& waiting = e.queue[(e.head + i) % MAX_QUEUE_DEPTH];
+    if (waiting.submitted < pollTime) waiting.waited = true;
+  }
+}
+
+static void runFrame(unsigned long long frame) {
+  unsigned frameBytes = 0;
+  for (int i = 0; i < USB_ENDPOINT_COUNT; i++) {
+    if (frame % endpoints[i].intervalMs == 0) pollEndpoint((UsbEndpoint)i, frame, frameBytes);
+  }
+  if (frameBytes) {
+    framesWithTraffic++;
+    totalBytes += frameBytes;
+    if (frameBytes > maxBytesPerFrame) {
+      maxBytesPerFrame = frameBytes;
+      maxBytesFrame = frame;
+    }
+  }
+}
+
+// Run all host polls scheduled up to (and including) the given virtual time
+static void advance(unsigned long long nowMicros) {
+  const unsigned long long lastFrame = nowMicros / MICROS_PER_FRAME;
+  for (; nextFrame <= lastFrame; nextFrame++) runFrame(nextFrame);
+}
+
+// Relative mouse reports (buttons, x, y, vWheel, hWheel) carry deltas, so a report
+// that can't be queued is folded into the newest pending one as long as the buttons
+// agree.  Other devices report absolute state, so the pending report is simply lost.
+static bool mergeMouseReport(PendingReport& pending, const uint8_t* data, int length) {
+  if (length != pending.length || length < 5 || data[0] != pending.data[0]) return false;
+  for (int i = 1; i < 5; i++) {
+    int sum = (int8_t)pending.data[i] + (int8_t)data[i];
+    if (sum > 127 || sum < -127) return false;
+  }
+  for (int i = 1; i < 5; i++) pending.data[i] = (uint8_t)((int8_t)pending.data[i] + (int8_t)data[i]);
+  return true;
+}
+
+static void submitReport(UsbEndpoint ep, const void* data, int length, unsigned cycle, unsigned long long time) {
+  if (ep >= USB_ENDPOINT_COUNT) return;
+  Endpoint& e = endpoints[ep];
+  const uint8_t* bytes = (const uint8_t*)data;
+  if (length > MAX_REPORT_LENGTH) length = MAX_REPORT_LENGTH;
+
+  e.sent++;
+  if (e.burstCycle != cycle) {
+    e.burstCycle = cycle;
+    e.burst = 0;
+  }
+  if (++e.burst > e.burstMax) {
+    e.burstMax = e.burst;
+    e.burstMaxCycle = cycle;
+  }
+
+  if (e.count == queueDepth) {
+    PendingReport& newest = e.queue[(e.head + e.count - 1) % MAX_QUEUE_DEPTH];
+    if (ep == USB_ENDPOINT_MOUSE && mergeMouseReport(newest, bytes, length)) {
+      e.merged++;
+      *hoststream << "Cycle " << cycle << ": " << usbEndpointName(ep) << " report merged into pending report from cycle "
+                  << newest.cycle;
+      logReport(newest);
+      return;
+    }
+    e.dropped++;
+    *hoststream << "Cycle " << cycle << ": " << usbEndpointName(ep) << " report from cycle " << newest.cycle
+                << " dropped (overwritten before the host polled)";
+    logReport(newest);
+    e.count--;
+  }
+
+  PendingReport& report = e.queue[(e.head + e.count) % MAX_QUEUE_DEPTH];
+  report.submitted = time;
+  report.cycle = cycle;
+  report.waited = false;
+  report.length = length;
+  memcpy(report.data, bytes, length);
+  e.count++;
+}
+
+static void finish(void) {
+  // The host keeps polling after the sketch stops; let it collect what's still queued
+  bool pending = true;
+  while (pending) {
+    pending = false;
+    for (int i = 0; i < USB_ENDPOINT_COUNT; i++) if (endpoints[i].count) pending = true;
+    if (pending) runFrame(nextFrame++);
+  }
+
+  std::ostream& out = *hoststream;
+  out << "\n--- USB host summary ---" << std::endl;
+  unsigned long lost = 0;
+  for (int i = 0; i < USB_ENDPOINT_COUNT; i++) {
+    const Endpoint& e = endpoints[i];
+    lost += e.dropped;
+    if (!e.sent) continue;
+    out << usbEndpointName((UsbEndpoint)i) << " (polled every " << e.intervalMs << " ms): "
+        << e.sent << " sent, " << e.received << " received (" << e.delayed << " delayed), "
+        << e.merged << " merged, " << e.dropped << " dropped; "
+        << "latency avg " << (e.received ? e.latencySum / e.received : 0) << " us, max " << e.latencyMax << " us; "
+        << e.bytes << " bytes; largest burst " << e.burstMax << " reports in cycle " << e.burstMaxCycle << std::endl;
+  }
+  out << "Frames with traffic: " << framesWithTraffic << ", " << totalBytes << " bytes total, max "
+      << maxBytesPerFrame << " bytes in frame " << maxBytesFrame << std::endl;
+  out.flush();
+
+  if (lost) std::cout << "USB host model: " << lost << " report(s) were never seen by the host; see " << resultsPath("USB_host.txt") << std::endl;
+}
+
+class UsbHostSink : public EventSink {
+ public:
+  virtual void consume(const Event& event) override {
+    if (event.type == EVENT_REPORT) submitReport((UsbEndpoint)event.device, event.payload, event.length, event.cycle, event.timeMicros);
+    else if (event.type == EVENT_CYCLE) advance(event.timeMicros);
+  }
+
+  virtual void finish(void) override {
+    ::finish();
+  }
+};
+
+bool usbHostBegin(void) {
+  static UsbHostSink sink;
+  initEndpointsOnce();
+  hoststream = new std::ofstream(resultsPath("USB_host.txt").c_str());
+  if (!(*hoststream)) {
+    std::cerr << "Error opening " << resultsPath("USB_host.txt") << std::endl;
+    return false;
+  }
+  enabled = true;
+  eventBusAddSink(&sink);
+  return true;
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <stdbool.h>
+#include "virtual_io.h"  // UsbEndpoint
+
+// Model of the host side of the USB connection.
+//
+// Without this model, every HID report is considered delivered at the moment
+// sendReport() is called.  A real host instead polls each interrupt endpoint
+// once every bInterval frames (1 ms each), and the device can only have a
+// limited number of reports waiting in the endpoint's banks.  Reports sent in
+// a burst are therefore delayed, and reports the host never got around to
+// polling are overwritten.
+//
+// When enabled, the model is a sink on the event bus: it keeps a queue per
+// endpoint, polls the queues against the virtual time of the events, and logs
+// every report the host actually receives to results/USB_host.txt, along with
+// any reports that were merged or dropped.  A summary (latency, bytes per
+// frame, bursts) is appended at exit.
+
+#define USB_HOST_MAX_QUEUE_DEPTH 16
+
+// Settings; these must be applied before usbHostBegin()
+void usbHostSetPollInterval(unsigned ms);  // all endpoints
+void usbHostSetPollInterval(UsbEndpoint endpoint, unsigned ms);
+void usbHostSetQueueDepth(unsigned reports);
+
+// Adds the model to the event bus.  Returns TRUE if successful, FALSE if the
+// host log couldn't be opened.
+bool usbHostBegin(void);
+bool usbHostEnabled(void);
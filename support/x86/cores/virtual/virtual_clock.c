@@ -0,0 +1,35 @@
+#include "virtual_clock.h"
+
+static uint64_t now = 0;
+static uint32_t period = VIRTUAL_CLOCK_DEFAULT_PERIOD;
+static uint64_t deadline = UINT64_MAX;
+
+uint64_t virtualClockMicros(void) {
+  return now;
+}
+
+void virtualClockSetPeriod(uint32_t micros) {
+  period = micros ? micros : 1;
+}
+
+uint32_t virtualClockPeriod(void) {
+  return period;
+}
+
+void virtualClockAdvance(uint64_t micros) {
+  now += micros;
+}
+
+void virtualClockSet(uint64_t micros) {
+  now = micros;
+}
+
+void virtualClockDeadline(uint64_t atMicros) {
+  if (atMicros < deadline) deadline = atMicros;
+}
+
+uint64_t virtualClockTakeDeadline(void) {
+  const uint64_t earliest = deadline;
+  deadline = UINT64_MAX;
+  return earliest;
+}
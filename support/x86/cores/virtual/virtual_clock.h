@@ -0,0 +1,45 @@
+#pragma once
+
+#include <stdint.h>
+
+// The virtual clock: time as the sketch sees it, in microseconds.
+//
+// It is owned by the main loop, which advances it by the scan period at the
+// end of every cycle, so time only depends on the number of cycles run, not on
+// how often anything reads it.  millis() and micros() are plain reads of it,
+// and event timestamps (see event_bus.h) come from it.  Within a cycle it only
+// moves if the sketch calls delay(), and between cycles it may jump
+// ahead over idle cycles with --fast-forward.
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define VIRTUAL_CLOCK_DEFAULT_PERIOD 1000  // microseconds per scan cycle
+
+uint64_t virtualClockMicros(void);
+
+// Length of a scan cycle in microseconds (at least 1); set it before the first cycle
+void virtualClockSetPeriod(uint32_t micros);
+uint32_t virtualClockPeriod(void);
+
+// Moves the clock forward: the main loop does this at the end of each cycle,
+// and delay() by the time it waits
+void virtualClockAdvance(uint64_t micros);
+
+// Only for restoring a checkpoint (see checkpoint.h), before the first cycle
+void virtualClockSet(uint64_t micros);
+
+// Asks for a scan cycle to run at or after 'atMicros' (virtual time), for
+// anything that changes on a timeout rather than on input.  --fast-forward
+// never skips past the earliest deadline.  Deadlines only hold for the cycle
+// they are registered in, so register one in every cycle while it is pending.
+void virtualClockDeadline(uint64_t atMicros);
+
+// The earliest deadline registered since the last call (UINT64_MAX if none);
+// for the main loop, at the end of each cycle
+uint64_t virtualClockTakeDeadline(void);
+
+#ifdef __cplusplus
+}
+#endif
@@ -1,108 +1,1059 @@
 #include "virtual_io.h"
+#include "event_bus.h"
+#include "text_sinks.h"
+#include "flight_recorder.h"
+#include "structured_trace.h"
+#include "trace_store.h"
+#include "timeline.h"
+#include "fingerprint.h"
+#include "rolling_log.h"
+#include "alloc_check.h"
+#include "run_stats.h"
+#include "virtual_clock.h"
+#include "realtime.h"
+#include "corpus.h"
+#include "checkpoint.h"
+#include "time_travel.h"
+#include "usb_host.h"
+#include "host_cursor.h"
+#include "host_text.h"
 #include <iostream>
 #include <fstream>
-#include <iomanip>
+#include <vector>
 #include <string.h>
+#include <strings.h>  // strcasecmp()
 #include <stdlib.h>  // exit()
+#include <ctype.h>  // isdigit()
+#include <limits.h>  // UINT_MAX
+#include <stdio.h>  // fflush()
+#include <unistd.h>  // _exit()
 #include <sys/types.h>  // mkdir()
 #include <sys/stat.h>  // mkdir()
+#include <sys/wait.h>  // wait()
+#include <fcntl.h>  // open()
 #include <errno.h>
+#include <poll.h>
 
 static bool interactive;
+static bool keyboardEdges = false;
+static bool headless = false;  // no console output
+static bool embedded = false;  // the library build: no input, the matrix is set directly
 static std::istream* input = NULL;
-static std::ostream* usbstream = NULL;
-static std::ostream* ledstream = NULL;
 static unsigned cycle = 0;
+static unsigned cyclesBeforeReset = 0;  // the library build: run before virtualReset() set 'cycle' back
+static std::string outputDir;  // empty until set by --output-dir or the environment
+
+static_assert(USB_ENDPOINT_COUNT == TRACE_DEVICE_COUNT, "traceDeviceNames[] needs a name for each endpoint");
+
+const char* usbEndpointName(UsbEndpoint endpoint) {
+  return (endpoint < USB_ENDPOINT_COUNT) ? traceDeviceNames[endpoint] : "Unknown";
+}
 
 bool isInteractive(void) {
   return interactive;
 }
 
+bool reportKeyboardEdges(void) {
+  return keyboardEdges;
+}
+
+std::string resultsPath(const char* filename) {
+  return outputDir + "/" + filename;
+}
+
+// Like "mkdir -p"
+static bool makeDirectories(const std::string& path) {
+  for (size_t slashpos = path.find('/', 1); ; slashpos = path.find('/', slashpos + 1)) {
+    const std::string dir = path.substr(0, slashpos);
+    if (mkdir(dir.c_str(), S_IRWXU | S_IRWXG | S_IROTH | S_IXOTH) && errno != EEXIST) {
+      std::cerr << "Error creating directory '" << dir << "', errno " << errno << std::endl;
+      return false;
+    }
+    if (slashpos == std::string::npos) return true;
+  }
+}
+
+// "results/<script name without directory or extension>", e.g. results/typing for tests/typing.txt
+static std::string autoOutputDir(const char* script) {
+  if (strcmp(script, "-i") == 0) return "results/interactive";
+  std::string name(script);
+  const size_t slashpos = name.rfind('/');
+  if (slashpos != std::string::npos) name = name.substr(slashpos + 1);
+  const size_t dotpos = name.rfind('.');
+  if (dotpos != std::string::npos && dotpos > 0) name = name.substr(0, dotpos);
+  return "results/" + name;
+}
+
 unsigned currentCycle(void) {
   return cycle;
 }
+
+void setCurrentCycle(unsigned newCycle) {
+  if (newCycle < cycle) cyclesBeforeReset += cycle - newCycle;
+  cycle = newCycle;
+}
+// Publishes an event, and records it if the flight recorder is on
+static void publish(EventType type, uint8_t device, const void* data, size_t length) {
+  if (flightRecorderEnabled()) flightRecorderRecord(type, device, data, length, cycle, currentTimeMicros());
+  eventBusPublish(type, device, data, length);
+}
+
+// --check-allocations: after the warm-up, fail any cycle that allocates on the simulation thread
+static bool checkAllocations = false;
+static unsigned allocationWarmupCycles = 10;
+static unsigned long allocationsAtCycleStart = 0;
+
+static uint64_t cycleStartedAt = 0;  // for the timeline
+
+// --fast-forward: skip cycles in which nothing can happen.  After a cycle whose
+// matrix scan saw no key down or released, the following cycles are idle as
+// long as their lines of input are blank (or part of an "@wait"); they are
+// skipped, up to the first one that starts at or after a deadline (see
+// virtual_clock.h).  A cycle after one with key activity always runs, since
+// e.g. the release report of a tap is only sent then.  With "verify", every
+// cycle runs, and one that would have been skipped but produced output or
+// changed the sketch's data or bss (the memory a checkpoint holds) is an error.
+typedef enum {
+  FAST_FORWARD_OFF,
+  FAST_FORWARD_ON,
+  FAST_FORWARD_VERIFY,
+} FastForwardMode;
+static FastForwardMode fastForward = FAST_FORWARD_OFF;
+static bool matrixActive = false;
+static unsigned idleLinesAhead = 0;  // blank lines still to be returned by getLineOfInput()
+static std::string lineAhead;  // the first line after those, if haveLineAhead
+static bool haveLineAhead = false;
+static bool inputEnded = false;
+static unsigned long long skippedCycles = 0;
+static unsigned verifyUntil = 0;  // --fast-forward=verify: cycles before this would have been skipped
+static std::vector<CheckpointRegion> verifyRegions;  // --fast-forward=verify: the sketch's state, as checkpointed
+static uint64_t stateHashAtCycleStart = 0;
+static unsigned long outputs = 0;  // reports, LED frames and serial payloads published
+static unsigned long outputsAtCycleStart = 0;
+static unsigned checkpointCycle = 0;  // --checkpoint: after this many cycles
+static std::string checkpointPath;  // cleared once saved
+static unsigned restoredCycles = 0;  // --restore: the cycles the checkpointed run ran, not this one
+static unsigned long long timeTravelBudget = 0;  // --time-travel; 0 if off
+static const std::string* cycleInput = NULL;  // this cycle's line of input, once read
+
+void setMatrixActive(bool active) {
+  matrixActive = active;
+}
+
+// "N" cycles, or "Nus", "Nms" or "Ns" of virtual time (rounded up to whole
+// cycles); 0 if malformed
+static unsigned parseWait(const char* text) {
+  char* suffix;
+  const unsigned long long number = strtoull(text, &suffix, 10);
+  if (suffix == text) return 0;
+  unsigned long long micros;
+  if (*suffix == '\0') return number;
+  else if (strcmp(suffix, "us") == 0) micros = number;
+  else if (strcmp(suffix, "ms") == 0) micros = number * 1000;
+  else if (strcmp(suffix, "s") == 0) micros = number * 1000000;
+  else return 0;
+  const uint32_t period = virtualClockPeriod();
+  return (micros + period - 1) / period;
+}
+
+// "@wait DURATION" runs DURATION idle cycles; returns the number, or 0 if 'line' isn't one
+static unsigned waitCycles(const std::string& line) {
+  if (line.compare(0, 6, "@wait ") != 0) return 0;
+  const unsigned cycles = parseWait(line.c_str() + 6);
+  if (!cycles) std::cerr << "Error: expected \"@wait CYCLES\" or \"@wait TIME\" with a us, ms or s suffix" << std::endl;
+  return cycles;
+}
+
+// Reads ahead over blank lines and waits, up to 'wanted' idle cycles; returns how many there are
+static unsigned idleCyclesAhead(unsigned wanted) {
+  while (idleLinesAhead < wanted && !haveLineAhead && !inputEnded) {
+    if (!std::getline(*input, lineAhead)) {
+      inputEnded = true;
+    } else if (lineAhead.empty()) {
+      idleLinesAhead++;
+    } else if (const unsigned cycles = waitCycles(lineAhead)) {
+      idleLinesAhead += cycles;
+    } else {
+      haveLineAhead = true;
+    }
+  }
+  return (idleLinesAhead < wanted) ? idleLinesAhead : wanted;
+}
+
+// At the end of a cycle, after the clock has moved on to the next: how many
+// of the cycles from the next one on can be skipped
+static unsigned skippableCycles(uint64_t deadline) {
+  if (interactive || matrixActive) return 0;
+  const uint64_t now = virtualClockMicros();
+  if (deadline <= now) return 0;
+  // the first cycle that starts at or after the deadline has to run
+  const uint64_t period = virtualClockPeriod();
+  const uint64_t beforeDeadline = (deadline - now + period - 1) / period;
+  return idleCyclesAhead(beforeDeadline < UINT_MAX ? beforeDeadline : UINT_MAX);
+}
+
+// A hash of the sketch's data and bss, to tell whether a cycle changed them
+static uint64_t hashState(void) {
+  uint64_t hash = 14695981039346656037ULL;
+  for (size_t r = 0; r < verifyRegions.size(); r++) {
+    const uint8_t* bytes = (const uint8_t*)verifyRegions[r].address;
+    const uint64_t size = verifyRegions[r].size;
+    uint64_t i = 0;
+    for (; i + 8 <= size; i += 8) {
+      uint64_t word;
+      memcpy(&word, bytes + i, 8);
+      hash = (hash ^ word) * 1099511628211ULL;
+    }
+    for (; i < size; i++) hash = (hash ^ bytes[i]) * 1099511628211ULL;
+  }
+  return hash;
+}
+
+static void fastForwardCycles(uint64_t deadline) {
+  const unsigned skip = skippableCycles(deadline);
+  if (fastForward == FAST_FORWARD_VERIFY) {
+    if (cycle + skip > verifyUntil) verifyUntil = cycle + skip;
+    return;
+  }
+  virtualClockAdvance((uint64_t)skip * virtualClockPeriod());
+  cycle += skip;
+  idleLinesAhead -= skip;
+  skippedCycles += skip;
+}
+
+void beginCycle(void) {
+  runStatsEnter(RUN_PHASE_OUTPUT);
+  allocationsAtCycleStart = threadAllocations();
+  if (timelineEnabled()) cycleStartedAt = timelineNow();
+  outputsAtCycleStart = outputs;
+  if (cycle < verifyUntil) stateHashAtCycleStart = hashState();
+  cycleInput = NULL;
+  publish(EVENT_CYCLE, 0, NULL, 0);
+  runStatsEnter(RUN_PHASE_LOOP);
+}
+static void flushAllSerial(void);
 void nextCycle(void) {
+  runStatsEnter(RUN_PHASE_OUTPUT);
+  flushAllSerial();
+  timelineSpan(TIMELINE_CYCLE, cycleStartedAt, 0);
+  // The comparisons run on the event bus thread: wait for them to catch up with this cycle's
+  // output, so that a mismatch stops the run at the cycle it was found in
+  if (textSinksComparing()) eventBusSync();
+  // a comparison with an expected file has failed (and been reported); no point going on
+  if (textSinksMismatch() || fingerprintMismatch()) exit(1);
+  if (checkAllocations && cycle >= allocationWarmupCycles) {
+    const unsigned long allocations = threadAllocations() - allocationsAtCycleStart;
+    if (allocations) {
+      std::cerr << "Error: cycle " << cycle << " made " << allocations << " heap allocation(s) (--check-allocations)" << std::endl;
+      exit(1);
+    }
+  }
+  if (cycle < verifyUntil && outputs != outputsAtCycleStart) {
+    std::cerr << "Error: --fast-forward would have skipped cycle " << cycle << ", which produced output"
+              << " (does something with a timeout need to register a deadline?)" << std::endl;
+    exit(1);
+  }
+  // a change that only shows in the output after the skipped cycles
+  if (cycle < verifyUntil && hashState() != stateHashAtCycleStart) {
+    std::cerr << "Error: --fast-forward would have skipped cycle " << cycle << ", which changed the sketch's state"
+              << " (does something with a timeout need to register a deadline?)" << std::endl;
+    exit(1);
+  }
+  const uint64_t deadline = virtualClockTakeDeadline();
+  // with --realtime, by as many periods as have passed on the wall clock
+  const unsigned periods = realtimeEnabled() ? realtimeWait() : 1;
+  virtualClockAdvance((uint64_t)periods * virtualClockPeriod());
   cycle++;
+  if (fastForward != FAST_FORWARD_OFF) fastForwardCycles(deadline);
+  // at the first cycle boundary at or after --checkpoint's (it may be skipped over)
+  if (!checkpointPath.empty() && cycle >= checkpointCycle) {
+    if (!checkpointSave(checkpointPath.c_str(), cycle, virtualClockMicros())) exit(1);
+    checkpointPath.clear();
+  }
+  if (timeTravelEnabled()) {
+    timeTravelRecord(cycle, virtualClockMicros(), cycleInput ? cycleInput->data() : NULL, cycleInput ? cycleInput->size() : 0);
+    uint64_t clockMicros;
+    if (timeTravelRewind(&cycle, &clockMicros)) {
+      virtualClockSet(clockMicros);
+      char line[64];
+      printConsole(line, snprintf(line, sizeof(line), "Rewound to the start of cycle %u", cycle));
+    }
+  }
+}
+unsigned long long currentTimeMicros(void) {
+  return virtualClockMicros();
+}
+
+void logHIDReport(UsbEndpoint endpoint, const void* data, int length) {
+  timelineInstant(TIMELINE_REPORT, endpoint);
+  runStatsAddReport();
+  outputs++;
+  publish(EVENT_REPORT, endpoint, data, length);
 }
 
-void logUSBEvent(std::string descrip, void* data, int length) {
-  if (usbstream) {
-    *usbstream << "Cycle " << std::dec << currentCycle() << ": " << descrip << ": 0x" << std::hex;
-    unsigned char* report = (unsigned char*) data;
-    for (int i = 0; i < length; i++) *usbstream << std::setfill('0') << std::setw(2) << (unsigned int)(report[i]); // pad with 0's to total of 2 characters
-    *usbstream << std::endl;
+void logUSBEvent_keyboard(const char* descrip, size_t length) {
+  publish(EVENT_USB_TEXT, USB_ENDPOINT_KEYBOARD, descrip, length);
+}
+
+void logLEDFrame(const void* rgb, int ledCount) {
+  outputs++;
+  publish(EVENT_LED_FRAME, 0, rgb, ledCount * 3);
+}
+
+void printConsole(const char* line, size_t length) {
+  if (headless) {
+    runStatsAddDroppedConsoleLine();
+    if (!flightRecorderEnabled()) return;  // nothing else reads it
   }
+  publish(EVENT_CONSOLE, 0, line, length);
+}
+
+void printConsole(const char* line) {
+  printConsole(line, strlen(line));
 }
 
-void logUSBEvent_keyboard(std::string descrip) {
-  if (usbstream) {
-    *usbstream << "Cycle " << std::dec << currentCycle() << ": " << descrip << std::endl;
+// Serial output is collected per port and published a payload at a time (or at
+// the end of the cycle, or on flush()), rather than as one event per byte
+typedef struct {
+  uint8_t data[EVENT_PAYLOAD_SIZE];
+  int length;
+} SerialBuffer;
+#define MAX_SERIAL_PORTS 256  // port numbers are a byte in the event
+static std::vector<SerialBuffer> serialBuffers;
+
+void flushSerial(unsigned port) {
+  if (port >= serialBuffers.size() || !serialBuffers[port].length) return;
+  outputs++;
+  eventBusPublish(EVENT_SERIAL, port, serialBuffers[port].data, serialBuffers[port].length);
+  serialBuffers[port].length = 0;
+}
+
+static void flushAllSerial(void) {
+  for (unsigned port = 0; port < serialBuffers.size(); port++) flushSerial(port);
+}
+
+void logSerial(unsigned port, const void* data, int length) {
+  if (port >= MAX_SERIAL_PORTS) return;
+  if (port >= serialBuffers.size()) {
+    SerialBuffer empty;
+    empty.length = 0;
+    serialBuffers.resize(port + 1, empty);
+  }
+  if (length == 0) {
+    publish(EVENT_SERIAL, port, NULL, 0);
+    return;
+  }
+  // already recorded here; flushSerial() only publishes
+  if (flightRecorderEnabled()) flightRecorderRecord(EVENT_SERIAL, port, data, length, cycle, currentTimeMicros());
+  SerialBuffer& buffer = serialBuffers[port];
+  const uint8_t* bytes = (const uint8_t*)data;
+  while (length > 0) {
+    int chunk = EVENT_PAYLOAD_SIZE - buffer.length;
+    if (chunk > length) chunk = length;
+    memcpy(buffer.data + buffer.length, bytes, chunk);
+    buffer.length += chunk;
+    bytes += chunk;
+    length -= chunk;
+    if (buffer.length == EVENT_PAYLOAD_SIZE) flushSerial(port);
   }
 }
 
-void logLEDStates(std::string descrip) {
-  if (ledstream) {
-    *ledstream << "Cycle " << std::dec << currentCycle() << ": " << descrip << std::endl;
+static void finishVirtualOutput(void) {
+  runStatsEnter(RUN_PHASE_OUTPUT);
+  flushAllSerial();
+  timelineFlush();
+  eventBusShutdown();
+  rollingLogsFinish();
+  runStatsPrint(cycle - restoredCycles + cyclesBeforeReset);
+  realtimePrint();
+  if (runStatsEnabled() && fastForward == FAST_FORWARD_ON) {
+    fprintf(stderr, "  skipped     %llu cycle(s) (--fast-forward)\n", skippedCycles);
+  }
+  if (textSinksMismatch() || fingerprintMismatch()) {
+    // even if the script ran to the end; the outputs are all flushed by now
+    std::cout.flush();
+    fflush(NULL);
+    _exit(1);
   }
 }
 
+static bool usbHostRequested = false;
+static bool mouseTraceRequested = false;
+static bool hostTextRequested = false;
+static bool flightRecorderRequested = false;
+static bool structuredTraceRequested = false;
+static bool traceStoreRequested = false;
+static bool timelineRequested = false;
+static bool fingerprintRequested = false;
+static bool statsRequested = false;
+static bool realtimeRequested = false;
+static unsigned forkServerJobs = 0;  // --fork-server: children run at once; 0 if not a fork server
+static std::string corpusList;  // --corpus
+static unsigned corpusSamples = 0;  // --corpus-verify
+static std::string restorePath;  // --restore
+static const char* restoreScript = NULL;  // its run begins once the checkpoint is restored
+
+// "SIZE" in bytes, or with a k, M or G suffix; 0 if malformed
+static unsigned long long parseSize(const std::string& value) {
+  char* suffix;
+  const unsigned long long number = strtoull(value.c_str(), &suffix, 10);
+  if (suffix == value.c_str()) return 0;
+  switch (*suffix) {
+  case '\0': return number;
+  case 'k': case 'K': return number << 10;
+  case 'm': case 'M': return number << 20;
+  case 'g': case 'G': return number << 30;
+  default: return 0;
+  }
+}
+
+// "N" as a plain decimal number; FALSE if malformed
+static bool parseCount(const std::string& value, unsigned& count) {
+  if (value.empty() || !isdigit((unsigned char)value[0])) return false;
+  char* end;
+  const unsigned long number = strtoul(value.c_str(), &end, 10);
+  if (*end != '\0' || number > UINT_MAX) return false;
+  count = number;
+  return true;
+}
+
+// Handles a single "--name=value" (or "--name") option.  Returns FALSE if the option is invalid.
+static bool applyOption(const std::string& name, const std::string& value) {
+  if (name == "usb-host") {
+    usbHostRequested = true;
+  } else if (name == "usb-poll-interval") {
+    // either "MS" for all endpoints, or "ENDPOINT:MS"
+    size_t colonpos = value.find(':');
+    unsigned ms;
+    if (!parseCount(colonpos == std::string::npos ? value : value.substr(colonpos + 1), ms) || ms == 0) {
+      std::cerr << "Error: expected --usb-poll-interval=MS or --usb-poll-interval=ENDPOINT:MS, with MS > 0" << std::endl;
+      return false;
+    }
+    if (colonpos == std::string::npos) {
+      usbHostSetPollInterval(ms);
+    } else {
+      std::string endpoint = value.substr(0, colonpos);
+      int ep;
+      for (ep = 0; ep < USB_ENDPOINT_COUNT; ep++) {
+        if (strcasecmp(endpoint.c_str(), usbEndpointName((UsbEndpoint)ep)) == 0) break;
+      }
+      if (ep == USB_ENDPOINT_COUNT) {
+        std::cerr << "Error: unknown USB endpoint \"" << endpoint << "\"" << std::endl;
+        return false;
+      }
+      usbHostSetPollInterval((UsbEndpoint)ep, ms);
+    }
+    usbHostRequested = true;
+  } else if (name == "keyboard-edges") {
+    keyboardEdges = true;
+  } else if (name == "mouse-trace") {
+    mouseTraceRequested = true;
+  } else if (name == "host-text") {
+    if (!value.empty() && !hostTextSetLayout(value.c_str())) {
+      std::cerr << "Error: unknown host keyboard layout \"" << value << "\"" << std::endl;
+      return false;
+    }
+    hostTextRequested = true;
+  } else if (name == "host-repeat") {
+    // "DELAY_MS:RATE_HZ", or "off"
+    if (value == "off") {
+      hostTextSetRepeat(0, 0);
+    } else {
+      size_t colonpos = value.find(':');
+      unsigned delay, rate;
+      // the host_text model works in microseconds: 1 to 1000000 per second, a delay of up to ~71 minutes
+      if (colonpos == std::string::npos || !parseCount(value.substr(0, colonpos), delay) ||
+          !parseCount(value.substr(colonpos + 1), rate) || rate == 0 || rate > 1000000 || delay > UINT_MAX / 1000) {
+        std::cerr << "Error: expected --host-repeat=DELAY_MS:RATE_HZ, with RATE_HZ > 0, or --host-repeat=off" << std::endl;
+        return false;
+      }
+      hostTextSetRepeat(delay, rate);
+    }
+    hostTextRequested = true;
+  } else if (name == "flight-recorder") {
+    if (!value.empty()) {
+      unsigned cycles;
+      if (!parseCount(value, cycles) || cycles == 0 || cycles > FLIGHT_MAX_CYCLES) {
+        std::cerr << "Error: expected --flight-recorder=CYCLES, with CYCLES from 1 to " << FLIGHT_MAX_CYCLES << std::endl;
+        return false;
+      }
+      flightRecorderSetCycles(cycles);
+    }
+    flightRecorderRequested = true;
+  } else if (name == "trace") {
+    if (!value.empty() && !structuredTraceSetFormat(value.c_str())) {
+      std::cerr << "Error: unknown trace format \"" << value << "\" (expected jsonl or cbor)" << std::endl;
+      return false;
+    }
+    structuredTraceRequested = true;
+  } else if (name == "trace-store") {
+    traceStoreRequested = true;
+  } else if (name == "timeline") {
+    if (value == "phases") {
+      timelineSetDetail(TIMELINE_DETAIL_PHASES);
+    } else if (value == "keys") {
+      timelineSetDetail(TIMELINE_DETAIL_KEYS);
+    } else if (!value.empty() && value != "cycles") {
+      std::cerr << "Error: --timeline takes \"cycles\", \"phases\" or \"keys\"" << std::endl;
+      return false;
+    }
+    timelineRequested = true;
+  } else if (name == "fingerprint") {
+    if (!value.empty()) {
+      const int interval = atoi(value.c_str());
+      if (interval <= 0) {
+        std::cerr << "Error: expected --fingerprint=CYCLES with CYCLES > 0" << std::endl;
+        return false;
+      }
+      fingerprintSetInterval(interval);
+    }
+    fingerprintRequested = true;
+  } else if (name == "expect-fingerprint") {
+    fingerprintExpect(value.c_str());
+    fingerprintRequested = true;
+  } else if (name == "expect-usb") {
+    textSinksExpectUSB(value.c_str());
+  } else if (name == "expect-led") {
+    textSinksExpectLED(value.c_str());
+  } else if (name == "expect-serial") {
+    // "FILE" for port 0, or "PORT:FILE"
+    size_t colonpos = value.find(':');
+    if (colonpos != std::string::npos && colonpos > 0 && value.find_first_not_of("0123456789") == colonpos) {
+      textSinksExpectSerial(atoi(value.c_str()), value.c_str() + colonpos + 1);
+    } else {
+      textSinksExpectSerial(0, value.c_str());
+    }
+  } else if (name == "log-segment-size") {
+    const unsigned long long bytes = parseSize(value);
+    if (!bytes) {
+      std::cerr << "Error: expected --log-segment-size=SIZE, e.g. 64M" << std::endl;
+      return false;
+    }
+    rollingLogSetSegmentBytes(bytes);
+  } else if (name == "log-segment-cycles") {
+    unsigned cycles;
+    if (!parseCount(value, cycles) || cycles == 0) {
+      std::cerr << "Error: expected --log-segment-cycles=N, with N > 0" << std::endl;
+      return false;
+    }
+    rollingLogSetSegmentCycles(cycles);
+  } else if (name == "log-compress") {
+    rollingLogSetCompression(true);
+  } else if (name == "log-keep") {
+    // "FIRST:LAST"
+    size_t colonpos = value.find(':');
+    unsigned first, last;
+    if (colonpos == std::string::npos || !parseCount(value.substr(0, colonpos), first) ||
+        !parseCount(value.substr(colonpos + 1), last) || (first == 0 && last == 0)) {
+      std::cerr << "Error: expected --log-keep=FIRST:LAST, with FIRST or LAST > 0" << std::endl;
+      return false;
+    }
+    rollingLogSetRetention(first, last);
+  } else if (name == "output-dir") {
+    if (value.empty()) {
+      std::cerr << "Error: expected --output-dir=DIR or --output-dir=auto" << std::endl;
+      return false;
+    }
+    outputDir = value;
+  } else if (name == "scan-period") {
+    const int micros = atoi(value.c_str());
+    if (micros <= 0) {
+      std::cerr << "Error: expected --scan-period=MICROSECONDS, e.g. 1000" << std::endl;
+      return false;
+    }
+    virtualClockSetPeriod(micros);
+  } else if (name == "fast-forward") {
+    if (value.empty()) fastForward = FAST_FORWARD_ON;
+    else if (value == "verify") fastForward = FAST_FORWARD_VERIFY;
+    else {
+      std::cerr << "Error: expected --fast-forward or --fast-forward=verify" << std::endl;
+      return false;
+    }
+  } else if (name == "fork-server") {
+    forkServerJobs = value.empty() ? 1 : atoi(value.c_str());
+    if (forkServerJobs == 0) {
+      std::cerr << "Error: expected --fork-server or --fork-server=JOBS with JOBS > 0" << std::endl;
+      return false;
+    }
+  } else if (name == "corpus") {
+    if (value.empty()) {
+      std::cerr << "Error: expected --corpus=LIST" << std::endl;
+      return false;
+    }
+    corpusList = value;
+  } else if (name == "corpus-verify") {
+    corpusSamples = 10;
+    if (!value.empty() && (!parseCount(value, corpusSamples) || corpusSamples == 0)) {
+      std::cerr << "Error: expected --corpus-verify or --corpus-verify=N, with N > 0" << std::endl;
+      return false;
+    }
+  } else if (name == "checkpoint") {
+    const size_t colonpos = value.find(':');
+    checkpointCycle = atoi(value.c_str());
+    if (colonpos == std::string::npos || checkpointCycle == 0 || colonpos + 1 == value.size()) {
+      std::cerr << "Error: expected --checkpoint=CYCLES:FILE with CYCLES > 0" << std::endl;
+      return false;
+    }
+    checkpointPath = value.substr(colonpos + 1);
+  } else if (name == "restore") {
+    if (value.empty()) {
+      std::cerr << "Error: expected --restore=FILE" << std::endl;
+      return false;
+    }
+    restorePath = value;
+  } else if (name == "time-travel") {
+    timeTravelBudget = value.empty() ? TIME_TRAVEL_DEFAULT_BUDGET : parseSize(value);
+    if (!timeTravelBudget) {
+      std::cerr << "Error: expected --time-travel or --time-travel=BUDGET (bytes, or with a k, M or G suffix)" << std::endl;
+      return false;
+    }
+  } else if (name == "realtime") {
+    realtimeRequested = true;
+  } else if (name == "headless") {
+    headless = true;
+    statsRequested = true;
+  } else if (name == "stats") {
+    statsRequested = true;
+  } else if (name == "traces") {
+    // comma-separated: usb, led, serial; or none
+    bool usb = false, led = false, serialPorts = false;
+    for (size_t start = 0; start <= value.size(); ) {
+      size_t commapos = value.find(',', start);
+      if (commapos == std::string::npos) commapos = value.size();
+      const std::string trace = value.substr(start, commapos - start);
+      if (trace == "usb") usb = true;
+      else if (trace == "led") led = true;
+      else if (trace == "serial") serialPorts = true;
+      else if (trace != "none") {
+        std::cerr << "Error: unknown trace \"" << trace << "\" (expected usb, led, serial or none)" << std::endl;
+        return false;
+      }
+      start = commapos + 1;
+    }
+    textSinksSetTraces(usb, led, serialPorts);
+  } else if (name == "check-allocations") {
+    if (!value.empty() && !parseCount(value, allocationWarmupCycles)) {
+      std::cerr << "Error: expected --check-allocations or --check-allocations=N (warm-up cycles)" << std::endl;
+      return false;
+    }
+    checkAllocations = true;
+  } else if (name == "usb-queue-depth") {
+    unsigned depth;
+    if (!parseCount(value, depth) || depth == 0 || depth > USB_HOST_MAX_QUEUE_DEPTH) {
+      std::cerr << "Error: expected --usb-queue-depth=N, with N from 1 to " << USB_HOST_MAX_QUEUE_DEPTH << std::endl;
+      return false;
+    }
+    usbHostSetQueueDepth(depth);
+    usbHostRequested = true;
+  } else {
+    std::cerr << "Error: unknown option \"--" << name << "\"" << std::endl;
+    return false;
+  }
+  return true;
+}
+
+// Handles a single "--name=value" (or "--name") argument
+static bool applyArgument(const char* argument) {
+  std::string option(argument + 2);
+  size_t eqpos = option.find('=');
+  std::string value = (eqpos == std::string::npos) ? "" : option.substr(eqpos + 1);
+  return applyOption(option.substr(0, eqpos), value);
+}
+
+static bool beginRun(const char* script);
+
 bool initVirtualInput(int argc, char* argv[]) {
-  if (argc < 2 || strcmp(argv[1], "?") == 0) {
+  const char* script = NULL;
+  for (int i = 1; i < argc; i++) {
+    if (strncmp(argv[i], "--", 2) == 0) {
+      if (!applyArgument(argv[i])) return false;
+    } else if (script) {
+      std::cerr << "Error: more arguments than expected (got \"" << script << "\" and \"" << argv[i] << "\")" << std::endl;
+      return false;
+    } else {
+      script = argv[i];
+    }
+  }
+
+  if (forkServerJobs && !corpusList.empty()) {
+    std::cerr << "Error: --fork-server and --corpus can't be combined" << std::endl;
+    return false;
+  }
+  if (forkServerJobs || !corpusList.empty()) {
+    const char* mode = forkServerJobs ? "--fork-server" : "--corpus";
+    if (script) {
+      std::cerr << "Error: with " << mode << ", scripts aren't given on the command line" << std::endl;
+      return false;
+    }
+    if (realtimeRequested) {
+      std::cerr << "Error: --realtime can't be combined with " << mode << std::endl;
+      return false;
+    }
+    if (!corpusList.empty() && fastForward != FAST_FORWARD_OFF) {
+      std::cerr << "Error: --fast-forward can't be combined with --corpus" << std::endl;
+      return false;
+    }
+    if (!checkpointPath.empty()) {
+      std::cerr << "Error: --checkpoint can't be combined with " << mode << std::endl;
+      return false;
+    }
+  } else if (!script || strcmp(script, "?") == 0) {
     printHelp();
     return false;
-  } else if (argc > 2) {
-    std::cerr << "Error: more arguments than expected (got " << (argc - 1) << ")" << std::endl;
+  }
+  if (realtimeRequested && fastForward != FAST_FORWARD_OFF) {
+    std::cerr << "Error: --fast-forward skips cycles, which --realtime can't do" << std::endl;
+    return false;
+  }
+  if (timeTravelBudget && fastForward != FAST_FORWARD_OFF) {
+    std::cerr << "Error: --time-travel snapshots every cycle, which --fast-forward skips" << std::endl;
+    return false;
+  }
+  if (fastForward == FAST_FORWARD_VERIFY && !checkpointRegions(verifyRegions)) return false;
+
+  // a fork server or corpus run opens each script's outputs in the child that
+  // runs it, so the output of setup() is held until then
+  if (forkServerJobs) {
+    eventBusHold();
+    return true;
+  }
+  if (!corpusList.empty()) {
+    // the options for a standalone run of one of the scripts, to verify against
+    std::vector<std::string> options;
+    for (int i = 1; i < argc; i++) {
+      if (strncmp(argv[i], "--corpus", 8) != 0 && strncmp(argv[i], "--output-dir", 12) != 0) options.push_back(argv[i]);
+    }
+    corpusSetVerify(corpusSamples, options);
+    eventBusHold();
+    return corpusLoad(corpusList.c_str(), outputDir.empty() ? "auto" : outputDir);
+  }
+  // likewise a restored run's, to be dropped, and its run begins once restored
+  if (!restorePath.empty()) {
+    restoreScript = script;
+    eventBusHold();
+    return true;
+  }
+  return beginRun(script);
+}
+
+bool initEmbeddedRun(int argc, const char* const argv[]) {
+  for (int i = 0; i < argc; i++) {
+    if (strncmp(argv[i], "--", 2) != 0) {
+      std::cerr << "Error: the library only takes options, not \"" << argv[i] << "\"" << std::endl;
+      return false;
+    }
+    if (!applyArgument(argv[i])) return false;
+  }
+  // the rest either read input or run more than one simulation
+  // (and --check-allocations would need the library to replace the host process's operator new)
+  if (forkServerJobs || !corpusList.empty() || !checkpointPath.empty() || !restorePath.empty() || timeTravelBudget ||
+      fastForward != FAST_FORWARD_OFF || checkAllocations) {
+    std::cerr << "Error: --fork-server, --corpus, --checkpoint, --restore, --time-travel, --fast-forward and"
+              << " --check-allocations aren't available in the library build" << std::endl;
     return false;
   }
+  embedded = true;
+  interactive = false;
+  return beginRunOutputs("library", runOutputDir("library", outputDir));
+}
 
-  if (strcmp(argv[1], "-i") == 0) {
+std::string runOutputDir(const char* script, const std::string& requested) {
+  std::string dir = requested;
+  if (dir.empty()) {
+    const char* fromEnvironment = getenv("KALEIDOSCOPE_VIRTUAL_OUTPUT_DIR");
+    dir = (fromEnvironment && *fromEnvironment) ? fromEnvironment : "results";
+  }
+  if (dir == "auto") dir = autoOutputDir(script);
+  while (dir.size() > 1 && dir[dir.size() - 1] == '/') dir.erase(dir.size() - 1);
+  return dir;
+}
+
+// Opens the script and then its outputs (see beginRunOutputs())
+static bool beginRun(const char* script) {
+  if (strcmp(script, "-i") == 0) {
     interactive = true;
     input = &std::cin;
   } else {
     interactive = false;
-    input = new std::ifstream(argv[1]);
+    input = new std::ifstream(script);
     if (!input || !(*input)) {
-      std::cerr << "Error opening input file \"" << argv[1] << "\"" << std::endl;
+      std::cerr << "Error opening input file \"" << script << "\"" << std::endl;
       return false;
     }
   }
+  return beginRunOutputs(script, runOutputDir(script, outputDir));
+}
 
-  if (mkdir("results", S_IRWXU | S_IRWXG | S_IROTH | S_IXOTH) && errno != EEXIST) {
-    std::cerr << "Error creating directory 'results', errno " << errno << std::endl;
+bool beginRunOutputs(const char* script, const std::string& dir) {
+  outputDir = dir;
+  if (!makeDirectories(outputDir)) return false;
+  // a forked run's stdout would be mixed up with the fork server's replies
+  if ((forkServerJobs || corpusEnabled()) && !freopen(resultsPath("stdout.txt").c_str(), "w", stdout)) {
+    std::cerr << "Error opening " << resultsPath("stdout.txt") << std::endl;
     return false;
   }
-  usbstream = new std::ofstream("results/USB.txt");
-  ledstream = new std::ofstream("results/LED.txt");
 
+  if (statsRequested) runStatsBegin();
+  if (flightRecorderRequested && !flightRecorderBegin()) return false;
+  textSinksSetConsole(!headless);
+  textSinksSetFlush(!headless);
+  textSinksSetQuietCycles(realtimeRequested);
+  if (!addTextSinks()) return false;
+  if (usbHostRequested && !usbHostBegin()) return false;
+  if (mouseTraceRequested && !hostCursorBegin()) return false;
+  if (hostTextRequested && !hostTextBegin()) return false;
+  if (structuredTraceRequested && !structuredTraceBegin()) return false;
+  if (traceStoreRequested && !traceStoreBegin()) return false;
+  if (timelineRequested && !timelineBegin()) return false;
+  if (fingerprintRequested && !fingerprintBegin()) return false;
+  if (realtimeRequested && !realtimeBegin(virtualClockPeriod())) return false;
+  if (timeTravelBudget && !timeTravelBegin(timeTravelBudget, cycle, virtualClockMicros())) return false;
+
+  if (realtimeRequested && interactive) {
+    std::cout << "Real-time mode: each line you enter applies to the next scan cycle; Q to quit." << std::endl;
+  }
+  eventBusStart();
+  atexit(finishVirtualOutput);
   return true;
 }
 
-std::string getLineOfInput(bool anythingHeld) {
-  if (interactive) {
-    std::cout << "Enter a command for this scan cycle, or ? or 'help' for help." << std::endl;
-    if (anythingHeld) std::cout << "+> ";
-    else std::cout << "> ";
+// --fork-server: a child running a script
+typedef struct {
+  pid_t pid;
+  std::string script;
+  std::string outputDir;
+} ForkedRun;
+
+// Waits for any child to exit, and replies with its status
+static void reapForkedRun(std::vector<ForkedRun>& running) {
+  int status;
+  const pid_t pid = wait(&status);
+  if (pid < 0) return;
+  for (size_t i = 0; i < running.size(); i++) {
+    if (running[i].pid != pid) continue;
+    if (WIFSIGNALED(status)) std::cout << "signal " << WTERMSIG(status);
+    else std::cout << "exit " << WEXITSTATUS(status);
+    std::cout << " " << running[i].script << " " << running[i].outputDir << std::endl;
+    running.erase(running.begin() + i);
+    return;
+  }
+}
+
+// After setup(), a fork server reads "SCRIPT [OUTPUT_DIR]" lines from stdin and
+// forks a child to run each one, from the state setup() left behind (shared
+// copy-on-write), with up to --fork-server=JOBS children at once.  The server
+// only returns in a child; once stdin ends and the children have exited, it
+// exits.
+static bool serveForks(void) {
+  std::vector<ForkedRun> running;
+  std::string request;
+  while (std::getline(std::cin, request)) {
+    const size_t spacepos = request.find(' ');
+    ForkedRun run;
+    run.script = request.substr(0, spacepos);
+    const std::string requestedDir = (spacepos == std::string::npos) ? outputDir : request.substr(spacepos + 1);
+    if (run.script.empty() || run.script == "-i") {
+      if (!run.script.empty()) std::cout << "error " << request << " (interactive runs can't be forked)" << std::endl;
+      continue;
+    }
+    run.outputDir = runOutputDir(run.script.c_str(), requestedDir);
+    while (running.size() >= forkServerJobs) reapForkedRun(running);
+    std::cout.flush();  // or the child would write it again
+    fflush(NULL);
+    run.pid = fork();
+    if (run.pid == 0) {
+      // stdin is shared with the server; detach from it, or exiting would seek
+      // it back to what this process had read
+      const int devnull = open("/dev/null", O_RDONLY);
+      dup2(devnull, STDIN_FILENO);
+      close(devnull);
+      outputDir = run.outputDir;
+      return beginRun(run.script.c_str());
+    }
+    if (run.pid < 0) {
+      std::cout << "error " << request << " (fork failed, errno " << errno << ")" << std::endl;
+      continue;
+    }
+    running.push_back(run);
+  }
+  while (!running.empty()) reapForkedRun(running);
+  exit(0);
+}
+
+bool startRun(void) {
+  if (!restorePath.empty()) {
+    uint64_t clockMicros;
+    if (!checkpointRestore(restorePath.c_str(), &cycle, &clockMicros)) return false;
+    virtualClockSet(clockMicros);
+    restoredCycles = cycle;
+    eventBusDropHeld();
+  }
+  if (corpusEnabled()) corpusRun();  // only returns in a child
+  if (forkServerJobs) return serveForks();
+  return restoreScript ? beginRun(restoreScript) : true;
+}
+
+// --realtime in interactive mode: the next line typed, if a whole one has been
+// typed by now; doesn't wait for one
+static bool pollLine(std::string& line) {
+  static std::string typed;  // so far
+  while (true) {
+    const size_t newlinepos = typed.find('\n');
+    if (newlinepos != std::string::npos) {
+      line.assign(typed, 0, newlinepos);
+      typed.erase(0, newlinepos + 1);
+      return true;
+    }
+    struct pollfd stdinPoll = {STDIN_FILENO, POLLIN, 0};
+    if (poll(&stdinPoll, 1, 0) <= 0) return false;
+    char buffer[256];
+    const ssize_t length = read(STDIN_FILENO, buffer, sizeof(buffer));
+    if (length <= 0) exit(0);  // end of input
+    typed.append(buffer, length);
+  }
+}
+
+const std::string& getLineOfInput(bool anythingHeld) {
+  static std::string line;
+  runStatsEnter(RUN_PHASE_INPUT);
+  if (line.capacity() < 256) line.reserve(256);  // reused, so that typical lines never allocate
+  if (timeTravelReplayLine(line)) {
+    // the same input as before a rewind
+  } else if (idleLinesAhead) {
+    idleLinesAhead--;
+    line.clear();
+  } else if (haveLineAhead) {
+    line.swap(lineAhead);
+    haveLineAhead = false;
+  } else if (embedded) {
+    line.clear();
+  } else if (corpusEnabled()) {
+    if (!corpusNextLine(line)) exit(0);  // end of this process's script
+  } else if (interactive && realtimeEnabled()) {
+    if (!pollLine(line)) line.clear();
+  } else {
+    if (interactive) {
+      eventBusSync();  // so that the prompt comes after this cycle's output
+      std::cout << "Enter a command for this scan cycle, or ? or 'help' for help." << std::endl;
+      if (anythingHeld) std::cout << "+> ";
+      else std::cout << "> ";
+    }
+    if (inputEnded) exit(0);
+    std::getline(*input, line);
+    if (!interactive && !(*input)) exit(0); // reached EOF or other file error
+  }
+  if (const unsigned cycles = waitCycles(line)) {
+    // this cycle is the first of them
+    idleLinesAhead += cycles - 1;
+    line.clear();
+  } else if (line.compare(0, 8, "@rewind ") == 0) {
+    timeTravelRequest(strtoul(line.c_str() + 8, NULL, 10), false);  // or prints why not
+    line.clear();
   }
-  std::string line;
-  std::getline(*input, line);
-  if (!interactive && !(*input)) exit(0); // reached EOF or other file error
+  cycleInput = &line;
+  publish(EVENT_INPUT, 0, line.data(), line.size());
+  runStatsEnter(RUN_PHASE_LOOP);
   return line;
 }
 
 void printHelp(void) {
+  eventBusSync();
   std::cout << "\nUsage:\n" << std::endl;
   std::cout << "(Running with no arguments or with the argument '?' will print this help message and quit.)\n" << std::endl;
   std::cout << "This program expects a single argument, which is either:" << std::endl;
   std::cout << "  1. An input file/script, with format given below, or" << std::endl;
   std::cout << "  2. \"-i\", to run interactively, where you can interactively enter commands and see results." << std::endl;
+  std::cout << "It may be preceded by any of the following options:" << std::endl;
+  std::cout << "  --usb-host                 Model the host polling the USB endpoints, and log what it actually" << std::endl;
+  std::cout << "                               receives to results/USB_host.txt.  Implied by the two options below." << std::endl;
+  std::cout << "  --usb-poll-interval=MS     Poll every endpoint every MS milliseconds (default 1).  Use" << std::endl;
+  std::cout << "                               ENDPOINT:MS to set a single endpoint, e.g. \"mouse:8\"." << std::endl;
+  std::cout << "  --usb-queue-depth=N        Number of reports an endpoint can hold before the host polls it" << std::endl;
+  std::cout << "                               (default 2, at most 16)." << std::endl;
+  std::cout << "  --keyboard-edges           Print and log keyboard reports as the keys pressed and released since" << std::endl;
+  std::cout << "                               the previous report (e.g. \"+a -lshift\") instead of all held keys." << std::endl;
+  std::cout << "  --mouse-trace              Integrate mouse reports into a host cursor position, and write it" << std::endl;
+  std::cout << "                               per cycle to results/mouse.bin with a summary in results/mouse.txt." << std::endl;
+  std::cout << "  --host-text[=LAYOUT]       Write the text a host would have typed to results/text.txt, using the" << std::endl;
+  std::cout << "                               host keyboard layout \"us\" (default), \"de\" or \"dvorak\"." << std::endl;
+  std::cout << "  --host-repeat=DELAY:RATE   Host auto-repeat delay (ms) and rate (per second) for --host-text" << std::endl;
+  std::cout << "                               (default 660:25), or \"off\"." << std::endl;
+  std::cout << "  --output-dir=DIR           Write output files to DIR instead of \"results\" (created if needed)." << std::endl;
+  std::cout << "                               \"auto\" means results/<script name>, e.g. results/typing for" << std::endl;
+  std::cout << "                               tests/typing.txt.  Defaults to $KALEIDOSCOPE_VIRTUAL_OUTPUT_DIR if set." << std::endl;
+  std::cout << "  --trace[=FORMAT]           Write a structured trace of every cycle, input line, report, LED frame" << std::endl;
+  std::cout << "                               and serial write to trace.jsonl, or trace.cbor with FORMAT \"cbor\";" << std::endl;
+  std::cout << "                               see cores/virtual/structured_trace.h and tools/trace-reader.h." << std::endl;
+  std::cout << "  --trace-store              Write reports, LED frames, serial output and input lines to trace.store," << std::endl;
+  std::cout << "                               in indexed blocks that tools/trace-query.cpp can search by cycle," << std::endl;
+  std::cout << "                               device and payload bytes without reading the whole file." << std::endl;
+  std::cout << "  --timeline[=DETAIL]        Write a timeline of each cycle (wall clock) and of the reports and LED" << std::endl;
+  std::cout << "                               frames (virtual time) to timeline.json, for chrome://tracing or" << std::endl;
+  std::cout << "                               ui.perfetto.dev.  DETAIL is \"cycles\" (the default)," << std::endl;
+  std::cout << "                               \"phases\" (also loop(), readMatrix() etc. and reports) or \"keys\" (also" << std::endl;
+  std::cout << "                               handleKeyswitchEvent())." << std::endl;
+  std::cout << "  --log-segment-size=SIZE    Split USB.txt, LED.txt and serial_N.txt into segments (USB.000000.txt," << std::endl;
+  std::cout << "                               USB.000001.txt, ...) of about SIZE bytes each (k, M or G suffix)." << std::endl;
+  std::cout << "  --log-segment-cycles=N     Likewise, with each segment covering at most N cycles." << std::endl;
+  std::cout << "  --log-compress             Gzip finished segments in the background." << std::endl;
+  std::cout << "  --log-keep=FIRST:LAST      Only keep the first FIRST and the last LAST segments of each log;" << std::endl;
+  std::cout << "                               either may be 0." << std::endl;
+  std::cout << "  --expect-usb=FILE          Compare USB.txt, as it is produced, with FILE instead of writing it;" << std::endl;
+  std::cout << "                               stop with an error at the first difference.  Likewise" << std::endl;
+  std::cout << "  --expect-led=FILE            for LED.txt, and serial_0.txt (or serial_PORT.txt with" << std::endl;
+  std::cout << "  --expect-serial=[PORT:]FILE  PORT:FILE)." << std::endl;
+  std::cout << "  --fingerprint[=CYCLES]     Write a 64-bit hash of all reports, LED frames and serial output to" << std::endl;
+  std::cout << "                               fingerprint.txt, with a checkpoint every CYCLES cycles (default 1000)." << std::endl;
+  std::cout << "  --expect-fingerprint=FILE  Compare the fingerprint with FILE as checkpoints are reached; stop with" << std::endl;
+  std::cout << "                               an error naming the first window of cycles that differs." << std::endl;
+  std::cout << "  --scan-period=US           Advance the virtual clock (millis(), micros()) by US microseconds per" << std::endl;
+  std::cout << "                               scan cycle (default 1000)." << std::endl;
+  std::cout << "  --fast-forward[=verify]    Skip idle cycles (no keys held, blank input or \"@wait\") by jumping the" << std::endl;
+  std::cout << "                               virtual clock, up to the next input or registered deadline.  With" << std::endl;
+  std::cout << "                               \"verify\", run them all but fail if one that would be skipped had output." << std::endl;
+  std::cout << "  --fork-server[=JOBS]       Instead of a script argument, run setup() once, then read lines of" << std::endl;
+  std::cout << "                               \"SCRIPT [OUTPUT_DIR]\" from stdin and fork a child to run each, up to" << std::endl;
+  std::cout << "                               JOBS (default 1) at once.  A child's stdout goes to stdout.txt in its" << std::endl;
+  std::cout << "                               output directory; when it exits, \"exit STATUS SCRIPT OUTPUT_DIR\"" << std::endl;
+  std::cout << "                               (or \"signal N ...\") is printed." << std::endl;
+  std::cout << "  --corpus=LIST              Instead of a script argument, run every script in LIST (lines of" << std::endl;
+  std::cout << "                               \"SCRIPT [OUTPUT_DIR]\"), simulating the input they share only once by" << std::endl;
+  std::cout << "                               forking where they diverge.  Output as for --fork-server; the output" << std::endl;
+  std::cout << "                               directory is \"auto\" unless set." << std::endl;
+  std::cout << "  --corpus-verify[=N]        Afterwards, run N (default 10) of the scripts standalone and check that" << std::endl;
+  std::cout << "                               their outputs are identical." << std::endl;
+  std::cout << "  --checkpoint=CYCLES:FILE   After the first CYCLES cycles, save the state of the sketch, the virtual" << std::endl;
+  std::cout << "                               clock and the cycle number to FILE." << std::endl;
+  std::cout << "  --restore=FILE             After setup(), restore a checkpoint saved by this same build, and go on" << std::endl;
+  std::cout << "                               from there with the script (or --fork-server, or --corpus)." << std::endl;
+  std::cout << "  --time-travel[=BUDGET]     Snapshot the sketch's state every cycle into an in-memory ring of at" << std::endl;
+  std::cout << "                               most BUDGET bytes (default 64M), to rewind to with \"@rewind CYCLE\"" << std::endl;
+  std::cout << "                               or from gdb (see tools/time-travel.gdb)." << std::endl;
+  std::cout << "  --realtime                 Run one scan cycle per scan period of wall-clock time.  Interactive" << std::endl;
+  std::cout << "                               input doesn't wait: a line applies to the next cycle once entered." << std::endl;
+  std::cout << "                               Prints wake-up jitter percentiles on stderr at exit." << std::endl;
+  std::cout << "  --headless                 Don't print anything on stdout (the console lines are only counted)," << std::endl;
+  std::cout << "                               and print run statistics on stderr at exit (see --stats)." << std::endl;
+  std::cout << "  --traces=LIST              Only write these of USB.txt, LED.txt and serial_N.txt: a comma-separated" << std::endl;
+  std::cout << "                               list of usb, led and serial, or none.  Compared traces are kept." << std::endl;
+  std::cout << "  --stats                    At exit, print cycles and reports per second, the wall-clock time spent" << std::endl;
+  std::cout << "                               on input, loop() and output, CPU time and peak RSS on stderr." << std::endl;
+  std::cout << "  --check-allocations[=N]    Exit with an error if any cycle after the first N (default 10) makes a" << std::endl;
+  std::cout << "                               heap allocation on the simulation thread." << std::endl;
+  std::cout << "  --flight-recorder[=CYCLES] Keep up to the last CYCLES cycles (default 10000, at most" << std::endl;
+  std::cout << "                               1000000) of input and output in flight.bin, which survives a crash;" << std::endl;
+  std::cout << "                               see tools/flight-decode.cpp." << std::endl;
   std::cout << "\nIn either case, for each scan cycle you will specify zero or more input 'commands', that is," << std::endl;
   std::cout << "  actions to take on the keys of the virtual keyboard.  Each line of the input file, or each" << std::endl;
   std::cout << "  prompt (in interactive mode), represents one scan cycle; a blank line or empty prompt means" << std::endl;
   std::cout << "  to do nothing to the inputs this scan cycle (held keys will still remain held, though)." << std::endl;
+  std::cout << "  \"@wait N\" on a line of its own does nothing for N scan cycles, or with a suffix, e.g. \"@wait 30s\"," << std::endl;
+  std::cout << "  for that much virtual time (us, ms or s)." << std::endl;
+  std::cout << "  \"@rewind N\" (with --time-travel) goes back to the start of cycle N, and on from there." << std::endl;
   std::cout << "\nOutput, in terms of HID reports (packets sent to the host computer, for real hardware), is" << std::endl;
   std::cout << "  printed to stdout as it happens, in summarized/human-readable form.  Raw HID output and" << std::endl;
   std::cout << "  serial output (through the 'Serial' object) are collected and redirected to various files" << std::endl;
-  std::cout << "  in a subdirectory \"results\" of the current directory." << std::endl;
+  std::cout << "  in a subdirectory \"results\" of the current directory (see --output-dir)." << std::endl;
   std::cout << "\nSerial input is currently unsupported - sketches requesting it will still build, but will" << std::endl;
   std::cout << "  find nothing is ever transmitted to them on the serial port." << std::endl;
   std::cout << "\n--- Commands ---" << std::endl;
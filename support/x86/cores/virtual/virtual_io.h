@@ -1,16 +1,63 @@
+#pragma once
+
 #include <stdbool.h>
 #include <string>
 
+typedef enum {
+  USB_ENDPOINT_KEYBOARD,
+  USB_ENDPOINT_MOUSE,
+  USB_ENDPOINT_ABSOLUTE_MOUSE,
+  USB_ENDPOINT_CONSUMER_CONTROL,
+  USB_ENDPOINT_SYSTEM_CONTROL,
+  USB_ENDPOINT_COUNT,
+} UsbEndpoint;
+
+const char* usbEndpointName(UsbEndpoint endpoint);
+
 // Returns TRUE if successful, FALSE if not
 bool initVirtualInput(int argc, char* argv[]);
+// Should only be used by cores/virtual/main.cpp, after setup().  With
+// --restore, restores the checkpoint first (see checkpoint.h).  With
+// --fork-server, serves requests and only returns in each forked child, once
+// its run has begun; with --corpus, runs the corpus (see corpus.h).  Returns
+// FALSE if the run couldn't begin.
+bool startRun(void);
 
-std::string getLineOfInput(bool anythingHeld);
+// For the library build (see virtual_library.h), instead of initVirtualInput():
+// options as on the command line but no script, as there's no input; opens the
+// outputs.  Returns TRUE if successful, FALSE if not.
+bool initEmbeddedRun(int argc, const char* const argv[]);
+
+// For runs forked by --fork-server and --corpus: the output directory for
+// 'script', from 'requested' (or else the environment or the default), and
+// opening the outputs there and starting the event bus
+std::string runOutputDir(const char* script, const std::string& requested);
+bool beginRunOutputs(const char* script, const std::string& dir);
+
+const std::string& getLineOfInput(bool anythingHeld);  // valid until the next call
 bool isInteractive(void);
+bool reportKeyboardEdges(void);  // log keyboard reports as key presses/releases rather than full state
 void printHelp(void);
 
+// Path of an output file, e.g. resultsPath("USB.txt"); the directory is "results"
+// unless changed with --output-dir or $KALEIDOSCOPE_VIRTUAL_OUTPUT_DIR
+std::string resultsPath(const char* filename);
+
 unsigned currentCycle(void);  // current cycle number, first cycle is 0
+void beginCycle(void);  // should only be used by cores/virtual/main.cpp, at the start of each cycle
 void nextCycle(void);  // should only be used by cores/virtual/main.cpp, to increment currentCycle()
+void runCycle(void);  // a whole cycle: beginCycle(), loop() and nextCycle(); in cores/virtual/main.cpp
+void setCurrentCycle(unsigned cycle);  // only for the library build's virtualReset(), between cycles
+void setMatrixActive(bool active);  // by the hardware after each matrix scan: whether any key was down or released
+unsigned long long currentTimeMicros(void);  // virtual time now (see virtual_clock.h); each cycle is --scan-period long, 1 ms by default
 
-void logUSBEvent(std::string descrip, void* data, int length);
-void logUSBEvent_keyboard(std::string descrip);  // assumes 'descrip' uniquely describes the raw data too
-void logLEDStates(std::string descrip);  // assumes 'descrip' uniquely describes the LED states
+// All output goes through the event bus (see event_bus.h); these only copy it
+// into the ring, and never allocate.  Text is passed preformatted, as a pointer
+// and a length (or NUL-terminated).
+void logHIDReport(UsbEndpoint endpoint, const void* data, int length);
+void logUSBEvent_keyboard(const char* descrip, size_t length);  // assumes 'descrip' uniquely describes the raw data too
+void logLEDFrame(const void* rgb, int ledCount);  // r, g, b bytes of each LED
+void logSerial(unsigned port, const void* data, int length);  // length 0 just opens the port
+void flushSerial(unsigned port);
+void printConsole(const char* line, size_t length);  // a line of stdout, without the newline
+void printConsole(const char* line);
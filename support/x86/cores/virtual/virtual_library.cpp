@@ -0,0 +1,96 @@
+#ifdef KALEIDOSCOPE_VIRTUAL_LIBRARY
+
+#include "virtual_library.h"
+#include "virtual_io.h"
+#include "virtual_clock.h"
+#include "event_bus.h"
+#include "checkpoint.h"
+#include <Arduino.h>
+#include <vector>
+#include <string.h>
+
+static bool initialized = false;
+static std::vector<CheckpointRegion> regions;
+static std::vector<uint8_t> afterSetup;  // the contents of 'regions' when setup() returned
+static uint64_t clockAfterSetup = 0;
+
+// Hands reports and LED frames to the callbacks
+class CallbackSink : public EventSink {
+ public:
+  CallbackSink() : report(NULL), reportContext(NULL), leds(NULL), ledsContext(NULL) {}
+
+  void consume(const Event& event) {
+    if (event.type != EVENT_REPORT && event.type != EVENT_LED_FRAME) return;
+    payload.insert(payload.end(), event.payload, event.payload + event.length);
+    if (event.flags & EVENT_FLAG_CONTINUED) return;
+    if (event.type == EVENT_REPORT && report) {
+      report(reportContext, event.cycle, event.device, payload.data(), payload.size());
+    } else if (event.type == EVENT_LED_FRAME && leds) {
+      leds(ledsContext, event.cycle, payload.data(), payload.size() / 3);
+    }
+    payload.clear();
+  }
+
+  VirtualReportCallback report;
+  void* reportContext;
+  VirtualLedCallback leds;
+  void* ledsContext;
+
+ private:
+  std::vector<uint8_t> payload;  // of the event(s) so far
+};
+
+static CallbackSink callbacks;
+
+int virtualInit(int argc, const char* const argv[]) {
+  if (initialized) return 0;
+  initialized = true;
+  eventBusAddSink(&callbacks);
+  if (!initEmbeddedRun(argc, argv)) return 0;
+
+  init();
+  initVariant();
+  setup();
+
+  if (!checkpointRegions(regions)) return 0;
+  for (size_t i = 0; i < regions.size(); i++) {
+    const uint8_t* start = (const uint8_t*)regions[i].address;
+    afterSetup.insert(afterSetup.end(), start, start + regions[i].size);
+  }
+  clockAfterSetup = virtualClockMicros();
+  return 1;
+}
+
+void virtualSetReportCallback(VirtualReportCallback callback, void* context) {
+  callbacks.report = callback;
+  callbacks.reportContext = context;
+}
+
+void virtualSetLedCallback(VirtualLedCallback callback, void* context) {
+  callbacks.leds = callback;
+  callbacks.ledsContext = context;
+}
+
+unsigned virtualStep(unsigned cycles) {
+  for (unsigned i = 0; i < cycles; i++) runCycle();
+  eventBusSync();
+  return currentCycle();
+}
+
+unsigned virtualCycle(void) {
+  return currentCycle();
+}
+
+void virtualReset(void) {
+  eventBusSync();  // the callbacks are done with the cycles so far
+  const uint8_t* saved = afterSetup.data();
+  for (size_t i = 0; i < regions.size(); i++) {
+    memcpy((void*)regions[i].address, saved, regions[i].size);
+    saved += regions[i].size;
+  }
+  setCurrentCycle(0);
+  virtualClockSet(clockAfterSetup);
+  virtualClockTakeDeadline();
+}
+
+#endif
@@ -0,0 +1,112 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+// The simulator as a shared library, for test drivers that run the sketch
+// in-process instead of feeding scripts to the executable (the "Shared
+// library" build in boards.txt, which defines KALEIDOSCOPE_VIRTUAL_LIBRARY and
+// leaves out main()).  Only this header is needed to use it, from C, from C++
+// (with the wrapper at the end) or through a C FFI such as Python's ctypes:
+//
+//   const char* options[] = {"--headless", "--traces=none"};
+//   virtualInit(2, options);  // opens the outputs and runs setup()
+//   virtualSetReportCallback(onReport, NULL);
+//   virtualSetKeystate(2, 1, VIRTUAL_KEY_TAP);
+//   virtualStep(1);
+//   virtualReset();  // back to the state setup() left, at cycle 0
+//
+// There is no script; the matrix only changes through virtualSetKeystate().
+// Options are those of the executable, apart from the ones that read input or
+// run more than one simulation, and the outputs are written as usual (to
+// results/library with --output-dir=auto).  There is one simulator per
+// process, driven from one thread; an error that would end a run (e.g. a
+// --expect-usb mismatch) exits the process.
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// As Virtual::keystate
+#define VIRTUAL_KEY_PRESSED 0
+#define VIRTUAL_KEY_NOT_PRESSED 1
+#define VIRTUAL_KEY_TAP 2  // pressed for the next cycle only
+
+// Called on the event bus thread (see event_bus.h) with each HID report
+// ('endpoint' is a UsbEndpoint, see virtual_io.h) or LED frame (the r, g, b
+// bytes of each LED) as it's sent.  Every call for the cycles run by
+// virtualStep() has been made by the time it returns.  Set callbacks between
+// steps; NULL for none.
+typedef void (*VirtualReportCallback)(void* context, unsigned cycle, int endpoint, const uint8_t* report, size_t length);
+typedef void (*VirtualLedCallback)(void* context, unsigned cycle, const uint8_t* rgb, unsigned ledCount);
+
+// Takes options as on the command line, opens the outputs and runs setup().
+// Returns 1 if successful, 0 if not (after printing an error on stderr), or
+// if it has already been called.
+int virtualInit(int argc, const char* const argv[]);
+
+void virtualSetReportCallback(VirtualReportCallback callback, void* context);
+void virtualSetLedCallback(VirtualLedCallback callback, void* context);
+
+// Sets key (row, col) of the matrix to a VIRTUAL_KEY_* state, as of the next
+// cycle; returns 0 if the key or state is out of range.  Implemented by the
+// Virtual hardware (src/Kaleidoscope-Hardware-Virtual.cpp).
+int virtualSetKeystate(unsigned row, unsigned col, int keystate);
+
+// Runs 'cycles' scan cycles; returns the number of the next one
+unsigned virtualStep(unsigned cycles);
+unsigned virtualCycle(void);
+
+// Puts the sketch's state, the cycle number and the virtual clock back to how
+// setup() left them, so that the next test starts afresh without reloading the
+// library.  The outputs carry on, with cycle numbers starting again from 0.
+void virtualReset(void);
+
+#ifdef __cplusplus
+}
+
+#include <functional>
+#include <string>
+#include <vector>
+
+// A thin C++ wrapper, with std::function callbacks
+class VirtualKeyboard {
+ public:
+  typedef std::function<void(unsigned cycle, int endpoint, const uint8_t* report, size_t length)> ReportCallback;
+  typedef std::function<void(unsigned cycle, const uint8_t* rgb, unsigned ledCount)> LedCallback;
+
+  bool begin(const std::vector<std::string>& options = std::vector<std::string>()) {
+    std::vector<const char*> argv;
+    for (size_t i = 0; i < options.size(); i++) argv.push_back(options[i].c_str());
+    return virtualInit(argv.size(), argv.data()) != 0;
+  }
+
+  void onReport(ReportCallback callback) {
+    report = callback;
+    virtualSetReportCallback(report ? forwardReport : NULL, this);
+  }
+  void onLeds(LedCallback callback) {
+    leds = callback;
+    virtualSetLedCallback(leds ? forwardLeds : NULL, this);
+  }
+
+  bool press(unsigned row, unsigned col) { return virtualSetKeystate(row, col, VIRTUAL_KEY_PRESSED) != 0; }
+  bool release(unsigned row, unsigned col) { return virtualSetKeystate(row, col, VIRTUAL_KEY_NOT_PRESSED) != 0; }
+  bool tap(unsigned row, unsigned col) { return virtualSetKeystate(row, col, VIRTUAL_KEY_TAP) != 0; }
+
+  unsigned step(unsigned cycles = 1) { return virtualStep(cycles); }
+  unsigned cycle(void) const { return virtualCycle(); }
+  void reset(void) { virtualReset(); }
+
+ private:
+  static void forwardReport(void* context, unsigned cycle, int endpoint, const uint8_t* data, size_t length) {
+    ((VirtualKeyboard*)context)->report(cycle, endpoint, data, length);
+  }
+  static void forwardLeds(void* context, unsigned cycle, const uint8_t* rgb, unsigned ledCount) {
+    ((VirtualKeyboard*)context)->leds(cycle, rgb, ledCount);
+  }
+
+  ReportCallback report;
+  LedCallback leds;
+};
+#endif
@@ -0,0 +1,135 @@
+// Dumps a flight recorder file (results/flight.bin, see --flight-recorder) as text.
+//
+// Build:  g++ -std=gnu++11 -O2 -I support/x86/cores/virtual tools/flight-decode.cpp -o flight-decode
+// Usage:  flight-decode results/flight.bin [CYCLES]
+//
+// Prints the last CYCLES cycles (default: all that the file still holds in full), oldest first.
+
+#include "flight_recorder.h"
+#include "event_bus.h"
+#include "structured_trace.h"  // traceDeviceNames
+#include <string>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+static const char* endpointName(unsigned endpoint) {
+  return (endpoint < TRACE_DEVICE_COUNT) ? traceDeviceNames[endpoint] : "Unknown";
+}
+
+static void printEvent(const FlightRecord& first, const std::string& payload) {
+  const unsigned char* bytes = (const unsigned char*)payload.data();
+  switch (first.type) {
+  case EVENT_CYCLE:
+    printf("=== Cycle %u (%llu us) ===\n", first.cycle, (unsigned long long)first.timeMicros);
+    break;
+  case EVENT_INPUT:
+    printf("input: %s\n", payload.c_str());
+    break;
+  case EVENT_REPORT:
+    printf("%s HID report: 0x", endpointName(first.device));
+    for (size_t i = 0; i < payload.size(); i++) printf("%02x", bytes[i]);
+    printf("\n");
+    break;
+  case EVENT_USB_TEXT:
+    printf("usb: %s\n", payload.c_str());
+    break;
+  case EVENT_LED_FRAME:
+    printf("LEDs:");
+    for (size_t i = 0; i + 2 < payload.size(); i += 3) printf(" %x.%x.%x", bytes[i], bytes[i + 1], bytes[i + 2]);
+    printf("\n");
+    break;
+  case EVENT_SERIAL:
+    if (payload.empty()) {
+      printf("serial %u: opened\n", first.device);
+      break;
+    }
+    printf("serial %u: \"", first.device);
+    for (size_t i = 0; i < payload.size(); i++) {
+      if (bytes[i] == '\n') printf("\\n");
+      else if (bytes[i] == '\r') printf("\\r");
+      else if (bytes[i] == '"' || bytes[i] == '\\') printf("\\%c", bytes[i]);
+      else if (bytes[i] < 0x20 || bytes[i] >= 0x7f) printf("\\x%02x", bytes[i]);
+      else putchar(bytes[i]);
+    }
+    printf("\"\n");
+    break;
+  case EVENT_CONSOLE:
+    printf("console: %s\n", payload.c_str());
+    break;
+  default:
+    printf("unknown event type %u (%zu bytes)\n", first.type, payload.size());
+    break;
+  }
+}
+
+int main(int argc, char* argv[]) {
+  if (argc < 2 || argc > 3) {
+    fprintf(stderr, "Usage: %s FLIGHT_FILE [CYCLES]\n", argv[0]);
+    return 2;
+  }
+  const int fd = open(argv[1], O_RDONLY);
+  struct stat st;
+  if (fd < 0 || fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(FlightHeader)) {
+    fprintf(stderr, "Error opening %s\n", argv[1]);
+    return 1;
+  }
+  const void* map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (map == MAP_FAILED) {
+    fprintf(stderr, "Error mapping %s\n", argv[1]);
+    return 1;
+  }
+
+  const FlightHeader& header = *(const FlightHeader*)map;
+  if (memcmp(header.magic, FLIGHT_MAGIC, sizeof(header.magic)) != 0 || header.version != FLIGHT_VERSION ||
+      header.recordSize != sizeof(FlightRecord) || header.indexEntries == 0 || header.dataRecords == 0 ||
+      (size_t)st.st_size < sizeof(FlightHeader) + header.indexEntries * sizeof(FlightCycleIndex) + header.dataRecords * sizeof(FlightRecord)) {
+    fprintf(stderr, "%s is not a version %u flight recorder file\n", argv[1], FLIGHT_VERSION);
+    return 1;
+  }
+  const FlightCycleIndex* cycleIndex = (const FlightCycleIndex*)(&header + 1);
+  const FlightRecord* records = (const FlightRecord*)(cycleIndex + header.indexEntries);
+
+  // Records older than the ring's capacity have been overwritten; so have cycles
+  // older than the index's.  Start at the oldest cycle that is still complete.
+  const uint64_t written = header.recordsWritten;
+  const uint64_t oldest = (written > header.dataRecords) ? written - header.dataRecords : 0;
+  uint64_t firstCycle = (header.cyclesWritten > header.indexEntries) ? header.cyclesWritten - header.indexEntries : 0;
+  if (argc == 3) {
+    const uint64_t wanted = strtoull(argv[2], NULL, 10);
+    if (header.cyclesWritten - firstCycle > wanted) firstCycle = header.cyclesWritten - wanted;
+  }
+  uint64_t start = oldest;
+  uint64_t shown = 0;
+  for (uint64_t c = firstCycle; c < header.cyclesWritten; c++) {
+    const FlightCycleIndex& entry = cycleIndex[c % header.indexEntries];
+    if (entry.firstRecord >= oldest) {
+      start = entry.firstRecord;
+      shown = header.cyclesWritten - c;
+      break;
+    }
+  }
+  printf("%llu cycles, %llu records written; showing the last %llu cycle(s), records %llu-%llu\n",
+         (unsigned long long)header.cyclesWritten, (unsigned long long)written, (unsigned long long)shown,
+         (unsigned long long)start, (unsigned long long)written);
+
+  std::string payload;
+  const FlightRecord* first = NULL;
+  for (uint64_t i = start; i < written; i++) {
+    const FlightRecord& record = records[i % header.dataRecords];
+    if (!first) {
+      first = &record;
+      payload.clear();
+    }
+    payload.append((const char*)record.payload, record.length > FLIGHT_PAYLOAD_SIZE ? FLIGHT_PAYLOAD_SIZE : record.length);
+    if (record.flags & EVENT_FLAG_CONTINUED) continue;
+    printEvent(*first, payload);
+    first = NULL;
+  }
+  if (first) printf("(last event incomplete)\n");
+  return 0;
+}
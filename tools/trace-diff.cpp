@@ -0,0 +1,484 @@
+// Compares two traces cycle by cycle, on all cores, and reports the ranges of
+// cycles in which they differ.
+//
+// Build:  g++ -std=gnu++11 -O2 -pthread -I support/x86/cores/virtual tools/trace-diff.cpp -o trace-diff
+// Usage:  trace-diff [-j THREADS] [--max-ranges=N] A B
+//
+// Understands the text logs whose lines start with "Cycle N:" (USB.txt,
+// LED.txt), JSON Lines traces (trace.jsonl, see --trace) and trace stores
+// (trace.store, see --trace-store).  Not USB_host.txt: its "Frame N:" lines
+// count USB frames, which only match cycles at the default scan period.  Both files are
+// mapped, split into chunks on cycle boundaries, and the chunks are compared
+// in parallel.  Within a cycle, the records of each device are compared in
+// order, so the summary can say which devices differ.
+//
+// A range of differing cycles ends at the next cycle that has output in
+// either file and matches.  Exits with 0 if the traces match, 1 if they
+// differ and 2 on error, like diff.
+
+#include "trace-store.h"
+#include "structured_trace.h"  // traceDeviceNames
+#include <string>
+#include <vector>
+#include <map>
+#include <thread>
+#include <atomic>
+#include <algorithm>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define CHUNK_BYTES (8 << 20)  // of the first file, for text traces
+#define CHUNK_CYCLES 20000  // for trace stores
+
+static const char* endpointName(unsigned endpoint) {
+  return (endpoint < TRACE_DEVICE_COUNT) ? traceDeviceNames[endpoint] : "Unknown";
+}
+
+// A line of a text trace, or a record of a trace store
+struct Record {
+  uint32_t cycle;
+  const char* device;  // trace stores; text lines name their device themselves
+  bool tagged;  // text lines: starts with a cycle
+  const char* data;
+  size_t length;
+};
+
+// --- Text traces ---
+
+class TextTrace {
+ public:
+  TextTrace() : base(NULL), size(0) {}
+  ~TextTrace() {
+    if (base) munmap((void*)base, size);
+  }
+
+  bool open(const char* path, std::string& error) {
+    const int fd = ::open(path, O_RDONLY);
+    if (fd < 0) {
+      error = std::string("can't open ") + path;
+      return false;
+    }
+    struct stat info;
+    fstat(fd, &info);
+    size = info.st_size;
+    if (size) {
+      void* mapping = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (mapping == MAP_FAILED) {
+        close(fd);
+        error = std::string("can't map ") + path;
+        return false;
+      }
+      base = (const char*)mapping;
+      madvise(mapping, size, MADV_SEQUENTIAL);
+    }
+    close(fd);
+    return true;
+  }
+
+  // The cycle of the line at 'p', if it has one: "Cycle N: ..." or a JSON
+  // object with a "cycle" member
+  bool cycleOf(size_t p, uint32_t& cycle) const {
+    const char* line = base + p;
+    const char* end = (const char*)memchr(line, '\n', size - p);
+    if (!end) end = base + size;
+    if (line < end && *line == '{') {
+      static const char key[] = "\"cycle\":";
+      const char* found = (const char*)memmem(line, end - line, key, sizeof(key) - 1);
+      if (!found) return false;
+      return number(found + sizeof(key) - 1, end, cycle);
+    }
+    static const char word[] = "Cycle ";
+    if ((size_t)(end - line) < sizeof(word) - 1 || memcmp(line, word, sizeof(word) - 1) != 0) return false;
+    const char* stop;
+    if (!number(line + sizeof(word) - 1, end, cycle, &stop)) return false;
+    return stop < end && *stop == ':';
+  }
+
+  // The start of the first line at or after 'p' that has a cycle, or 'size'
+  size_t nextCycleLine(size_t p) const {
+    if (p > 0 && p < size && base[p - 1] != '\n') p = lineAfter(p);
+    uint32_t cycle;
+    while (p < size && !cycleOf(p, cycle)) p = lineAfter(p);
+    return p;
+  }
+
+  // The start of the first line whose cycle is at least 'cycle' (lines in
+  // between without a cycle belong to the one before)
+  size_t positionOf(uint32_t cycle) const {
+    size_t low = 0, high = size;
+    while (low < high) {
+      const size_t middle = low + (high - low) / 2;
+      const size_t p = nextCycleLine(middle);
+      uint32_t found;
+      if (p == size || (cycleOf(p, found) && found >= cycle)) high = middle;
+      else low = middle + 1;
+    }
+    return nextCycleLine(low);
+  }
+
+  size_t lineAfter(size_t p) const {
+    const char* end = (const char*)memchr(base + p, '\n', size - p);
+    return end ? end - base + 1 : size;
+  }
+
+  // Appends the lines in [from, to) as records
+  void records(size_t from, size_t to, std::vector<Record>& out) const {
+    uint32_t cycle = 0;
+    bool haveCycle = false;
+    for (size_t p = from, next; p < to; p = next) {
+      Record record;
+      next = lineAfter(p);
+      record.data = base + p;
+      record.length = next - p;
+      record.device = NULL;
+      record.tagged = cycleOf(p, record.cycle);
+      if (record.tagged) {
+        cycle = record.cycle;
+        haveCycle = true;
+      } else {
+        if (record.length <= 1) continue;  // blank lines (LED.txt) carry nothing
+        record.cycle = haveCycle ? cycle : (out.empty() ? 0 : out.back().cycle);
+      }
+      out.push_back(record);
+    }
+  }
+
+  const char* base;
+  size_t size;
+
+ private:
+  static bool number(const char* p, const char* end, uint32_t& value, const char** stop = NULL) {
+    if (p >= end || *p < '0' || *p > '9') return false;
+    value = 0;
+    while (p < end && *p >= '0' && *p <= '9') value = value * 10 + (*p++ - '0');
+    if (stop) *stop = p;
+    return true;
+  }
+};
+
+// --- Comparison ---
+
+// The device a record is about: "Cycle N: Keyboard HID report" -> Keyboard,
+// "Cycle N: 0.0.0 ..." -> LEDs, {"type":"report",...,"device":"Mouse"} -> report Mouse.
+// Only needed for the cycles that differ.
+static std::string member(const char* line, const char* end, const char* key);
+static std::string deviceOf(const Record& record) {
+  if (record.device) return record.device;
+  if (!record.tagged) return "(untagged)";
+  const char* line = record.data;
+  const char* end = record.data + record.length;
+  if (*line == '{') {
+    std::string device = member(line, end, "\"type\":\"");
+    const std::string endpoint = member(line, end, "\"device\":\"");
+    if (!endpoint.empty()) device += " " + endpoint;
+    const std::string port = member(line, end, "\"port\":");
+    if (!port.empty()) device += " " + port;
+    return device;
+  }
+  const char* colon = (const char*)memchr(line, ':', end - line);
+  const char* word = colon + 1;
+  while (word < end && *word == ' ') word++;
+  const char* wordEnd = word;
+  while (wordEnd < end && *wordEnd != ' ' && *wordEnd != '\n' && *wordEnd != ';' && *wordEnd != ':') wordEnd++;
+  if (word == wordEnd) return "(empty)";
+  if (!((*word >= 'A' && *word <= 'Z') || (*word >= 'a' && *word <= 'z'))) return "LEDs";
+  return std::string(word, wordEnd);
+}
+
+// The value after 'key' in a JSON line, up to the next quote or comma
+static std::string member(const char* line, const char* end, const char* key) {
+  const char* found = (const char*)memmem(line, end - line, key, strlen(key));
+  if (!found) return "";
+  const char* value = found + strlen(key);
+  const char* stop = value;
+  while (stop < end && *stop != '"' && *stop != ',' && *stop != '}') stop++;
+  return std::string(value, stop);
+}
+
+struct Range {
+  uint32_t first, last;
+  unsigned cycles;  // that differ
+  std::map<std::string, unsigned> devices;  // cycles in which each device differs
+};
+
+struct ChunkResult {
+  std::vector<Range> ranges;
+  bool openAtStart;  // the first range started before any matching cycle in the chunk
+  bool openAtEnd;  // no matching cycle after the last range
+  bool anyMatch;
+  // the first difference in the chunk
+  std::string lineA, lineB;
+};
+
+static std::string show(const Record* record, bool text) {
+  if (!record) return "(nothing)";
+  if (text) {
+    size_t length = record->length;
+    while (length && (record->data[length - 1] == '\n' || record->data[length - 1] == '\r')) length--;
+    return std::string(record->data, length);
+  }
+  char prefix[64];
+  snprintf(prefix, sizeof(prefix), "cycle %u %s 0x", record->cycle, record->device);
+  std::string out = prefix;
+  static const char digits[] = "0123456789abcdef";
+  for (size_t i = 0; i < record->length; i++) {
+    out.push_back(digits[(uint8_t)record->data[i] >> 4]);
+    out.push_back(digits[(uint8_t)record->data[i] & 0xf]);
+  }
+  return out;
+}
+
+static bool same(const Record& a, const Record& b) {
+  return a.device == b.device && a.length == b.length && memcmp(a.data, b.data, a.length) == 0;  // names are interned
+}
+
+// Compares the records of one chunk (both sides cover the same cycles)
+static void compareChunk(const std::vector<Record>& a, const std::vector<Record>& b, bool text, ChunkResult& result) {
+  result.openAtStart = false;
+  result.openAtEnd = false;
+  result.anyMatch = false;
+  bool open = false;
+  size_t i = 0, j = 0;
+  std::vector<const Record*> deviceA, deviceB;
+  std::vector<std::string> namesA, namesB;
+  while (i < a.size() || j < b.size()) {
+    uint32_t cycle;
+    if (i == a.size()) cycle = b[j].cycle;
+    else if (j == b.size()) cycle = a[i].cycle;
+    else cycle = std::min(a[i].cycle, b[j].cycle);
+    size_t endA = i, endB = j;
+    while (endA < a.size() && a[endA].cycle == cycle) endA++;
+    while (endB < b.size() && b[endB].cycle == cycle) endB++;
+
+    bool differs = (endA - i != endB - j);
+    for (size_t k = 0; !differs && k < endA - i; k++) differs = !same(a[i + k], b[j + k]);
+    if (!differs) {
+      result.anyMatch = true;
+      open = false;
+    } else {
+      if (!open) {
+        if (result.ranges.empty()) {
+          result.openAtStart = !result.anyMatch;
+          // the first pair of records that differ
+          size_t k = 0;
+          while (i + k < endA && j + k < endB && same(a[i + k], b[j + k])) k++;
+          result.lineA = show(i + k < endA ? &a[i + k] : NULL, text);
+          result.lineB = show(j + k < endB ? &b[j + k] : NULL, text);
+        }
+        Range range;
+        range.first = cycle;
+        range.cycles = 0;
+        result.ranges.push_back(range);
+        open = true;
+      }
+      Range& range = result.ranges.back();
+      range.last = cycle;
+      range.cycles++;
+      // which devices' records differ
+      namesA.clear();
+      namesB.clear();
+      std::map<std::string, bool> seen;
+      for (size_t k = i; k < endA; k++) namesA.push_back(deviceOf(a[k]));
+      for (size_t k = j; k < endB; k++) namesB.push_back(deviceOf(b[k]));
+      for (size_t k = 0; k < namesA.size(); k++) seen[namesA[k]] = true;
+      for (size_t k = 0; k < namesB.size(); k++) seen[namesB[k]] = true;
+      bool anyDevice = false;
+      for (std::map<std::string, bool>::const_iterator device = seen.begin(); device != seen.end(); ++device) {
+        deviceA.clear();
+        deviceB.clear();
+        for (size_t k = 0; k < namesA.size(); k++) if (namesA[k] == device->first) deviceA.push_back(&a[i + k]);
+        for (size_t k = 0; k < namesB.size(); k++) if (namesB[k] == device->first) deviceB.push_back(&b[j + k]);
+        bool deviceDiffers = deviceA.size() != deviceB.size();
+        for (size_t k = 0; !deviceDiffers && k < deviceA.size(); k++) deviceDiffers = !same(*deviceA[k], *deviceB[k]);
+        if (deviceDiffers) {
+          range.devices[device->first]++;
+          anyDevice = true;
+        }
+      }
+      if (!anyDevice) range.devices["(order)"]++;  // same records per device, interleaved differently
+    }
+    i = endA;
+    j = endB;
+  }
+  result.openAtEnd = open;
+}
+
+static std::string serialNames[256];  // "serial N"; filled in before the workers start
+
+// Trace store records, as a single sequence ordered by cycle
+static void storeRecords(TraceStore& store, uint32_t first, uint32_t last, std::vector<Record>& out) {
+  static const uint8_t types[] = {EVENT_INPUT, EVENT_REPORT, EVENT_LED_FRAME, EVENT_SERIAL};
+  static const char* typeNames[] = {"input", "report", "LEDs", "serial"};
+  for (unsigned t = 0; t < sizeof(types); t++) {
+    StoreQuery query(types[t]);
+    query.firstCycle = first;
+    query.lastCycle = last;
+    store.query(query, [&](const StoreRecord& stored) {
+      Record record;
+      record.cycle = stored.cycle;
+      if (stored.type == EVENT_REPORT) record.device = endpointName(stored.device);
+      else if (stored.type == EVENT_SERIAL) record.device = serialNames[stored.device].c_str();
+      else record.device = typeNames[t];
+      record.tagged = true;
+      record.data = (const char*)stored.data;
+      record.length = stored.length;
+      out.push_back(record);
+      return true;
+    });
+  }
+  std::stable_sort(out.begin(), out.end(), [](const Record& x, const Record& y) { return x.cycle < y.cycle; });
+}
+
+static bool isStore(const char* path) {
+  char magic[8];
+  FILE* file = fopen(path, "rb");
+  if (!file) return false;
+  const bool store = fread(magic, 1, sizeof(magic), file) == sizeof(magic) && memcmp(magic, STORE_MAGIC, 8) == 0;
+  fclose(file);
+  return store;
+}
+
+static int usage(const char* program) {
+  fprintf(stderr, "Usage: %s [-j THREADS] [--max-ranges=N] A B\n", program);
+  return 2;
+}
+
+int main(int argc, char* argv[]) {
+  unsigned threads = std::thread::hardware_concurrency();
+  size_t maxRanges = 20;
+  const char* paths[2] = {NULL, NULL};
+  unsigned files = 0;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) threads = atoi(argv[++i]);
+    else if (strncmp(argv[i], "--max-ranges=", 13) == 0) maxRanges = strtoul(argv[i] + 13, NULL, 10);
+    else if (files < 2) paths[files++] = argv[i];
+    else return usage(argv[0]);
+  }
+  if (files != 2) return usage(argv[0]);
+  if (threads == 0) threads = 1;
+
+  // chunk k covers cycles [boundaries[k], boundaries[k + 1])
+  const bool store = isStore(paths[0]);
+  if (store != isStore(paths[1])) {
+    fprintf(stderr, "Error: can't compare a trace store with a text trace\n");
+    return 2;
+  }
+  TextTrace text[2];
+  TraceStore stores[2];
+  std::vector<uint32_t> boundaries;
+  std::vector<size_t> positions[2];
+  if (store) {
+    uint32_t last = 0;
+    for (unsigned f = 0; f < 2; f++) {
+      if (!stores[f].open(paths[f])) {
+        fprintf(stderr, "%s: %s\n", paths[f], stores[f].error().c_str());
+        return 2;
+      }
+      for (size_t i = 0; i < stores[f].blocks().size(); i++) last = std::max(last, stores[f].blocks()[i].lastCycle);
+    }
+    for (uint64_t cycle = 0; cycle <= last; cycle += CHUNK_CYCLES) boundaries.push_back(cycle);
+    for (unsigned port = 0; port < 256; port++) serialNames[port] = "serial " + std::to_string(port);
+  } else {
+    for (unsigned f = 0; f < 2; f++) {
+      std::string error;
+      if (!text[f].open(paths[f], error)) {
+        fprintf(stderr, "Error: %s\n", error.c_str());
+        return 2;
+      }
+    }
+    boundaries.push_back(0);
+    for (size_t offset = CHUNK_BYTES; offset < text[0].size; offset += CHUNK_BYTES) {
+      const size_t p = text[0].nextCycleLine(offset);
+      uint32_t cycle;
+      if (p < text[0].size && text[0].cycleOf(p, cycle) && cycle > boundaries.back()) boundaries.push_back(cycle);
+    }
+    for (unsigned f = 0; f < 2; f++) {
+      positions[f].push_back(0);  // lines before the first cycle go with the first chunk
+      for (size_t k = 1; k < boundaries.size(); k++) positions[f].push_back(text[f].positionOf(boundaries[k]));
+      positions[f].push_back(text[f].size);
+    }
+  }
+
+  std::vector<ChunkResult> results(boundaries.size());
+  std::atomic<size_t> nextChunk(0);
+  std::vector<std::thread> workers;
+  for (unsigned t = 0; t < threads && t < boundaries.size(); t++) {
+    workers.push_back(std::thread([&]() {
+      std::vector<Record> a, b;
+      for (size_t k = nextChunk++; k < boundaries.size(); k = nextChunk++) {
+        a.clear();
+        b.clear();
+        if (store) {
+          const uint32_t last = (k + 1 < boundaries.size()) ? boundaries[k + 1] - 1 : UINT32_MAX;
+          storeRecords(stores[0], boundaries[k], last, a);
+          storeRecords(stores[1], boundaries[k], last, b);
+        } else {
+          text[0].records(positions[0][k], positions[0][k + 1], a);
+          text[1].records(positions[1][k], positions[1][k + 1], b);
+        }
+        compareChunk(a, b, !store, results[k]);
+      }
+    }));
+  }
+  for (size_t t = 0; t < workers.size(); t++) workers[t].join();
+
+  // Join the chunks' ranges where one runs into the next
+  std::vector<Range> ranges;
+  std::string lineA, lineB;
+  bool open = false;
+  bool haveFirst = false;
+  for (size_t k = 0; k < results.size(); k++) {
+    ChunkResult& result = results[k];
+    for (size_t r = 0; r < result.ranges.size(); r++) {
+      Range& range = result.ranges[r];
+      if (r == 0 && open && result.openAtStart) {
+        Range& previous = ranges.back();
+        previous.last = range.last;
+        previous.cycles += range.cycles;
+        for (std::map<std::string, unsigned>::const_iterator d = range.devices.begin(); d != range.devices.end(); ++d) {
+          previous.devices[d->first] += d->second;
+        }
+      } else {
+        ranges.push_back(range);
+      }
+      if (!haveFirst) {
+        lineA = result.lineA;
+        lineB = result.lineB;
+        haveFirst = true;
+      }
+    }
+    if (!result.ranges.empty()) open = result.openAtEnd;
+    else if (result.anyMatch) open = false;
+  }
+
+  if (ranges.empty()) return 0;
+  unsigned cycles = 0;
+  std::map<std::string, unsigned> devices;
+  for (size_t r = 0; r < ranges.size(); r++) {
+    cycles += ranges[r].cycles;
+    for (std::map<std::string, unsigned>::const_iterator d = ranges[r].devices.begin(); d != ranges[r].devices.end(); ++d) {
+      devices[d->first] += d->second;
+    }
+  }
+  printf("%s and %s differ in %u cycle(s), in %zu range(s)\n", paths[0], paths[1], cycles, ranges.size());
+  printf("First difference, at cycle %u:\n< %s\n> %s\n", ranges[0].first, lineA.c_str(), lineB.c_str());
+  printf("Ranges:\n");
+  for (size_t r = 0; r < ranges.size() && r < maxRanges; r++) {
+    printf("  %u-%u: %u cycle(s);", ranges[r].first, ranges[r].last, ranges[r].cycles);
+    for (std::map<std::string, unsigned>::const_iterator d = ranges[r].devices.begin(); d != ranges[r].devices.end(); ++d) {
+      printf(" %s %u", d->first.c_str(), d->second);
+    }
+    printf("\n");
+  }
+  if (ranges.size() > maxRanges) printf("  ... and %zu more (see --max-ranges)\n", ranges.size() - maxRanges);
+  printf("By device (cycles that differ):\n");
+  for (std::map<std::string, unsigned>::const_iterator d = devices.begin(); d != devices.end(); ++d) {
+    printf("  %-20s %u\n", d->first.c_str(), d->second);
+  }
+  return 1;
+}
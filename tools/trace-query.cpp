@@ -0,0 +1,189 @@
+// Queries a trace store (results/trace.store, see --trace-store) by cycle range,
+// device and payload bytes, reading only the blocks that can match.
+//
+// Build:  g++ -std=gnu++11 -O2 -I support/x86/cores/virtual tools/trace-query.cpp -o trace-query
+// Usage:  trace-query STORE blocks
+//         trace-query STORE reports|leds|serial|input [OPTIONS]
+//
+// Options:
+//   --cycles=A:B       only cycles A to B (inclusive); either end may be left out
+//   --device=DEVICE    only this USB endpoint (name or number) or serial port
+//   --byte=K:V         payload byte K is V, or in LO-HI with --byte=K:LO-HI
+//   --bits=K:MASK      payload byte K has all the bits of MASK set
+//   --key=USAGE        keyboard reports with this usage held (e.g. 0x04 for 'a', 0xe1 for left shift)
+//   --led=N:RRGGBB     LED frames with LED N set to this color
+//   --first            stop after the first match
+//   --count            print the number of matches instead of the matches
+//
+// Numbers may be decimal or 0x-prefixed hex.  For example, the first cycle in
+// which 'a' was reported:  trace-query results/trace.store reports --key=0x04 --first
+
+#include "trace-store.h"
+#include "structured_trace.h"  // traceDeviceNames
+#include <string>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+static const char* endpointName(unsigned endpoint) {
+  return (endpoint < TRACE_DEVICE_COUNT) ? traceDeviceNames[endpoint] : "Unknown";
+}
+
+static const char* typeName(unsigned type) {
+  switch (type) {
+  case EVENT_REPORT: return "reports";
+  case EVENT_LED_FRAME: return "leds";
+  case EVENT_SERIAL: return "serial";
+  case EVENT_INPUT: return "input";
+  default: return "unknown";
+  }
+}
+
+static bool parseNumber(const char* text, unsigned long& value, char** end = NULL) {
+  char* stop;
+  value = strtoul(text, &stop, 0);
+  if (stop == text) return false;
+  if (end) *end = stop;
+  else if (*stop) return false;
+  return true;
+}
+
+static void printRecord(const StoreRecord& record) {
+  switch (record.type) {
+  case EVENT_REPORT:
+    printf("%u %s 0x", record.cycle, endpointName(record.device));
+    for (size_t i = 0; i < record.length; i++) printf("%02x", record.data[i]);
+    printf("\n");
+    break;
+  case EVENT_LED_FRAME:
+    printf("%u LEDs:", record.cycle);
+    for (size_t i = 0; i + 2 < record.length; i += 3) printf(" %x.%x.%x", record.data[i], record.data[i + 1], record.data[i + 2]);
+    printf("\n");
+    break;
+  case EVENT_SERIAL:
+    printf("%u serial %u: \"", record.cycle, record.device);
+    for (size_t i = 0; i < record.length; i++) {
+      const uint8_t c = record.data[i];
+      if (c == '\n') printf("\\n");
+      else if (c == '\r') printf("\\r");
+      else if (c == '"' || c == '\\') printf("\\%c", c);
+      else if (c < 0x20 || c >= 0x7f) printf("\\x%02x", c);
+      else putchar(c);
+    }
+    printf("\"\n");
+    break;
+  case EVENT_INPUT:
+    printf("%u input: %.*s\n", record.cycle, (int)record.length, (const char*)record.data);
+    break;
+  }
+}
+
+static int usage(const char* program) {
+  fprintf(stderr, "Usage: %s STORE blocks\n", program);
+  fprintf(stderr, "       %s STORE reports|leds|serial|input [--cycles=A:B] [--device=DEVICE] [--byte=K:V[-MAX]]\n", program);
+  fprintf(stderr, "           [--bits=K:MASK] [--key=USAGE] [--led=N:RRGGBB] [--first] [--count]\n");
+  return 2;
+}
+
+int main(int argc, char* argv[]) {
+  if (argc < 3) return usage(argv[0]);
+  TraceStore store;
+  if (!store.open(argv[1])) {
+    fprintf(stderr, "%s: %s\n", argv[1], store.error().c_str());
+    return 1;
+  }
+  if (store.recovered()) fprintf(stderr, "%s: no index (the run didn't finish); read the block headers instead\n", argv[1]);
+
+  const std::string what = argv[2];
+  if (what == "blocks") {
+    const std::vector<StoreBlockHeader>& blocks = store.blocks();
+    for (size_t i = 0; i < blocks.size(); i++) {
+      printf("%-7s cycles %u-%u, %u records, devices 0x%x, %u bytes at %llu\n", typeName(blocks[i].type),
+             blocks[i].firstCycle, blocks[i].lastCycle, blocks[i].count, blocks[i].devices, blocks[i].size,
+             (unsigned long long)blocks[i].offset);
+    }
+    return 0;
+  }
+
+  uint8_t type;
+  if (what == "reports") type = EVENT_REPORT;
+  else if (what == "leds") type = EVENT_LED_FRAME;
+  else if (what == "serial") type = EVENT_SERIAL;
+  else if (what == "input") type = EVENT_INPUT;
+  else return usage(argv[0]);
+
+  StoreQuery query(type);
+  bool firstOnly = false;
+  bool countOnly = false;
+  for (int i = 3; i < argc; i++) {
+    const std::string arg = argv[i];
+    const size_t equals = arg.find('=');
+    const std::string name = arg.substr(0, equals);
+    const char* value = (equals == std::string::npos) ? "" : argv[i] + equals + 1;
+    unsigned long first, second;
+    char* rest;
+    if (name == "--first") {
+      firstOnly = true;
+    } else if (name == "--count") {
+      countOnly = true;
+    } else if (name == "--cycles") {
+      const char* colon = strchr(value, ':');
+      if (!colon) return usage(argv[0]);
+      if (colon != value) {
+        if (!parseNumber(std::string(value, colon).c_str(), first)) return usage(argv[0]);
+        query.firstCycle = first;
+      }
+      if (colon[1]) {
+        if (!parseNumber(colon + 1, second)) return usage(argv[0]);
+        query.lastCycle = second;
+      }
+    } else if (name == "--device") {
+      unsigned device = TRACE_DEVICE_COUNT;
+      for (unsigned ep = 0; ep < TRACE_DEVICE_COUNT; ep++) {
+        if (strcasecmp(value, traceDeviceNames[ep]) == 0) device = ep;
+      }
+      if (device == TRACE_DEVICE_COUNT) {
+        if (!parseNumber(value, first)) return usage(argv[0]);
+        device = first;
+      }
+      query.devices = 1u << (device < 31 ? device : 31);
+    } else if (name == "--byte") {
+      if (!parseNumber(value, first, &rest) || *rest != ':' || !parseNumber(rest + 1, second, &rest)) return usage(argv[0]);
+      unsigned long high = second;
+      if (*rest == '-' && !parseNumber(rest + 1, high)) return usage(argv[0]);
+      if (*rest && *rest != '-') return usage(argv[0]);
+      query.conditions.push_back(StoreCondition::range(first, second, high));
+    } else if (name == "--bits") {
+      if (!parseNumber(value, first, &rest) || *rest != ':' || !parseNumber(rest + 1, second)) return usage(argv[0]);
+      query.conditions.push_back(StoreCondition::bits(first, second));
+    } else if (name == "--key") {
+      // modifier byte, then a bitmap of the usages held (see decodeReport() in cores/virtual/structured_trace.cpp)
+      if (!parseNumber(value, first)) return usage(argv[0]);
+      query.devices = 1u << 0;
+      if (first >= 0xe0 && first <= 0xe7) query.conditions.push_back(StoreCondition::bits(0, 1 << (first - 0xe0)));
+      else query.conditions.push_back(StoreCondition::bits(1 + first / 8, 1 << (first % 8)));
+    } else if (name == "--led") {
+      if (!parseNumber(value, first, &rest) || *rest != ':' || strlen(rest + 1) != 6) return usage(argv[0]);
+      const unsigned long color = strtoul(rest + 1, &rest, 16);
+      if (*rest) return usage(argv[0]);
+      for (unsigned c = 0; c < 3; c++) {
+        const uint8_t component = color >> (16 - 8 * c);
+        query.conditions.push_back(StoreCondition::range(first * 3 + c, component, component));
+      }
+    } else {
+      return usage(argv[0]);
+    }
+  }
+
+  const size_t matches = store.query(query, [&](const StoreRecord& record) {
+    if (!countOnly) printRecord(record);
+    return !firstOnly;
+  });
+  if (countOnly) printf("%zu\n", matches);
+
+  size_t blocksOfType = 0;
+  for (size_t i = 0; i < store.blocks().size(); i++) blocksOfType += (store.blocks()[i].type == type);
+  fprintf(stderr, "%zu match(es); read %zu of %zu %s blocks\n", matches, store.blocksRead(), blocksOfType, typeName(type));
+  return 0;
+}
@@ -0,0 +1,361 @@
+// Streaming reader for structured traces (results/trace.jsonl or results/trace.cbor,
+// see --trace and cores/virtual/structured_trace.h for the schema).
+//
+// Header-only; include it with -I support/x86/cores/virtual.  The file is read in
+// large blocks and each record is decoded in place into a reused TraceRecord,
+// so reading costs about as much as the disk does:
+//
+//   TraceReader reader;
+//   TraceRecord record;
+//   if (!reader.open("results/trace.cbor")) { fprintf(stderr, "%s\n", reader.error().c_str()); ... }
+//   while (reader.next(record)) {
+//     if (record.type == TRACE_RECORD_REPORT && record.device == 0) ...  // a keyboard report
+//   }
+//   if (!reader.error().empty()) ...  // stopped early
+//
+// The encoding (JSON Lines or CBOR) is detected from the first byte.
+
+#pragma once
+
+#include "structured_trace.h"  // TRACE_SCHEMA, TRACE_VERSION, traceDeviceNames
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+typedef enum {
+  TRACE_RECORD_HEADER,
+  TRACE_RECORD_CYCLE,
+  TRACE_RECORD_INPUT,
+  TRACE_RECORD_REPORT,
+  TRACE_RECORD_LED,
+  TRACE_RECORD_SERIAL,
+  TRACE_RECORD_UNKNOWN,  // from a newer writer; skip it
+} TraceRecordType;
+
+struct TraceRecord {
+  TraceRecordType type;
+  uint32_t cycle;
+  uint64_t time;  // virtual microseconds
+  int device;  // report: UsbEndpoint (0 Keyboard ... 4 SystemControl, -1 unknown); serial: port
+  std::string data;  // input: text; report: raw bytes; led: r, g, b bytes; serial: bytes written
+  // Decoded report fields; those the endpoint doesn't have are 0 (or empty)
+  int modifiers;
+  int buttons;
+  int x, y;
+  int wheel, hWheel;
+  std::vector<unsigned> usages;
+  uint32_t version;  // header only
+};
+
+class TraceReader {
+ public:
+  TraceReader() : file(NULL), start(0), end(0), eof(false), cbor(false), traceVersion(0) {}
+  ~TraceReader() {
+    if (file) fclose(file);
+  }
+
+  // Opens the trace and reads its header.  Returns FALSE (see error()) if it
+  // can't be read, or was written with a newer schema version.
+  bool open(const char* path) {
+    file = fopen(path, "rb");
+    if (!file) return fail(std::string("can't open ") + path);
+    buffer.resize(BLOCK_SIZE);
+    if (!fill(1)) return fail("empty trace");
+    cbor = ((uint8_t)buffer[start] != '{');
+    TraceRecord header;
+    if (!next(header)) return fail(message.empty() ? "empty trace" : message);
+    if (header.type != TRACE_RECORD_HEADER || schema != TRACE_SCHEMA) return fail("not a trace (no header record)");
+    if (header.version > TRACE_VERSION) return fail("trace was written with a newer schema version");
+    traceVersion = header.version;
+    return true;
+  }
+
+  // Reads the next record.  Returns FALSE at the end of the trace, or on a
+  // malformed record (error() is then set).
+  bool next(TraceRecord& record) {
+    clear(record);
+    return cbor ? nextCbor(record) : nextJson(record);
+  }
+
+  const std::string& error(void) const {
+    return message;
+  }
+  uint32_t version(void) const {
+    return traceVersion;
+  }
+  bool isCbor(void) const {
+    return cbor;
+  }
+
+ private:
+  enum { BLOCK_SIZE = 1 << 20 };
+
+  bool fail(const std::string& why) {
+    if (message.empty()) message = why;
+    return false;
+  }
+
+  // Makes at least 'count' unread bytes available; FALSE if the file ends first
+  bool fill(size_t count) {
+    if (end - start >= count) return true;
+    if (eof) return false;
+    memmove(&buffer[0], &buffer[start], end - start);
+    end -= start;
+    start = 0;
+    if (buffer.size() < count) buffer.resize(count + BLOCK_SIZE);
+    while (end < count && !eof) {
+      const size_t got = fread(&buffer[end], 1, buffer.size() - end, file);
+      if (got == 0) eof = true;
+      end += got;
+    }
+    return end >= count;
+  }
+
+  static void clear(TraceRecord& record) {
+    record.type = TRACE_RECORD_UNKNOWN;
+    record.cycle = 0;
+    record.time = 0;
+    record.device = -1;
+    record.data.clear();
+    record.modifiers = record.buttons = record.x = record.y = record.wheel = record.hWheel = 0;
+    record.usages.clear();
+    record.version = 0;
+  }
+
+  static TraceRecordType recordType(const std::string& name) {
+    static const char* names[] = {"header", "cycle", "input", "report", "led", "serial"};
+    for (int i = 0; i < TRACE_RECORD_UNKNOWN; i++) if (name == names[i]) return (TraceRecordType)i;
+    return TRACE_RECORD_UNKNOWN;
+  }
+
+  static int deviceNumber(const std::string& name) {
+    for (int i = 0; i < TRACE_DEVICE_COUNT; i++) if (name == traceDeviceNames[i]) return i;
+    return -1;
+  }
+
+  // Stores one field in the record; unknown keys are ignored
+  void integerField(TraceRecord& record, const std::string& key, long long value) {
+    switch (key[0]) {
+    case 'c': if (key == "cycle") record.cycle = value; break;
+    case 't': if (key == "time") record.time = value; break;
+    case 'p': if (key == "port") record.device = value; break;
+    case 'm': if (key == "modifiers") record.modifiers = value; break;
+    case 'b': if (key == "buttons") record.buttons = value; break;
+    case 'x': if (key == "x") record.x = value; break;
+    case 'y': if (key == "y") record.y = value; break;
+    case 'w': if (key == "wheel") record.wheel = value; break;
+    case 'h': if (key == "hwheel") record.hWheel = value; break;
+    case 'v': if (key == "version") record.version = value; break;
+    default: break;
+    }
+  }
+
+  // 'value' holds the decoded bytes (already un-hexed for JSON)
+  void stringField(TraceRecord& record, const std::string& key, std::string& value) {
+    if (key == "type") record.type = recordType(value);
+    else if (key == "device") record.device = deviceNumber(value);
+    else if (key == "text" || key == "raw" || key == "rgb" || key == "data") record.data.swap(value);
+    else if (key == "schema") schema.swap(value);
+  }
+
+  static bool isHexKey(const std::string& key) {
+    return key == "raw" || key == "rgb";
+  }
+
+  // --- JSON Lines: one flat object per line ---
+
+  bool nextJson(TraceRecord& record) {
+    const char* newline;
+    while (true) {
+      newline = (const char*)memchr(&buffer[start], '\n', end - start);
+      if (newline) break;
+      const size_t have = end - start;
+      if (!fill(have + 1)) {
+        if (have == 0) return false;
+        return fail("trace ends in the middle of a record");
+      }
+    }
+    const char* p = &buffer[start];
+    const char* lineEnd = newline;
+    start = newline + 1 - &buffer[0];
+    if (*p++ != '{') return fail("malformed JSON record");
+    while (p < lineEnd && *p != '}') {
+      if (*p == ',') p++;
+      if (!jsonString(p, lineEnd, key) || p >= lineEnd || *p++ != ':') return fail("malformed JSON record");
+      if (*p == '"') {
+        if (!jsonString(p, lineEnd, value)) return fail("malformed JSON string");
+        if (isHexKey(key) && !unhex(value)) return fail("malformed hex string");
+        stringField(record, key, value);
+      } else if (*p == '[') {
+        p++;
+        const bool wanted = (key == "usages");
+        while (p < lineEnd && *p != ']') {
+          if (*p == ',') p++;
+          char* after;
+          const unsigned long number = strtoul(p, &after, 10);
+          if (after == p) return fail("malformed JSON array");
+          if (wanted) record.usages.push_back(number);
+          p = after;
+        }
+        p++;
+      } else {
+        char* after;
+        const long long number = strtoll(p, &after, 10);
+        if (after == p) return fail("malformed JSON value");
+        integerField(record, key, number);
+        p = after;
+      }
+    }
+    return true;
+  }
+
+  // Reads a quoted string starting at 'p' into 'out', leaving 'p' after the closing quote
+  static bool jsonString(const char*& p, const char* limit, std::string& out) {
+    out.clear();
+    if (p >= limit || *p++ != '"') return false;
+    while (p < limit) {
+      const char* run = p;
+      while (p < limit && *p != '"' && *p != '\\') p++;
+      out.append(run, p - run);
+      if (p >= limit) return false;
+      if (*p++ == '"') return true;
+      if (p >= limit) return false;
+      const char c = *p++;
+      switch (c) {
+      case 'n': out.push_back('\n'); break;
+      case 't': out.push_back('\t'); break;
+      case 'r': out.push_back('\r'); break;
+      case 'b': out.push_back('\b'); break;
+      case 'f': out.push_back('\f'); break;
+      case 'u': {
+        if (limit - p < 4) return false;
+        char digits[5] = {p[0], p[1], p[2], p[3], 0};
+        const unsigned long code = strtoul(digits, NULL, 16);
+        p += 4;
+        // the writer only escapes single bytes; anything else is encoded as UTF-8
+        if (code < 0x100) {
+          out.push_back((char)code);
+        } else if (code < 0x800) {
+          out.push_back((char)(0xc0 | (code >> 6)));
+          out.push_back((char)(0x80 | (code & 0x3f)));
+        } else {
+          out.push_back((char)(0xe0 | (code >> 12)));
+          out.push_back((char)(0x80 | ((code >> 6) & 0x3f)));
+          out.push_back((char)(0x80 | (code & 0x3f)));
+        }
+        break;
+      }
+      default: out.push_back(c); break;
+      }
+    }
+    return false;
+  }
+
+  static int hexDigit(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+  }
+
+  static bool unhex(std::string& s) {
+    if (s.size() % 2) return false;
+    for (size_t i = 0; i < s.size() / 2; i++) {
+      const int high = hexDigit(s[2 * i]), low = hexDigit(s[2 * i + 1]);
+      if (high < 0 || low < 0) return false;
+      s[i] = (char)(high << 4 | low);
+    }
+    s.resize(s.size() / 2);
+    return true;
+  }
+
+  // --- CBOR sequence: one map per record ---
+
+  // Reads an item's head; 'major' is the major type, 'argument' its value (or
+  // length), and 'indefinite' is set for the 0x1f additional information
+  bool cborHead(uint8_t& major, unsigned long long& argument, bool& indefinite) {
+    if (!fill(1)) return false;
+    const uint8_t initial = buffer[start++];
+    major = initial >> 5;
+    const uint8_t info = initial & 0x1f;
+    indefinite = (info == 31);
+    if (info < 24 || indefinite) {
+      argument = indefinite ? 0 : info;
+      return true;
+    }
+    if (info > 27) return fail("malformed CBOR item");
+    const size_t size = (size_t)1 << (info - 24);
+    if (!fill(size)) return fail("trace ends in the middle of a record");
+    argument = 0;
+    for (size_t i = 0; i < size; i++) argument = (argument << 8) | (uint8_t)buffer[start++];
+    return true;
+  }
+
+  bool cborString(unsigned long long length, std::string& out) {
+    if (!fill(length)) return fail("trace ends in the middle of a record");
+    out.assign(&buffer[start], length);
+    start += length;
+    return true;
+  }
+
+  bool nextCbor(TraceRecord& record) {
+    uint8_t major;
+    unsigned long long argument;
+    bool indefinite;
+    if (!fill(1)) return false;  // clean end of the sequence
+    if (!cborHead(major, argument, indefinite) || major != 5) return fail("malformed CBOR record");
+    const unsigned long long entries = argument;
+    for (unsigned long long i = 0; indefinite || i < entries; i++) {
+      if (indefinite) {
+        if (!fill(1)) return fail("trace ends in the middle of a record");
+        if ((uint8_t)buffer[start] == 0xff) {
+          start++;
+          break;
+        }
+      }
+      bool keyIndefinite;
+      if (!cborHead(major, argument, keyIndefinite)) return fail("trace ends in the middle of a record");
+      if (major != 3 || keyIndefinite || !cborString(argument, key)) return fail("malformed CBOR key");
+      bool valueIndefinite;
+      unsigned long long valueArgument;
+      if (!cborHead(major, valueArgument, valueIndefinite) || valueIndefinite) return fail("malformed CBOR value");
+      switch (major) {
+      case 0:
+        integerField(record, key, (long long)valueArgument);
+        break;
+      case 1:
+        integerField(record, key, -1 - (long long)valueArgument);
+        break;
+      case 2:
+      case 3:
+        if (!cborString(valueArgument, value)) return false;
+        stringField(record, key, value);
+        break;
+      case 4:
+        for (unsigned long long j = 0; j < valueArgument; j++) {
+          uint8_t elementMajor;
+          unsigned long long element;
+          bool elementIndefinite;
+          if (!cborHead(elementMajor, element, elementIndefinite) || elementMajor != 0) return fail("malformed CBOR array");
+          if (key == "usages") record.usages.push_back(element);
+        }
+        break;
+      default:
+        return fail("unexpected CBOR value type");
+      }
+    }
+    return true;
+  }
+
+  FILE* file;
+  std::vector<char> buffer;
+  size_t start, end;  // unread part of 'buffer'
+  bool eof;
+  bool cbor;
+  uint32_t traceVersion;
+  std::string key, value, schema;  // reused between records
+  std::string message;
+};
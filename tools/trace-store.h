@@ -0,0 +1,245 @@
+// Random-access reader for trace stores (results/trace.store, see --trace-store
+// and cores/virtual/trace_store.h for the layout).
+//
+// Header-only; include it with -I support/x86/cores/virtual.  The file is
+// mapped, and a query only touches the blocks that its cycle range, devices
+// and byte conditions don't rule out from the index:
+//
+//   TraceStore store;
+//   if (!store.open("results/trace.store")) { fprintf(stderr, "%s\n", store.error().c_str()); ... }
+//   StoreQuery query(EVENT_REPORT);
+//   query.firstCycle = 1000;
+//   query.devices = 1 << 0;  // keyboard
+//   query.conditions.push_back(StoreCondition::bits(1 + 0x04 / 8, 1 << (0x04 % 8)));  // 'a' held
+//   store.query(query, [](const StoreRecord& record) { ...; return true; });  // FALSE to stop
+//
+// Once open, a store can be queried from several threads at once.
+
+#pragma once
+
+#include "trace_store.h"
+#include "event_bus.h"  // EventType
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <atomic>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+struct StoreRecord {
+  uint8_t type;  // EventType
+  uint32_t cycle;
+  uint8_t device;
+  const uint8_t* data;  // into the mapping; valid while the TraceStore is open
+  size_t length;
+};
+
+// A condition on payload byte 'offset'; records shorter than that never match
+struct StoreCondition {
+  unsigned offset;
+  bool bitsOnly;  // match (byte & low) == low instead of low <= byte <= high
+  uint8_t low, high;
+
+  static StoreCondition range(unsigned offset, uint8_t low, uint8_t high) {
+    StoreCondition condition = {offset, false, low, high};
+    return condition;
+  }
+  static StoreCondition bits(unsigned offset, uint8_t mask) {
+    StoreCondition condition = {offset, true, mask, 0xff};
+    return condition;
+  }
+
+  bool matches(uint8_t value) const {
+    return bitsOnly ? (value & low) == low : (value >= low && value <= high);
+  }
+};
+
+struct StoreQuery {
+  explicit StoreQuery(uint8_t type) : type(type), firstCycle(0), lastCycle(UINT32_MAX), devices(~0u) {}
+
+  uint8_t type;  // EventType
+  uint32_t firstCycle, lastCycle;  // inclusive
+  uint32_t devices;  // bit N for device N, as in StoreBlockHeader::devices
+  std::vector<StoreCondition> conditions;  // all must match
+};
+
+class TraceStore {
+ public:
+  TraceStore() : base(NULL), size(0), indexRecovered(false), read(0) {}
+  ~TraceStore() {
+    if (base) munmap((void*)base, size);
+  }
+
+  // Maps the store and loads its index, or rebuilds it from the block headers
+  // if the run didn't finish writing it (see recovered()).
+  bool open(const char* path) {
+    const int fd = ::open(path, O_RDONLY);
+    if (fd < 0) return fail(std::string("can't open ") + path);
+    struct stat info;
+    if (fstat(fd, &info) != 0 || (size_t)info.st_size < sizeof(StoreHeader)) {
+      close(fd);
+      return fail("not a trace store (too short)");
+    }
+    size = info.st_size;
+    void* mapping = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED) return fail(std::string("can't map ") + path);
+    base = (const uint8_t*)mapping;
+
+    StoreHeader header;
+    memcpy(&header, base, sizeof(header));
+    if (memcmp(header.magic, STORE_MAGIC, sizeof(header.magic)) != 0) return fail("not a trace store");
+    if (header.version > STORE_VERSION) return fail("trace store was written by a newer version");
+    if (header.blockHeaderSize != sizeof(StoreBlockHeader)) return fail("unexpected block header size");
+    if (!loadIndex()) recoverIndex();
+    for (size_t i = 0; i < index.size(); i++) byType[index[i].type].push_back(i);
+    return true;
+  }
+
+  const std::string& error(void) const { return message; }
+  bool recovered(void) const { return indexRecovered; }
+  const std::vector<StoreBlockHeader>& blocks(void) const { return index; }
+  size_t blocksRead(void) const { return read; }  // by queries so far
+
+  // Whether a block could have records matching 'query', from its header alone
+  bool mayMatch(const StoreBlockHeader& block, const StoreQuery& query) const {
+    if (block.type != query.type || block.lastCycle < query.firstCycle || block.firstCycle > query.lastCycle) return false;
+    if (!(block.devices & query.devices)) return false;
+    const uint8_t* minimum = column(block, COLUMN_MINIMUM);
+    const uint8_t* maximum = minimum + padded(block.statsLength);
+    const uint8_t* bitsSet = maximum + padded(block.statsLength);
+    for (size_t i = 0; i < query.conditions.size(); i++) {
+      const StoreCondition& condition = query.conditions[i];
+      if (condition.offset >= STORE_STATS_BYTES) continue;  // no stats; has to be read
+      if (condition.offset >= block.statsLength) return false;  // no record that long
+      const unsigned k = condition.offset;
+      if (condition.bitsOnly ? (bitsSet[k] & condition.low) != condition.low
+                             : (maximum[k] < condition.low || minimum[k] > condition.high)) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  // Calls visit(const StoreRecord&) for each matching record, in cycle order,
+  // until it returns FALSE.  Returns the number of records visited.
+  template <typename Visitor>
+  size_t query(const StoreQuery& query, Visitor visit) {
+    const std::vector<size_t>& blocksOfType = byType[query.type];
+    // blocks of a type are in cycle order; find the first that reaches firstCycle
+    size_t first = std::lower_bound(blocksOfType.begin(), blocksOfType.end(), query.firstCycle,
+                                    [this](size_t block, uint32_t cycle) { return index[block].lastCycle < cycle; }) -
+                   blocksOfType.begin();
+    size_t visited = 0;
+    for (size_t b = first; b < blocksOfType.size(); b++) {
+      const StoreBlockHeader& block = index[blocksOfType[b]];
+      if (block.firstCycle > query.lastCycle) break;
+      if (!mayMatch(block, query)) continue;
+      read++;
+      const uint32_t* cycles = (const uint32_t*)column(block, COLUMN_CYCLES);
+      const uint32_t* offsets = (const uint32_t*)column(block, COLUMN_OFFSETS);
+      const uint8_t* devices = column(block, COLUMN_DEVICES);
+      const uint8_t* payload = column(block, COLUMN_PAYLOAD);
+      for (size_t i = std::lower_bound(cycles, cycles + block.count, query.firstCycle) - cycles; i < block.count; i++) {
+        if (cycles[i] > query.lastCycle) break;
+        if (!(query.devices & (1u << (devices[i] < 31 ? devices[i] : 31)))) continue;
+        StoreRecord record = {block.type, cycles[i], devices[i], payload + offsets[i], offsets[i + 1] - offsets[i]};
+        bool matches = true;
+        for (size_t c = 0; c < query.conditions.size() && matches; c++) {
+          const StoreCondition& condition = query.conditions[c];
+          matches = condition.offset < record.length && condition.matches(record.data[condition.offset]);
+        }
+        if (!matches) continue;
+        visited++;
+        if (!visit(record)) return visited;
+      }
+    }
+    return visited;
+  }
+
+ private:
+  typedef enum {
+    COLUMN_CYCLES,
+    COLUMN_OFFSETS,
+    COLUMN_DEVICES,
+    COLUMN_MINIMUM,
+    COLUMN_PAYLOAD,
+  } Column;
+
+  static size_t padded(size_t length) {
+    return (length + 3) & ~(size_t)3;
+  }
+
+  // See the block layout in trace_store.h
+  const uint8_t* column(const StoreBlockHeader& block, Column which) const {
+    size_t offset = block.offset + sizeof(StoreBlockHeader);
+    if (which == COLUMN_CYCLES) return base + offset;
+    offset += padded(block.count * 4);
+    if (which == COLUMN_OFFSETS) return base + offset;
+    offset += padded((block.count + 1) * 4);
+    if (which == COLUMN_DEVICES) return base + offset;
+    offset += padded(block.count);
+    if (which == COLUMN_MINIMUM) return base + offset;
+    return base + offset + 3 * padded(block.statsLength);
+  }
+
+  // Whether a block header describes a complete block at 'offset'
+  bool validBlock(const StoreBlockHeader& block, uint64_t offset) const {
+    if (memcmp(block.marker, "BLK_", 4) != 0 || block.offset != offset) return false;
+    if (block.size < sizeof(StoreBlockHeader) || block.size > size - offset) return false;
+    if (block.statsLength > STORE_STATS_BYTES || block.count == 0) return false;
+    const size_t columns = sizeof(StoreBlockHeader) + padded(block.count * 4) + padded((block.count + 1) * 4) +
+                           padded(block.count) + 3 * padded(block.statsLength);
+    if (columns > block.size) return false;
+    const uint32_t* offsets = (const uint32_t*)column(block, COLUMN_OFFSETS);
+    return columns + offsets[block.count] <= block.size;
+  }
+
+  bool loadIndex(void) {
+    if (size < sizeof(StoreHeader) + sizeof(StoreTrailer)) return false;
+    StoreTrailer trailer;
+    memcpy(&trailer, base + size - sizeof(trailer), sizeof(trailer));
+    if (memcmp(trailer.magic, STORE_MAGIC, sizeof(trailer.magic)) != 0) return false;
+    if (trailer.indexOffset + (uint64_t)trailer.blocks * sizeof(StoreBlockHeader) + sizeof(trailer) != size) return false;
+    index.resize(trailer.blocks);
+    if (trailer.blocks) memcpy(index.data(), base + trailer.indexOffset, trailer.blocks * sizeof(StoreBlockHeader));
+    for (size_t i = 0; i < index.size(); i++) {
+      if (index[i].offset + index[i].size > trailer.indexOffset || !validBlock(index[i], index[i].offset)) {
+        index.clear();
+        return false;
+      }
+    }
+    return true;
+  }
+
+  // Walks the blocks from the start, up to the first incomplete one
+  void recoverIndex(void) {
+    indexRecovered = true;
+    index.clear();
+    uint64_t offset = sizeof(StoreHeader);
+    while (offset + sizeof(StoreBlockHeader) <= size) {
+      StoreBlockHeader block;
+      memcpy(&block, base + offset, sizeof(block));
+      if (!validBlock(block, offset)) break;
+      index.push_back(block);
+      offset += block.size;
+    }
+  }
+
+  bool fail(const std::string& why) {
+    message = why;
+    return false;
+  }
+
+  const uint8_t* base;
+  size_t size;
+  std::vector<StoreBlockHeader> index;
+  std::vector<size_t> byType[256];  // positions in 'index'
+  bool indexRecovered;
+  std::atomic<size_t> read;
+  std::string message;
+};